@@ -154,6 +154,26 @@ typedef struct __dc1394camera_list_t
     dc1394camera_id_t    *ids;
 } dc1394camera_list_t;
 
+/**
+ * Kinds of hotplug events
+ */
+typedef enum {
+    DC1394_CAMERA_ARRIVED=896,
+    DC1394_CAMERA_REMOVED
+} dc1394camera_event_type_t;
+#define DC1394_CAMERA_EVENT_TYPE_MIN    DC1394_CAMERA_ARRIVED
+#define DC1394_CAMERA_EVENT_TYPE_MAX    DC1394_CAMERA_REMOVED
+#define DC1394_CAMERA_EVENT_TYPE_NUM   (DC1394_CAMERA_EVENT_TYPE_MAX - DC1394_CAMERA_EVENT_TYPE_MIN + 1)
+
+/**
+ * A camera that came or went, as reported by dc1394_camera_monitor_get_events()
+ */
+typedef struct
+{
+    dc1394camera_event_type_t type;
+    dc1394camera_id_t         id;
+} dc1394camera_event_t;
+
 typedef struct __dc1394_t dc1394_t;
 
 #ifdef __cplusplus
@@ -174,6 +194,16 @@ dc1394_t* dc1394_new (void);
  */
 void dc1394_free (dc1394_t *dc1394);
 
+/**
+ * Sets the directory where the static descriptors of the cameras are kept between runs, or disables the cache
+ * if directory is NULL. The descriptors of a camera are its directory entries, vendor and model strings and
+ * its inquiry registers; they are saved in one file per unit, named after the GUID, and reused only if the
+ * software version and a few registers of the camera still read the same. The directory is created if needed
+ * but not its parents. The cache is disabled by default, unless the DC1394_DESCRIPTOR_CACHE environment
+ * variable is set.
+ */
+dc1394error_t dc1394_set_descriptor_cache (dc1394_t *dc1394, const char *directory);
+
 /**
  * Sets and gets the broadcast flag of a camera. If the broadcast flag is set,
  * all devices on the bus will execute the command. Useful to sync ISO start
@@ -218,6 +248,34 @@ dc1394error_t dc1394_camera_enumerate(dc1394_t *dc1394, dc1394camera_list_t **li
  */
 void dc1394_camera_free_list(dc1394camera_list_t *list);
 
+/**
+ * Starts watching for cameras that are plugged in or removed. The cameras present when the monitor starts are
+ * not reported as events: they are listed by dc1394_camera_enumerate(). Only the platforms that get hotplug
+ * notifications (juju, USB and the simulated one) are watched; their device lists are read again when they
+ * notify, without probing the other platforms.
+ */
+dc1394error_t dc1394_camera_monitor_start(dc1394_t *dc1394);
+
+/**
+ * Stops watching for cameras. Events not yet read are dropped.
+ */
+void dc1394_camera_monitor_stop(dc1394_t *dc1394);
+
+/**
+ * Gets a file descriptor that is readable when cameras may have come or gone, to be used for select(). It
+ * stays readable until dc1394_camera_monitor_get_events() is called.
+ */
+int dc1394_camera_monitor_get_fileno(dc1394_t *dc1394);
+
+/**
+ * Updates the camera list from the platforms that notified a change and gets the events since the last call.
+ * *num_events is the size of events on input and the number of events on output; events that do not fit are
+ * kept for the next call. Removals come before arrivals, so that a camera that went away and came back is
+ * reported twice. Does not block.
+ */
+dc1394error_t dc1394_camera_monitor_get_events(dc1394_t *dc1394, dc1394camera_event_t *events,
+        uint32_t *num_events);
+
 /**
  * Create a new camera based on a GUID (Global Unique IDentifier)
  */
@@ -19,20 +19,213 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "control.h"
 #include "platform.h"
 #include "internal.h"
 
+/* Id of the private copies made by dc1394_capture_retain() */
+#define CAPTURE_COPY_ID     0xffffffffU
+
+/* Holders of each DMA buffer, indexed by frame id. The lock also keeps
+   the final enqueues of different threads from overlapping. */
+struct _capture_refs_t {
+    pthread_mutex_t            lock;
+    uint32_t                   num_buffers;
+    uint32_t                   held;       /* buffers with more than one holder */
+    dc1394retain_policy_t      policy;
+    uint32_t                   max_held;
+    uint32_t                   refs[];
+};
+
+static capture_refs_t *
+capture_refs_new (uint32_t num_buffers)
+{
+    capture_refs_t * r = calloc (1, sizeof (capture_refs_t) +
+            num_buffers * sizeof (uint32_t));
+    if (!r)
+        return NULL;
+    pthread_mutex_init (&r->lock, NULL);
+    r->num_buffers = num_buffers;
+    r->policy = DC1394_RETAIN_POLICY_HOLD;
+    r->max_held = num_buffers / 2;
+    return r;
+}
+
+static void
+capture_refs_free (capture_refs_t * r)
+{
+    if (!r)
+        return;
+    pthread_mutex_destroy (&r->lock);
+    free (r);
+}
+
+void
+capture_refs_frame_delivered (dc1394camera_t * camera,
+        dc1394video_frame_t * frame)
+{
+    capture_refs_t * r = DC1394_CAMERA_PRIV (camera)->capture_refs;
+
+    if (r && frame->id < r->num_buffers) {
+        pthread_mutex_lock (&r->lock);
+        r->refs[frame->id] = 1;
+        pthread_mutex_unlock (&r->lock);
+    }
+}
+
+static uint64_t
+capture_now (void)
+{
+    struct timeval now;
+    gettimeofday (&now, NULL);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/* Remembers what the camera has to be given back after a bus reset */
+static void
+capture_watch_resets (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394switch_t iso = DC1394_OFF;
+
+    cpriv->capture_generation = 0;
+    if (d->capture_check_reset)
+        d->capture_check_reset (cpriv->pcam, &cpriv->capture_generation);
+    if (dc1394_video_get_iso_channel (camera, &cpriv->capture_iso_channel)
+            != DC1394_SUCCESS)
+        cpriv->capture_iso_channel = 0;
+    dc1394_video_get_transmission (camera, &iso);
+    cpriv->capture_streaming = iso == DC1394_ON;
+    cpriv->capture_gap_start = 0;
+    cpriv->capture_reset_time = 0;
+    cpriv->capture_reset_pending = 0;
+}
+
+/*
+  The bus forgets the isochronous resources on a reset and the camera may
+  stop sending or go back to its default channel, while the receive context
+  of the host stays as it was. So the resources recorded in iso.c are
+  allocated again and the camera is given its channel and transmission back.
+*/
+static dc1394error_t
+capture_recover (dc1394camera_t * camera, uint32_t generation)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394capture_stats_t * stats = &cpriv->capture_stats;
+    dc1394switch_t iso;
+    uint32_t channel;
+    dc1394error_t err;
+
+    dc1394_log_warning ("Bus reset while capturing from camera 0x%"PRIx64
+            ", recovering", camera->guid);
+    stats->bus_resets++;
+    cpriv->capture_generation = generation;
+    cpriv->capture_reset_time = capture_now ();
+    if (!cpriv->capture_gap_start)
+        cpriv->capture_gap_start = cpriv->last_frame_timestamp ?
+            cpriv->last_frame_timestamp : cpriv->capture_reset_time;
+    if (d->capture_follow_reset) {
+        err = d->capture_follow_reset (cpriv->pcam, generation);
+        DC1394_ERR_RTN (err, "Could not follow the bus reset");
+    }
+    dc1394_camera_flush_register_cache (camera);
+
+    err = iso_reallocate (camera);
+    DC1394_ERR_RTN (err, "Could not allocate the isochronous resources again");
+
+    err = dc1394_video_get_iso_channel (camera, &channel);
+    DC1394_ERR_RTN (err, "Could not get the isochronous channel");
+    if (channel != cpriv->capture_iso_channel) {
+        err = dc1394_video_set_iso_channel (camera, cpriv->capture_iso_channel);
+        DC1394_ERR_RTN (err, "Could not set the isochronous channel again");
+    }
+
+    if (cpriv->capture_streaming) {
+        err = dc1394_video_get_transmission (camera, &iso);
+        DC1394_ERR_RTN (err, "Could not get the transmission status");
+        if (iso == DC1394_OFF) {
+            err = dc1394_video_set_transmission (camera, DC1394_ON);
+            DC1394_ERR_RTN (err, "Could not restart the transmission");
+        }
+    }
+
+    stats->recoveries++;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+capture_check_bus_reset (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    uint32_t generation;
+    dc1394error_t err;
+
+    if (!d->capture_check_reset || cpriv->capture_num_buffers == 0)
+        return DC1394_SUCCESS;
+    if (cpriv->capture_thread) {
+        // the receive thread owns the notifications
+        if (!__sync_bool_compare_and_swap (&cpriv->capture_reset_pending, 1, 0))
+            return DC1394_SUCCESS;
+        __sync_synchronize ();
+        generation = cpriv->capture_reset_generation;
+    }
+    else {
+        err = d->capture_check_reset (cpriv->pcam, &generation);
+        DC1394_ERR_RTN (err, "Could not check for a bus reset");
+    }
+    if (generation == cpriv->capture_generation)
+        return DC1394_SUCCESS;
+    return capture_recover (camera, generation);
+}
+
+int
+capture_notice_bus_reset (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    uint32_t generation;
+
+    if (!d->capture_check_reset ||
+        d->capture_check_reset (cpriv->pcam, &generation) != DC1394_SUCCESS)
+        return 0;
+    if (generation == cpriv->capture_generation ||
+        (cpriv->capture_reset_pending &&
+         generation == cpriv->capture_reset_generation))
+        return 0;
+    cpriv->capture_reset_generation = generation;
+    __sync_synchronize ();
+    cpriv->capture_reset_pending = 1;
+    return 1;
+}
+
 dc1394error_t
 dc1394_capture_setup (dc1394camera_t *camera, uint32_t num_dma_buffers,
         uint32_t flags)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394error_t err;
     if (!d->capture_setup)
         return DC1394_FUNCTION_NOT_SUPPORTED;
-    return d->capture_setup (cpriv->pcam, num_dma_buffers, flags);
+    err = d->capture_setup (cpriv->pcam, num_dma_buffers, flags);
+    if (err == DC1394_SUCCESS) {
+        cpriv->capture_num_buffers = num_dma_buffers;
+        cpriv->capture_refs = capture_refs_new (num_dma_buffers);
+        dc1394_capture_reset_stats (camera);
+        capture_watch_resets (camera);
+    }
+    return err;
 }
 
 dc1394error_t
@@ -42,6 +235,11 @@ dc1394_capture_stop (dc1394camera_t *camera)
     const platform_dispatch_t * d = cpriv->platform->dispatch;
     if (!d->capture_stop)
         return DC1394_FUNCTION_NOT_SUPPORTED;
+    if (cpriv->capture_thread)
+        dc1394_capture_stop_thread (camera);
+    cpriv->capture_num_buffers = 0;
+    capture_refs_free (cpriv->capture_refs);
+    cpriv->capture_refs = NULL;
     return d->capture_stop (cpriv->pcam);
 }
 
@@ -50,32 +248,202 @@ dc1394_capture_get_fileno (dc1394camera_t * camera)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = cpriv->platform->dispatch;
+    if (cpriv->capture_thread)
+        return capture_thread_get_fileno (cpriv->capture_thread);
     if (!d->capture_get_fileno)
         return DC1394_FUNCTION_NOT_SUPPORTED;
     return d->capture_get_fileno (cpriv->pcam);
 }
 
+/*
+  Waits for a frame while watching the bus resets signalled by the backend.
+  Frames are taken without blocking so that those the backend already holds
+  are never waited for; the latest is then kept by giving the older back.
+*/
+static dc1394error_t
+capture_dequeue_watching_resets (dc1394camera_t * camera, int reset_fd,
+        dc1394capture_policy_t policy, dc1394video_frame_t ** frame)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394video_frame_t * newer;
+    struct pollfd fds[2];
+    dc1394error_t err;
+
+    fds[0].fd = d->capture_get_fileno (cpriv->pcam);
+    fds[0].events = POLLIN;
+    fds[1].fd = reset_fd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        err = d->capture_dequeue (cpriv->pcam, DC1394_CAPTURE_POLICY_POLL,
+                frame);
+        if (err != DC1394_SUCCESS || *frame)
+            break;
+        if (poll (fds, 2, -1) < 0 && errno != EINTR) {
+            dc1394_log_error ("poll() failed while waiting for a frame");
+            return DC1394_FAILURE;
+        }
+        if (fds[1].revents) {
+            err = capture_check_bus_reset (camera);
+            if (err != DC1394_SUCCESS)
+                return err;
+        }
+    }
+
+    if (err == DC1394_SUCCESS && policy == DC1394_CAPTURE_POLICY_LATEST) {
+        while (d->capture_dequeue (cpriv->pcam, DC1394_CAPTURE_POLICY_POLL,
+                    &newer) == DC1394_SUCCESS && newer) {
+            d->capture_enqueue (cpriv->pcam, *frame);
+            capture_stats_frames_dropped (camera, 1);
+            *frame = newer;
+        }
+    }
+    return err;
+}
+
 dc1394error_t
 dc1394_capture_dequeue (dc1394camera_t * camera, dc1394capture_policy_t policy,
         dc1394video_frame_t **frame)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = cpriv->platform->dispatch;
-    if (!d->capture_dequeue)
-        return DC1394_FUNCTION_NOT_SUPPORTED;
-    return d->capture_dequeue (cpriv->pcam, policy, frame);
+    dc1394error_t err;
+    int reset_fd = -1;
+
+    // a bus reset is recovered from here, in the thread of the application
+    *frame = NULL;
+    err = capture_check_bus_reset (camera);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    if (cpriv->capture_thread)
+        err = capture_thread_dequeue (cpriv->capture_thread, policy, frame);
+    else {
+        if (!d->capture_dequeue)
+            return DC1394_FUNCTION_NOT_SUPPORTED;
+        if (policy != DC1394_CAPTURE_POLICY_POLL &&
+            d->capture_get_reset_fileno && d->capture_get_fileno)
+            reset_fd = d->capture_get_reset_fileno (cpriv->pcam);
+        if (reset_fd >= 0)
+            err = capture_dequeue_watching_resets (camera, reset_fd, policy,
+                    frame);
+        else
+            err = d->capture_dequeue (cpriv->pcam, policy, frame);
+        if (err == DC1394_SUCCESS && *frame)
+            capture_stats_frame_dequeued (camera, *frame);
+    }
+    if (err == DC1394_SUCCESS && *frame)
+        capture_refs_frame_delivered (camera, *frame);
+    return err;
 }
 
-dc1394error_t
-dc1394_capture_enqueue (dc1394camera_t * camera, dc1394video_frame_t * frame)
+static dc1394error_t
+capture_enqueue_buffer (dc1394camera_t * camera, dc1394video_frame_t * frame)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = cpriv->platform->dispatch;
+    cpriv->capture_stats.frames_enqueued++;
+    if (cpriv->capture_thread)
+        return capture_thread_enqueue (cpriv->capture_thread, frame);
     if (!d->capture_enqueue)
         return DC1394_FUNCTION_NOT_SUPPORTED;
     return d->capture_enqueue (cpriv->pcam, frame);
 }
 
+dc1394error_t
+dc1394_capture_enqueue (dc1394camera_t * camera, dc1394video_frame_t * frame)
+{
+    capture_refs_t * r = DC1394_CAMERA_PRIV (camera)->capture_refs;
+    dc1394error_t err;
+
+    if (frame->id == CAPTURE_COPY_ID) {
+        free (frame);
+        return DC1394_SUCCESS;
+    }
+    if (!r || frame->id >= r->num_buffers)
+        return capture_enqueue_buffer (camera, frame);
+
+    pthread_mutex_lock (&r->lock);
+    if (r->refs[frame->id] > 1) {
+        if (--r->refs[frame->id] == 1)
+            r->held--;
+        pthread_mutex_unlock (&r->lock);
+        return DC1394_SUCCESS;
+    }
+    r->refs[frame->id] = 0;
+    err = capture_enqueue_buffer (camera, frame);
+    pthread_mutex_unlock (&r->lock);
+    return err;
+}
+
+dc1394error_t
+dc1394_capture_release (dc1394camera_t * camera, dc1394video_frame_t * frame)
+{
+    return dc1394_capture_enqueue (camera, frame);
+}
+
+dc1394error_t
+dc1394_capture_retain (dc1394camera_t * camera, dc1394video_frame_t * frame,
+        dc1394video_frame_t ** handle)
+{
+    capture_refs_t * r = DC1394_CAMERA_PRIV (camera)->capture_refs;
+    dc1394video_frame_t * copy;
+
+    *handle = NULL;
+    if (!r)
+        return DC1394_CAPTURE_IS_NOT_SET;
+    if (frame->id >= r->num_buffers)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&r->lock);
+    if (r->refs[frame->id] == 0) {
+        pthread_mutex_unlock (&r->lock);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+    // a buffer that is already shared costs nothing more to share again
+    if (r->refs[frame->id] > 1 || r->held < r->max_held ||
+        r->policy == DC1394_RETAIN_POLICY_HOLD) {
+        if (r->refs[frame->id]++ == 1)
+            r->held++;
+        pthread_mutex_unlock (&r->lock);
+        *handle = frame;
+        return DC1394_SUCCESS;
+    }
+    pthread_mutex_unlock (&r->lock);
+
+    if (r->policy == DC1394_RETAIN_POLICY_REFUSE)
+        return DC1394_FAILURE;
+
+    copy = malloc (sizeof (dc1394video_frame_t) + frame->total_bytes);
+    if (!copy)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    memcpy (copy, frame, sizeof (dc1394video_frame_t));
+    copy->image = (unsigned char *) (copy + 1);
+    copy->allocated_image_bytes = frame->total_bytes;
+    copy->id = CAPTURE_COPY_ID;
+    memcpy (copy->image, frame->image, frame->total_bytes);
+    *handle = copy;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_capture_set_retain_policy (dc1394camera_t * camera,
+        dc1394retain_policy_t policy, uint32_t max_held)
+{
+    capture_refs_t * r = DC1394_CAMERA_PRIV (camera)->capture_refs;
+
+    if (!r)
+        return DC1394_CAPTURE_IS_NOT_SET;
+    if (policy < DC1394_RETAIN_POLICY_MIN || policy > DC1394_RETAIN_POLICY_MAX)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    pthread_mutex_lock (&r->lock);
+    r->policy = policy;
+    r->max_held = max_held;
+    pthread_mutex_unlock (&r->lock);
+    return DC1394_SUCCESS;
+}
+
 dc1394bool_t
 dc1394_capture_is_frame_corrupt (dc1394camera_t * camera,
         dc1394video_frame_t * frame)
@@ -88,3 +456,189 @@ dc1394_capture_is_frame_corrupt (dc1394camera_t * camera,
         return DC1394_FALSE;
     return d->capture_is_frame_corrupt (cpriv->pcam, frame);
 }
+
+dc1394error_t
+dc1394_capture_set_roi (dc1394camera_t * camera, uint32_t left, uint32_t top,
+        uint32_t width, uint32_t height)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394video_mode_t mode;
+    dc1394video_frame_t proto;
+    dc1394color_coding_t coding;
+    dc1394switch_t iso;
+    uint32_t packet_size, old_left, old_top, old_width, old_height;
+    dc1394error_t err, err2;
+
+    if (!d->capture_set_layout)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    if (cpriv->capture_num_buffers == 0)
+        return DC1394_CAPTURE_IS_NOT_SET;
+    if (cpriv->capture_thread) {
+        dc1394_log_error ("The region of interest can not be changed "
+                "while the receive thread runs");
+        return DC1394_CAPTURE_IS_RUNNING;
+    }
+
+    err = dc1394_video_get_mode (camera, &mode);
+    DC1394_ERR_RTN (err, "Could not get the video mode");
+    if (!dc1394_is_video_mode_scalable (mode))
+        return DC1394_INVALID_VIDEO_MODE;
+    err = dc1394_format7_get_roi (camera, mode, &coding, &packet_size,
+            &old_left, &old_top, &old_width, &old_height);
+    DC1394_ERR_RTN (err, "Could not get the current region of interest");
+
+    // a move leaves the packets as they are: the camera takes the new
+    // position at a frame boundary and only the frame metadata changes
+    if (width == old_width && height == old_height) {
+        err = dc1394_format7_set_image_position (camera, mode, left, top);
+        DC1394_ERR_RTN (err, "Could not set the image position");
+        err = capture_basic_setup (camera, &proto);
+        DC1394_ERR_RTN (err, "Could not get the new frame layout");
+        return d->capture_set_layout (cpriv->pcam, &proto);
+    }
+
+    // a new size changes the packets of each frame, so transmission pauses
+    // while the backend lays its buffers out again
+    err = dc1394_video_get_transmission (camera, &iso);
+    DC1394_ERR_RTN (err, "Could not get the transmission status");
+    if (iso == DC1394_ON) {
+        err = dc1394_video_set_transmission (camera, DC1394_OFF);
+        DC1394_ERR_RTN (err, "Could not stop the transmission");
+    }
+
+    err = dc1394_format7_set_roi (camera, mode, coding,
+            DC1394_QUERY_FROM_CAMERA, left, top, width, height);
+    if (err == DC1394_SUCCESS)
+        err = capture_basic_setup (camera, &proto);
+    if (err == DC1394_SUCCESS)
+        err = d->capture_set_layout (cpriv->pcam, &proto);
+    if (err != DC1394_SUCCESS)
+        dc1394_format7_set_roi (camera, mode, coding, packet_size,
+                old_left, old_top, old_width, old_height);
+
+    if (iso == DC1394_ON) {
+        err2 = dc1394_video_set_transmission (camera, DC1394_ON);
+        if (err == DC1394_SUCCESS)
+            err = err2;
+    }
+    DC1394_ERR_RTN (err, "Could not change the region of interest");
+    return err;
+}
+
+dc1394error_t
+dc1394_capture_set_transfers (dc1394camera_t * camera, uint32_t num_transfers)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+
+    if (!d->capture_set_transfers)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    if (cpriv->capture_num_buffers > 0)
+        return DC1394_CAPTURE_IS_RUNNING;
+    return d->capture_set_transfers (cpriv->pcam, num_transfers);
+}
+
+static int
+histogram_bin (uint64_t usec)
+{
+    int bin;
+    if (usec < 2)
+        return 0;
+    bin = 63 - __builtin_clzll (usec);
+    if (bin >= DC1394_CAPTURE_HISTOGRAM_BINS)
+        bin = DC1394_CAPTURE_HISTOGRAM_BINS - 1;
+    return bin;
+}
+
+void
+capture_stats_frame_dequeued (dc1394camera_t * camera,
+        dc1394video_frame_t * frame)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    dc1394capture_stats_t * stats = &cpriv->capture_stats;
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    uint32_t filled = frame->frames_behind + 1;
+    uint64_t now_us;
+
+    stats->frames_dequeued++;
+    if (filled > stats->ring_high_water)
+        stats->ring_high_water = filled;
+    if (d->capture_is_frame_corrupt &&
+        d->capture_is_frame_corrupt (cpriv->pcam, frame) == DC1394_TRUE)
+        stats->frames_corrupt++;
+
+    // the first frame taken after a bus reset closes the gap; the interval
+    // across it says nothing about the jitter
+    if (cpriv->capture_gap_start) {
+        uint64_t end = frame->timestamp ? frame->timestamp : capture_now ();
+        if (end >= cpriv->capture_reset_time) {
+            uint64_t gap = end - cpriv->capture_gap_start;
+            stats->last_gap = gap;
+            if (gap > stats->max_gap)
+                stats->max_gap = gap;
+            cpriv->capture_gap_start = 0;
+            cpriv->last_frame_timestamp = 0;
+            cpriv->last_frame_interval = 0;
+        }
+    }
+
+    if (frame->timestamp == 0)
+        return;
+
+    now_us = capture_now ();
+    if (now_us > frame->timestamp)
+        stats->latency_histogram[histogram_bin (now_us - frame->timestamp)]++;
+    else
+        stats->latency_histogram[0]++;
+
+    if (cpriv->last_frame_timestamp && frame->timestamp > cpriv->last_frame_timestamp) {
+        uint64_t interval = frame->timestamp - cpriv->last_frame_timestamp;
+        if (cpriv->last_frame_interval) {
+            uint64_t jitter = interval > cpriv->last_frame_interval ?
+                interval - cpriv->last_frame_interval :
+                cpriv->last_frame_interval - interval;
+            stats->jitter_histogram[histogram_bin (jitter)]++;
+        }
+        cpriv->last_frame_interval = interval;
+    }
+    cpriv->last_frame_timestamp = frame->timestamp;
+}
+
+void
+capture_stats_frames_dropped (dc1394camera_t * camera, uint32_t count)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+
+    // the application thread drops frames too when a receive thread runs
+    __sync_fetch_and_add (&cpriv->capture_stats.frames_dropped, count);
+}
+
+void
+capture_stats_ring_overrun (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+
+    __sync_fetch_and_add (&cpriv->capture_stats.ring_overruns, 1);
+}
+
+dc1394error_t
+dc1394_capture_get_stats (dc1394camera_t * camera, dc1394capture_stats_t * stats)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    if (!stats)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    memcpy (stats, &cpriv->capture_stats, sizeof (dc1394capture_stats_t));
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_capture_reset_stats (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    memset (&cpriv->capture_stats, 0, sizeof (dc1394capture_stats_t));
+    cpriv->last_frame_timestamp = 0;
+    cpriv->last_frame_interval = 0;
+    cpriv->capture_gap_start = 0;
+    return DC1394_SUCCESS;
+}
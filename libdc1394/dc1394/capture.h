@@ -36,24 +36,101 @@
 /**
  * The capture policy.
  *
- * Can be blocking (wait for a frame forever) or polling (returns if no frames is in the ring buffer)
+ * Can be blocking (wait for a frame forever) or polling (returns if no frames is in the ring buffer).
+ * The LATEST policy blocks like WAIT, but when several frames are ready it gives all older ones back to
+ * the DMA engine and only returns the most recent one (frames_behind is then 0).
  */
 typedef enum {
     DC1394_CAPTURE_POLICY_WAIT=672,
-    DC1394_CAPTURE_POLICY_POLL
+    DC1394_CAPTURE_POLICY_POLL,
+    DC1394_CAPTURE_POLICY_LATEST
 } dc1394capture_policy_t;
 #define DC1394_CAPTURE_POLICY_MIN    DC1394_CAPTURE_POLICY_WAIT
-#define DC1394_CAPTURE_POLICY_MAX    DC1394_CAPTURE_POLICY_POLL
+#define DC1394_CAPTURE_POLICY_MAX    DC1394_CAPTURE_POLICY_LATEST
 #define DC1394_CAPTURE_POLICY_NUM   (DC1394_CAPTURE_POLICY_MAX - DC1394_CAPTURE_POLICY_MIN + 1)
 
+/**
+ * What dc1394_capture_retain() does once the number of buffers kept out of the ring by extra holders has
+ * reached its limit: keep one more anyway (HOLD, the default), give the new holder a private copy of the
+ * frame (COPY), or fail (REFUSE).
+ */
+typedef enum {
+    DC1394_RETAIN_POLICY_HOLD=864,
+    DC1394_RETAIN_POLICY_COPY,
+    DC1394_RETAIN_POLICY_REFUSE
+} dc1394retain_policy_t;
+#define DC1394_RETAIN_POLICY_MIN    DC1394_RETAIN_POLICY_HOLD
+#define DC1394_RETAIN_POLICY_MAX    DC1394_RETAIN_POLICY_REFUSE
+#define DC1394_RETAIN_POLICY_NUM   (DC1394_RETAIN_POLICY_MAX - DC1394_RETAIN_POLICY_MIN + 1)
+
 /**
  * Capture flags. Currently limited to switching automatic functions on/off: channel allocation, bandwidth allocation and automatic
- * starting of ISO transmission
+ * starting of ISO transmission, and to keeping the DMA ring allocated between captures. With DC1394_CAPTURE_FLAGS_KEEP_BUFFERS the
+ * next dc1394_capture_setup() reuses the ring if it fits, so switching video modes does not map new buffers; it is released when a
+ * capture set up without the flag stops, or when the camera is freed.
  */
 #define DC1394_CAPTURE_FLAGS_CHANNEL_ALLOC   0x00000001U
 #define DC1394_CAPTURE_FLAGS_BANDWIDTH_ALLOC 0x00000002U
 #define DC1394_CAPTURE_FLAGS_DEFAULT         0x00000004U /* a reasonable default value: do bandwidth and channel allocation */
 #define DC1394_CAPTURE_FLAGS_AUTO_ISO        0x00000008U /* automatically start iso before capture and stop it after */
+#define DC1394_CAPTURE_FLAGS_KEEP_BUFFERS    0x00000010U /* keep the DMA ring after capture_stop for the next setup to reuse */
+
+/**
+ * Number of bins of the capture histograms. Bin 0 counts values below 2us, bin i values in [2^i, 2^(i+1))us
+ * and the last bin everything above.
+ */
+#define DC1394_CAPTURE_HISTOGRAM_BINS   24
+
+/**
+ * Capture statistics of a camera, counted since dc1394_capture_setup() or dc1394_capture_reset_stats().
+ * Latency is the time between the completion of a frame and its dequeue; jitter is the difference between
+ * two consecutive inter-frame intervals. A ring overrun is counted by the backends each time the DMA engine is
+ * left without a free buffer, so that the frames the camera sends until one is given back are lost; it is
+ * not counted for frames the user chose to skip. A frame is counted as dropped when it was captured but never
+ * reached the user because of a policy: skipped by the LATEST policy, or dropped by the receive thread when
+ * its queue was full.
+ * After a bus reset the capture is recovered automatically by dc1394_capture_dequeue(): the isochronous
+ * resources are allocated again, the camera is given its channel back and restarted if it was streaming. A
+ * gap is the time between the last frame before a reset and the first frame after it.
+ */
+typedef struct
+{
+    uint64_t                 frames_dequeued;
+    uint64_t                 frames_enqueued;
+    uint64_t                 frames_corrupt;
+    uint64_t                 frames_dropped;
+    uint64_t                 ring_overruns;
+    uint32_t                 ring_high_water;                /* the most buffers ever filled at once */
+    uint64_t                 latency_histogram[DC1394_CAPTURE_HISTOGRAM_BINS];
+    uint64_t                 jitter_histogram[DC1394_CAPTURE_HISTOGRAM_BINS];
+    uint32_t                 bus_resets;                     /* resets seen while capturing */
+    uint32_t                 recoveries;                     /* resets recovered from */
+    uint64_t                 last_gap;                       /* in microseconds */
+    uint64_t                 max_gap;
+} dc1394capture_stats_t;
+
+/**
+ * Function called by the receive thread for each captured frame. The frame must be given back with
+ * dc1394_capture_enqueue() once it is no longer needed, either from the callback or from another thread.
+ */
+typedef void (*dc1394capture_frame_callback_t)(dc1394camera_t * camera, dc1394video_frame_t * frame,
+        void * user_data);
+
+/**
+ * A group of cameras from which frames are captured together
+ */
+typedef struct __dc1394capture_group_t dc1394capture_group_t;
+
+/**
+ * Counters of a capture group: number of framesets returned complete, framesets returned with
+ * missing members after the partial timeout, and frames given back because they could not be matched.
+ */
+typedef struct
+{
+    uint64_t                 complete_sets;
+    uint64_t                 partial_sets;
+    uint64_t                 dropped_frames;
+} dc1394capture_group_stats_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -85,10 +162,31 @@ int dc1394_capture_get_fileno (dc1394camera_t * camera);
 dc1394error_t dc1394_capture_dequeue(dc1394camera_t * camera, dc1394capture_policy_t policy, dc1394video_frame_t **frame);
 
 /**
- * Returns a frame to the ring buffer once it has been used.
+ * Returns a frame to the ring buffer once it has been used. If the frame was retained, this drops one
+ * reference and the buffer goes back to the ring with the last one.
  */
 dc1394error_t dc1394_capture_enqueue(dc1394camera_t * camera, dc1394video_frame_t * frame);
 
+/**
+ * Adds a holder to a dequeued frame, so that several consumers can use one DMA buffer without copying it.
+ * Each holder gives the frame back with dc1394_capture_release() or dc1394_capture_enqueue(), from any
+ * thread. handle is the frame itself, or a private copy under DC1394_RETAIN_POLICY_COPY.
+ */
+dc1394error_t dc1394_capture_retain (dc1394camera_t * camera, dc1394video_frame_t * frame,
+        dc1394video_frame_t ** handle);
+
+/**
+ * Drops one reference to a frame; same as dc1394_capture_enqueue().
+ */
+dc1394error_t dc1394_capture_release (dc1394camera_t * camera, dc1394video_frame_t * frame);
+
+/**
+ * Sets what dc1394_capture_retain() does once max_held buffers are kept out of the ring by extra holders.
+ * Must be called after dc1394_capture_setup(); the default is DC1394_RETAIN_POLICY_HOLD with half the buffers.
+ */
+dc1394error_t dc1394_capture_set_retain_policy (dc1394camera_t * camera, dc1394retain_policy_t policy,
+        uint32_t max_held);
+
 /**
  * Returns DC1394_TRUE if the given frame (previously dequeued) has been
  * detected to be corrupt (missing data, corrupted data, overrun buffer, etc.).
@@ -100,6 +198,100 @@ dc1394error_t dc1394_capture_enqueue(dc1394camera_t * camera, dc1394video_frame_
 dc1394bool_t dc1394_capture_is_frame_corrupt (dc1394camera_t * camera,
         dc1394video_frame_t * frame);
 
+/**
+ * Changes the Format7 region of interest while capturing, keeping the ring buffer and the isochronous
+ * reception. A new position takes effect without interrupting the stream. A new size pauses the transmission
+ * briefly and must fit in the buffers allocated by dc1394_capture_setup(): to grow beyond the initial region,
+ * set up the capture with the largest region first. Frames received around the change may still show the
+ * previous region. Returns DC1394_FUNCTION_NOT_SUPPORTED on platforms that cannot do this.
+ */
+dc1394error_t dc1394_capture_set_roi (dc1394camera_t * camera, uint32_t left, uint32_t top,
+        uint32_t width, uint32_t height);
+
+/**
+ * Sets how many transfers each frame is split into, on the platforms that receive frames that way (USB).
+ * While one transfer completes the next is already queued, so more transfers keep the device busier at the
+ * cost of more completions per frame. 0 restores the default, one transfer per 512 kB of frame, which the
+ * DC1394_USB_TRANSFERS environment variable may override. Must be called before dc1394_capture_setup();
+ * returns DC1394_FUNCTION_NOT_SUPPORTED on the other platforms.
+ */
+dc1394error_t dc1394_capture_set_transfers (dc1394camera_t * camera, uint32_t num_transfers);
+
+/**
+ * Gets the capture statistics of the camera.
+ */
+dc1394error_t dc1394_capture_get_stats (dc1394camera_t * camera, dc1394capture_stats_t * stats);
+
+/**
+ * Resets the capture statistics of the camera.
+ */
+dc1394error_t dc1394_capture_reset_stats (dc1394camera_t * camera);
+
+/***************************************************************************
+     Receive Thread
+ ***************************************************************************/
+
+/**
+ * Starts a thread that dequeues the frames of the camera as soon as they are received, so that the ring
+ * buffer is serviced regardless of how fast the application is. Must be called after dc1394_capture_setup().
+ * If callback is not NULL it is called from that thread for each frame. Otherwise the frames are queued and
+ * returned by dc1394_capture_dequeue(), and dc1394_capture_get_fileno() returns a descriptor that is
+ * readable while frames are queued. In both cases frames must be enqueued from a single thread at a time.
+ * The thread does not recover from a bus reset itself, since that takes register transactions: it makes
+ * the descriptor of dc1394_capture_get_fileno() readable, and the next dc1394_capture_dequeue() of the
+ * application recovers. With a callback, this is the only time the descriptor is readable, and
+ * dc1394_capture_dequeue() must be called with DC1394_CAPTURE_POLICY_POLL; it returns no frame.
+ */
+dc1394error_t dc1394_capture_start_thread (dc1394camera_t * camera, dc1394capture_frame_callback_t callback,
+        void * user_data);
+
+/**
+ * Stops the receive thread. Frames that were queued but not dequeued are given back to the ring buffer.
+ * dc1394_capture_stop() does this automatically.
+ */
+dc1394error_t dc1394_capture_stop_thread (dc1394camera_t * camera);
+
+/***************************************************************************
+     Capture Groups
+ ***************************************************************************/
+
+/**
+ * Creates a capture group from cameras whose capture is already set up. Frames of the different cameras
+ * belong to the same set when their timestamps differ by at most tolerance microseconds.
+ */
+dc1394capture_group_t * dc1394_capture_group_new (dc1394camera_t ** cameras, uint32_t num_cameras,
+        uint64_t tolerance);
+
+/**
+ * Frees a capture group. Frames still held by the group are given back to their ring buffers.
+ */
+void dc1394_capture_group_free (dc1394capture_group_t * group);
+
+/**
+ * Sets how long (in microseconds) a frame may wait for the other members of its set. Once this delay has
+ * expired, dc1394_capture_group_dequeue() returns the incomplete set. 0 (the default) waits forever.
+ */
+dc1394error_t dc1394_capture_group_set_partial_timeout (dc1394capture_group_t * group, uint64_t timeout);
+
+/**
+ * Captures a set of matching frames, one per camera of the group. frames must hold one pointer per camera,
+ * and missing members of a partial set are NULL. Only the WAIT and POLL policies are supported. Frames that
+ * can't be matched are enqueued again automatically.
+ */
+dc1394error_t dc1394_capture_group_dequeue (dc1394capture_group_t * group, dc1394capture_policy_t policy,
+        dc1394video_frame_t ** frames, dc1394bool_t * complete);
+
+/**
+ * Returns a set of frames to the ring buffers of the group's cameras.
+ */
+dc1394error_t dc1394_capture_group_enqueue (dc1394capture_group_t * group, dc1394video_frame_t ** frames);
+
+/**
+ * Gets the counters of the capture group.
+ */
+dc1394error_t dc1394_capture_group_get_stats (dc1394capture_group_t * group,
+        dc1394capture_group_stats_t * stats);
+
 #ifdef __cplusplus
 }
 #endif
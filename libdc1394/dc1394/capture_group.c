@@ -0,0 +1,365 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Synchronized capture from several cameras
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#ifdef HAVE_LINUX
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "control.h"
+#include "capture.h"
+#include "internal.h"
+#include "log.h"
+
+/* Maximum number of frames that are held per camera while waiting for the
+   other members of the group */
+#define GROUP_MAX_PENDING  4
+
+typedef struct {
+    dc1394camera_t           * camera;
+    int                        fd;
+    int                        armed;
+    dc1394video_frame_t      * pending[GROUP_MAX_PENDING];
+    int                        num_pending;
+    uint64_t                   head_since;
+} group_member_t;
+
+struct __dc1394capture_group_t {
+    uint32_t                   num_cameras;
+    group_member_t           * members;
+    uint64_t                   tolerance;
+    uint64_t                   partial_timeout;
+    int                        epoll_fd;
+    dc1394capture_group_stats_t stats;
+};
+
+static uint64_t
+group_get_time (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static dc1394video_frame_t *
+member_pop (group_member_t * m, uint64_t now)
+{
+    dc1394video_frame_t * frame = m->pending[0];
+    m->num_pending--;
+    memmove (m->pending, m->pending + 1,
+             m->num_pending * sizeof (dc1394video_frame_t *));
+    m->head_since = now;
+    return frame;
+}
+
+/* Only the members that have nothing pending are watched, so that the
+   faster cameras don't wake us up while we wait for the slower ones. */
+static dc1394error_t
+member_arm (dc1394capture_group_t * group, uint32_t index, int arm)
+{
+    group_member_t * m = group->members + index;
+
+    if (m->armed == arm)
+        return DC1394_SUCCESS;
+#ifdef HAVE_LINUX
+    struct epoll_event ev;
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = index;
+    if (epoll_ctl (group->epoll_fd, arm ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                   m->fd, &ev) < 0) {
+        dc1394_log_error ("epoll_ctl failed for camera %d: %m", index);
+        return DC1394_FAILURE;
+    }
+#endif
+    m->armed = arm;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+group_wait (dc1394capture_group_t * group, int timeout)
+{
+    int n;
+#ifdef HAVE_LINUX
+    struct epoll_event events[16];
+
+    n = epoll_wait (group->epoll_fd, events, 16, timeout);
+#else
+    struct pollfd fds[group->num_cameras];
+    int num_fds = 0;
+    uint32_t i;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        if (!group->members[i].armed)
+            continue;
+        fds[num_fds].fd = group->members[i].fd;
+        fds[num_fds].events = POLLIN;
+        num_fds++;
+    }
+    n = poll (fds, num_fds, timeout);
+#endif
+    if (n < 0) {
+        dc1394_log_error ("waiting for the capture group failed: %m");
+        return DC1394_FAILURE;
+    }
+    return DC1394_SUCCESS;
+}
+
+dc1394capture_group_t *
+dc1394_capture_group_new (dc1394camera_t ** cameras, uint32_t num_cameras,
+                          uint64_t tolerance)
+{
+    dc1394capture_group_t * group;
+    uint32_t i;
+
+    if (cameras == NULL || num_cameras == 0)
+        return NULL;
+
+    group = calloc (1, sizeof (dc1394capture_group_t));
+    if (group == NULL)
+        return NULL;
+
+    group->members = calloc (num_cameras, sizeof (group_member_t));
+    if (group->members == NULL) {
+        free (group);
+        return NULL;
+    }
+    group->num_cameras = num_cameras;
+    group->tolerance = tolerance;
+    group->epoll_fd = -1;
+
+#ifdef HAVE_LINUX
+    group->epoll_fd = epoll_create (num_cameras);
+    if (group->epoll_fd < 0) {
+        dc1394_log_error ("epoll_create failed: %m");
+        goto fail;
+    }
+#endif
+
+    for (i = 0; i < num_cameras; i++) {
+        group_member_t * m = group->members + i;
+        m->camera = cameras[i];
+        m->fd = dc1394_capture_get_fileno (cameras[i]);
+        if (m->fd < 0) {
+            dc1394_log_error ("camera %d of the group has no capture file "
+                              "descriptor, is the capture set up?", i);
+            goto fail;
+        }
+        if (member_arm (group, i, 1) != DC1394_SUCCESS)
+            goto fail;
+    }
+
+    return group;
+
+ fail:
+    dc1394_capture_group_free (group);
+    return NULL;
+}
+
+void
+dc1394_capture_group_free (dc1394capture_group_t * group)
+{
+    uint32_t i;
+    int j;
+
+    if (group == NULL)
+        return;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        group_member_t * m = group->members + i;
+        for (j = 0; j < m->num_pending; j++)
+            dc1394_capture_enqueue (m->camera, m->pending[j]);
+    }
+    if (group->epoll_fd >= 0)
+        close (group->epoll_fd);
+    free (group->members);
+    free (group);
+}
+
+dc1394error_t
+dc1394_capture_group_set_partial_timeout (dc1394capture_group_t * group,
+                                          uint64_t timeout)
+{
+    if (group == NULL)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    group->partial_timeout = timeout;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_capture_group_dequeue (dc1394capture_group_t * group,
+                              dc1394capture_policy_t policy,
+                              dc1394video_frame_t ** frames,
+                              dc1394bool_t * complete)
+{
+    dc1394error_t err;
+    uint32_t i;
+
+    if (group == NULL || frames == NULL)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    if ((policy != DC1394_CAPTURE_POLICY_WAIT) &&
+        (policy != DC1394_CAPTURE_POLICY_POLL))
+        return DC1394_INVALID_CAPTURE_POLICY;
+
+    // default: return NULL in case of failures or lack of frames
+    for (i = 0; i < group->num_cameras; i++)
+        frames[i] = NULL;
+    if (complete)
+        *complete = DC1394_FALSE;
+
+    while (1) {
+        uint64_t now = group_get_time ();
+        uint64_t tmax = 0, oldest_since = 0;
+        uint32_t num_ready = 0;
+        int timeout;
+
+        // collect every frame that is already available, without blocking
+        for (i = 0; i < group->num_cameras; i++) {
+            group_member_t * m = group->members + i;
+            while (m->num_pending < GROUP_MAX_PENDING) {
+                dc1394video_frame_t * frame;
+                err = dc1394_capture_dequeue (m->camera,
+                        DC1394_CAPTURE_POLICY_POLL, &frame);
+                DC1394_ERR_RTN (err, "Could not dequeue a frame of the group");
+                if (frame == NULL)
+                    break;
+                if (m->num_pending == 0)
+                    m->head_since = now;
+                m->pending[m->num_pending++] = frame;
+            }
+            if (m->num_pending > 0) {
+                num_ready++;
+                if (m->pending[0]->timestamp > tmax)
+                    tmax = m->pending[0]->timestamp;
+                if (oldest_since == 0 || m->head_since < oldest_since)
+                    oldest_since = m->head_since;
+            }
+        }
+
+        if (num_ready == group->num_cameras) {
+            // drop the frames that are too old to ever be matched
+            int dropped = 0;
+            for (i = 0; i < group->num_cameras; i++) {
+                group_member_t * m = group->members + i;
+                while (m->num_pending > 0 &&
+                       m->pending[0]->timestamp + group->tolerance < tmax) {
+                    dc1394_capture_enqueue (m->camera, member_pop (m, now));
+                    group->stats.dropped_frames++;
+                    dropped = 1;
+                }
+            }
+            if (dropped)
+                continue;
+
+            for (i = 0; i < group->num_cameras; i++)
+                frames[i] = member_pop (group->members + i, now);
+            group->stats.complete_sets++;
+            if (complete)
+                *complete = DC1394_TRUE;
+            break;
+        }
+
+        // a member is late: hand out what we have once the timeout expired
+        if (num_ready > 0 && group->partial_timeout > 0 &&
+            now - oldest_since >= group->partial_timeout) {
+            uint64_t tref = 0;
+            for (i = 0; i < group->num_cameras; i++) {
+                group_member_t * m = group->members + i;
+                if (m->num_pending > 0 && m->head_since == oldest_since)
+                    tref = m->pending[0]->timestamp;
+            }
+            for (i = 0; i < group->num_cameras; i++) {
+                group_member_t * m = group->members + i;
+                if (m->num_pending > 0 &&
+                    m->pending[0]->timestamp <= tref + group->tolerance &&
+                    m->pending[0]->timestamp + group->tolerance >= tref)
+                    frames[i] = member_pop (m, now);
+            }
+            group->stats.partial_sets++;
+            break;
+        }
+
+        if (policy == DC1394_CAPTURE_POLICY_POLL)
+            break;
+
+        for (i = 0; i < group->num_cameras; i++) {
+            group_member_t * m = group->members + i;
+            err = member_arm (group, i, m->num_pending == 0);
+            DC1394_ERR_RTN (err, "Could not watch the camera of the group");
+        }
+
+        timeout = -1;
+        if (num_ready > 0 && group->partial_timeout > 0)
+            timeout = (group->partial_timeout - (now - oldest_since) + 999) / 1000;
+
+        err = group_wait (group, timeout);
+        DC1394_ERR_RTN (err, "Could not wait for the capture group");
+    }
+
+    // members that now have nothing pending must be watched again
+    for (i = 0; i < group->num_cameras; i++) {
+        group_member_t * m = group->members + i;
+        err = member_arm (group, i, m->num_pending == 0);
+        DC1394_ERR_RTN (err, "Could not watch the camera of the group");
+    }
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_capture_group_enqueue (dc1394capture_group_t * group,
+                              dc1394video_frame_t ** frames)
+{
+    dc1394error_t err = DC1394_SUCCESS;
+    uint32_t i;
+
+    if (group == NULL || frames == NULL)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        if (frames[i] == NULL)
+            continue;
+        err = dc1394_capture_enqueue (group->members[i].camera, frames[i]);
+        DC1394_ERR_RTN (err, "Could not enqueue a frame of the group");
+        frames[i] = NULL;
+    }
+
+    return err;
+}
+
+dc1394error_t
+dc1394_capture_group_get_stats (dc1394capture_group_t * group,
+                                dc1394capture_group_stats_t * stats)
+{
+    if (group == NULL || stats == NULL)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    memcpy (stats, &group->stats, sizeof (dc1394capture_group_stats_t));
+    return DC1394_SUCCESS;
+}
@@ -0,0 +1,382 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Receive thread for push-based capture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef HAVE_LINUX
+#include <sys/eventfd.h>
+#endif
+
+#include "control.h"
+#include "capture.h"
+#include "internal.h"
+#include "log.h"
+
+/* Single producer, single consumer ring of frame pointers. The producer
+   only writes tail and the consumer only writes head, so no lock is
+   needed; the barriers order the slot accesses with the index updates. */
+typedef struct {
+    dc1394video_frame_t     ** slots;
+    uint32_t                   mask;
+    volatile uint32_t          head;
+    volatile uint32_t          tail;
+} frame_queue_t;
+
+/* A file descriptor that becomes readable once per signal */
+typedef struct {
+    int                        rfd;
+    int                        wfd;
+} notifier_t;
+
+struct _capture_thread_t {
+    dc1394camera_t           * camera;
+    pthread_t                  thread;
+    volatile int               stop;
+
+    dc1394capture_frame_callback_t callback;
+    void                     * user_data;
+
+    frame_queue_t              ready;     /* receive thread -> user */
+    frame_queue_t              done;      /* user -> receive thread */
+    notifier_t                 ready_notify;
+    notifier_t                 wake;
+};
+
+static int
+queue_init (frame_queue_t * q, uint32_t size)
+{
+    uint32_t n = 1;
+    while (n < size)
+        n <<= 1;
+    q->slots = calloc (n, sizeof (dc1394video_frame_t *));
+    if (!q->slots)
+        return -1;
+    q->mask = n - 1;
+    q->head = q->tail = 0;
+    return 0;
+}
+
+static int
+queue_push (frame_queue_t * q, dc1394video_frame_t * frame)
+{
+    uint32_t tail = q->tail;
+    if (tail - q->head > q->mask)
+        return -1;
+    q->slots[tail & q->mask] = frame;
+    __sync_synchronize ();
+    q->tail = tail + 1;
+    return 0;
+}
+
+static dc1394video_frame_t *
+queue_pop (frame_queue_t * q)
+{
+    dc1394video_frame_t * frame;
+    uint32_t head = q->head;
+    if (head == q->tail)
+        return NULL;
+    __sync_synchronize ();
+    frame = q->slots[head & q->mask];
+    __sync_synchronize ();
+    q->head = head + 1;
+    return frame;
+}
+
+static int
+notifier_open (notifier_t * n)
+{
+#ifdef HAVE_LINUX
+    n->rfd = n->wfd = eventfd (0, EFD_NONBLOCK | EFD_SEMAPHORE);
+    return n->rfd < 0 ? -1 : 0;
+#else
+    int fds[2];
+    if (pipe (fds) < 0)
+        return -1;
+    fcntl (fds[0], F_SETFL, O_NONBLOCK);
+    n->rfd = fds[0];
+    n->wfd = fds[1];
+    return 0;
+#endif
+}
+
+static void
+notifier_close (notifier_t * n)
+{
+    if (n->rfd >= 0)
+        close (n->rfd);
+    if (n->wfd >= 0 && n->wfd != n->rfd)
+        close (n->wfd);
+    n->rfd = n->wfd = -1;
+}
+
+static void
+notifier_signal (notifier_t * n)
+{
+#ifdef HAVE_LINUX
+    uint64_t one = 1;
+    if (write (n->wfd, &one, sizeof (one)) != sizeof (one))
+#else
+    char c = '+';
+    if (write (n->wfd, &c, 1) != 1)
+#endif
+        dc1394_log_error ("failed to signal the capture thread: %m");
+}
+
+/* Consumes one signal; returns 0 if there was none */
+static int
+notifier_consume (notifier_t * n)
+{
+#ifdef HAVE_LINUX
+    uint64_t val;
+    return read (n->rfd, &val, sizeof (val)) == sizeof (val);
+#else
+    char c;
+    return read (n->rfd, &c, 1) == 1;
+#endif
+}
+
+static void *
+capture_thread_main (void * arg)
+{
+    capture_thread_t * t = arg;
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (t->camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394video_frame_t * frame;
+    struct pollfd fds[3];
+    dc1394error_t err;
+
+    fds[0].fd = d->capture_get_fileno (cpriv->pcam);
+    fds[0].events = POLLIN;
+    fds[1].fd = t->wake.rfd;
+    fds[1].events = POLLIN;
+    fds[2].fd = d->capture_get_reset_fileno ?
+        d->capture_get_reset_fileno (cpriv->pcam) : -1;
+    fds[2].events = POLLIN;
+
+    while (!t->stop) {
+        // the recovery is left to the application, which is woken for it
+        if (capture_notice_bus_reset (t->camera))
+            notifier_signal (&t->ready_notify);
+
+        // give the frames released by the user back to the backend
+        while (notifier_consume (&t->wake))
+            ;
+        while ((frame = queue_pop (&t->done)) != NULL) {
+            err = d->capture_enqueue (cpriv->pcam, frame);
+            DC1394_WRN (err, "Could not enqueue a frame");
+        }
+
+        // then take every frame the backend has ready
+        while (!t->stop) {
+            err = d->capture_dequeue (cpriv->pcam,
+                    DC1394_CAPTURE_POLICY_POLL, &frame);
+            if (err != DC1394_SUCCESS) {
+                DC1394_WRN (err, "Could not dequeue a frame");
+                break;
+            }
+            if (frame == NULL)
+                break;
+            capture_stats_frame_dequeued (t->camera, frame);
+            if (t->callback) {
+                capture_refs_frame_delivered (t->camera, frame);
+                t->callback (t->camera, frame, t->user_data);
+            }
+            else if (queue_push (&t->ready, frame) == 0) {
+                notifier_signal (&t->ready_notify);
+            }
+            else {
+                dc1394_log_warning ("capture thread queue full, frame dropped");
+                d->capture_enqueue (cpriv->pcam, frame);
+                capture_stats_frames_dropped (t->camera, 1);
+            }
+        }
+
+        if (poll (fds, 3, -1) < 0 && errno != EINTR) {
+            dc1394_log_error ("capture thread poll failed: %m");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+dc1394error_t
+dc1394_capture_start_thread (dc1394camera_t * camera,
+        dc1394capture_frame_callback_t callback, void * user_data)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    capture_thread_t * t;
+
+    if (cpriv->capture_thread)
+        return DC1394_CAPTURE_IS_RUNNING;
+    if (cpriv->capture_num_buffers == 0)
+        return DC1394_CAPTURE_IS_NOT_SET;
+    if (!d->capture_dequeue || !d->capture_enqueue || !d->capture_get_fileno)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+
+    t = calloc (1, sizeof (capture_thread_t));
+    if (!t)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    t->camera = camera;
+    t->callback = callback;
+    t->user_data = user_data;
+    t->ready_notify.rfd = t->ready_notify.wfd = -1;
+    t->wake.rfd = t->wake.wfd = -1;
+
+    /* There are never more frames in flight than buffers in the ring, so
+       both queues can hold all of them. */
+    if (queue_init (&t->ready, cpriv->capture_num_buffers) < 0 ||
+        queue_init (&t->done, cpriv->capture_num_buffers) < 0)
+        goto fail;
+
+    if (notifier_open (&t->ready_notify) < 0 || notifier_open (&t->wake) < 0) {
+        dc1394_log_error ("could not create the capture thread notifiers: %m");
+        goto fail;
+    }
+
+    if (pthread_create (&t->thread, NULL, capture_thread_main, t) != 0) {
+        dc1394_log_error ("could not create the capture thread");
+        goto fail;
+    }
+
+    cpriv->capture_thread = t;
+    return DC1394_SUCCESS;
+
+ fail:
+    notifier_close (&t->ready_notify);
+    notifier_close (&t->wake);
+    free (t->ready.slots);
+    free (t->done.slots);
+    free (t);
+    return DC1394_FAILURE;
+}
+
+dc1394error_t
+dc1394_capture_stop_thread (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    capture_thread_t * t = cpriv->capture_thread;
+    dc1394video_frame_t * frame;
+
+    if (!t)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    t->stop = 1;
+    notifier_signal (&t->wake);
+    pthread_join (t->thread, NULL);
+    cpriv->capture_thread = NULL;
+
+    // frames the user never saw or already released go back to the backend
+    while ((frame = queue_pop (&t->done)) != NULL)
+        d->capture_enqueue (cpriv->pcam, frame);
+    while ((frame = queue_pop (&t->ready)) != NULL)
+        d->capture_enqueue (cpriv->pcam, frame);
+
+    notifier_close (&t->ready_notify);
+    notifier_close (&t->wake);
+    free (t->ready.slots);
+    free (t->done.slots);
+    free (t);
+    return DC1394_SUCCESS;
+}
+
+/* With a callback, the descriptor only becomes readable after a bus reset */
+int
+capture_thread_get_fileno (capture_thread_t * t)
+{
+    return t->ready_notify.rfd;
+}
+
+dc1394error_t
+capture_thread_dequeue (capture_thread_t * t, dc1394capture_policy_t policy,
+        dc1394video_frame_t ** frame_return)
+{
+    dc1394video_frame_t * frame, * next;
+    struct pollfd fds[1];
+
+    dc1394error_t err;
+
+    *frame_return = NULL;
+
+    if ((policy < DC1394_CAPTURE_POLICY_MIN) ||
+        (policy > DC1394_CAPTURE_POLICY_MAX))
+        return DC1394_INVALID_CAPTURE_POLICY;
+    if (t->callback) {
+        // a poll only collects the wake-ups of bus resets
+        while (notifier_consume (&t->ready_notify))
+            ;
+        if (policy == DC1394_CAPTURE_POLICY_POLL)
+            return DC1394_SUCCESS;
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    }
+
+    fds[0].fd = t->ready_notify.rfd;
+    fds[0].events = POLLIN;
+
+    // a signal without a frame is a wake-up for a bus reset
+    for (;;) {
+        if (notifier_consume (&t->ready_notify)) {
+            frame = queue_pop (&t->ready);
+            if (frame)
+                break;
+            err = capture_check_bus_reset (t->camera);
+            if (err != DC1394_SUCCESS)
+                return err;
+            continue;
+        }
+        if (policy == DC1394_CAPTURE_POLICY_POLL)
+            return DC1394_SUCCESS;
+        if (poll (fds, 1, -1) < 0 && errno != EINTR) {
+            dc1394_log_error ("poll() failed for device: %m");
+            return DC1394_FAILURE;
+        }
+    }
+
+    if (policy == DC1394_CAPTURE_POLICY_LATEST) {
+        while (notifier_consume (&t->ready_notify)) {
+            next = queue_pop (&t->ready);
+            if (!next)
+                continue;
+            capture_thread_enqueue (t, frame);
+            capture_stats_frames_dropped (t->camera, 1);
+            frame = next;
+        }
+    }
+
+    *frame_return = frame;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+capture_thread_enqueue (capture_thread_t * t, dc1394video_frame_t * frame)
+{
+    if (queue_push (&t->done, frame) < 0)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    notifier_signal (&t->wake);
+    return DC1394_SUCCESS;
+}
@@ -0,0 +1,354 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Synchronization of the bus cycle timer with the host clocks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "control.h"
+#include "clocksync.h"
+#include "internal.h"
+#include "log.h"
+
+#define TICKS_PER_SECOND   DC1394_CYCLE_TIMER_TICKS_PER_SECOND
+#define TICKS_PER_CYCLE    3072
+#define WRAP_TICKS         ((int64_t) 128 * TICKS_PER_SECOND)
+#define NOMINAL_RATE       (TICKS_PER_SECOND / 1e6)     /* ticks per microsecond */
+
+#define SYNC_WINDOW        32     /* samples the model is fitted to */
+#define SYNC_BURST         4      /* reads per sample, the fastest one is kept */
+#define SYNC_MAX_PERIOD    10000
+#define OUTLIER_MIN        20.0   /* microseconds */
+#define OUTLIER_FACTOR     5.0
+#define OUTLIER_RESET      3      /* consecutive outliers that mean a clock jumped */
+
+typedef struct {
+    int64_t                    host;      /* monotonic microseconds */
+    int64_t                    ticks;     /* unwrapped cycle timer */
+} sync_sample_t;
+
+struct __dc1394clocksync_t {
+    dc1394camera_t           * camera;
+    uint32_t                   period;
+
+    pthread_t                  thread;
+    pthread_mutex_t            mutex;
+    pthread_cond_t             cond;
+    int                        stop;
+
+    sync_sample_t              samples[SYNC_WINDOW];
+    uint32_t                   next;
+    uint32_t                   outliers;
+
+    /* ticks = base_ticks + intercept + rate * (host - base_host) */
+    int64_t                    base_host;
+    int64_t                    base_ticks;
+    double                     intercept;
+    double                     rate;
+    int64_t                    realtime_offset;   /* realtime - monotonic */
+
+    dc1394clocksync_info_t     info;
+};
+
+static int64_t
+get_clock (clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime (clock, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t
+cycle_timer_to_ticks (uint32_t cycle_timer)
+{
+    return (int64_t) (cycle_timer >> 25) * TICKS_PER_SECOND +
+        (int64_t) ((cycle_timer >> 12) & 0x1fff) * TICKS_PER_CYCLE +
+        (cycle_timer & 0xfff);
+}
+
+static uint32_t
+ticks_to_cycle_timer (int64_t ticks)
+{
+    int64_t rem;
+
+    ticks %= WRAP_TICKS;
+    if (ticks < 0)
+        ticks += WRAP_TICKS;
+    rem = ticks % TICKS_PER_SECOND;
+    return (uint32_t) (ticks / TICKS_PER_SECOND) << 25 |
+        (uint32_t) (rem / TICKS_PER_CYCLE) << 12 |
+        (uint32_t) (rem % TICKS_PER_CYCLE);
+}
+
+/* Adds the multiple of the wrap period that brings ticks closest to ref */
+static int64_t
+unwrap (int64_t ticks, double ref)
+{
+    double k = (ref - ticks) / WRAP_TICKS;
+    return ticks + (int64_t) (k < 0 ? k - 0.5 : k + 0.5) * WRAP_TICKS;
+}
+
+static double
+model_ticks (dc1394clocksync_t * s, int64_t host)
+{
+    return s->base_ticks + s->intercept + s->rate * (host - s->base_host);
+}
+
+/* Least squares fit of the samples in the window, relative to the oldest
+   one to keep the sums small enough for doubles. */
+static void
+fit_model (dc1394clocksync_t * s)
+{
+    uint32_t n = s->info.num_samples, i;
+    const sync_sample_t * first = s->samples + (s->next + SYNC_WINDOW - n) % SYNC_WINDOW;
+    const sync_sample_t * p;
+    double x, y, sx = 0, sy = 0, sxx = 0, sxy = 0, err = 0;
+
+    s->base_host = first->host;
+    s->base_ticks = first->ticks;
+    for (i = 0; i < n; i++) {
+        p = s->samples + (s->next + SYNC_WINDOW - n + i) % SYNC_WINDOW;
+        x = p->host - s->base_host;
+        y = p->ticks - s->base_ticks;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    if (n < 2 || n * sxx - sx * sx <= 0) {
+        s->rate = NOMINAL_RATE;
+        s->intercept = (sy - s->rate * sx) / n;
+    }
+    else {
+        s->rate = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+        s->intercept = (sy - s->rate * sx) / n;
+    }
+
+    for (i = 0; i < n; i++) {
+        p = s->samples + (s->next + SYNC_WINDOW - n + i) % SYNC_WINDOW;
+        x = p->ticks - model_ticks (s, p->host);
+        err += x < 0 ? -x : x;
+    }
+    s->info.residual = err / n / s->rate;
+    s->info.drift = (s->rate / NOMINAL_RATE - 1) * 1e6;
+}
+
+dc1394error_t
+dc1394_clocksync_sample (dc1394clocksync_t * s)
+{
+    uint32_t cycle_timer, best_cycle_timer = 0;
+    uint64_t local_time;
+    int64_t t0, t1, real, host = 0, offset = 0, best = -1, ticks;
+    double predicted, error;
+    dc1394error_t err;
+    int i;
+
+    // the read with the shortest round trip is the least delayed one
+    for (i = 0; i < SYNC_BURST; i++) {
+        t0 = get_clock (CLOCK_MONOTONIC);
+        err = dc1394_read_cycle_timer (s->camera, &cycle_timer, &local_time);
+        t1 = get_clock (CLOCK_MONOTONIC);
+        DC1394_ERR_RTN (err, "Could not read the cycle timer");
+        real = get_clock (CLOCK_REALTIME);
+        if (best < 0 || t1 - t0 < best) {
+            best = t1 - t0;
+            best_cycle_timer = cycle_timer;
+            host = t0 + (t1 - t0) / 2;
+            offset = real - (t1 + get_clock (CLOCK_MONOTONIC)) / 2;
+        }
+    }
+
+    pthread_mutex_lock (&s->mutex);
+    s->info.total_samples++;
+    s->realtime_offset = offset;
+
+    ticks = cycle_timer_to_ticks (best_cycle_timer);
+    if (s->info.num_samples > 0) {
+        predicted = model_ticks (s, host);
+        ticks = unwrap (ticks, predicted);
+        error = (ticks - predicted) / s->rate;
+        if (error < 0)
+            error = -error;
+        if (s->info.num_samples > 2 &&
+            error > OUTLIER_MIN && error > OUTLIER_FACTOR * s->info.residual) {
+            s->info.rejected_samples++;
+            if (++s->outliers < OUTLIER_RESET) {
+                pthread_mutex_unlock (&s->mutex);
+                return DC1394_SUCCESS;
+            }
+            // the cycle master changed or the host clock was stepped
+            dc1394_log_warning ("Clock sync: cycle timer off by %.0f us, "
+                    "restarting the model", error);
+            s->info.num_samples = 0;
+            s->info.resets++;
+            ticks = cycle_timer_to_ticks (best_cycle_timer);
+        }
+    }
+    s->outliers = 0;
+
+    s->samples[s->next].host = host;
+    s->samples[s->next].ticks = ticks;
+    s->next = (s->next + 1) % SYNC_WINDOW;
+    if (s->info.num_samples < SYNC_WINDOW)
+        s->info.num_samples++;
+    s->info.last_sample = host;
+    fit_model (s);
+    pthread_mutex_unlock (&s->mutex);
+
+    return DC1394_SUCCESS;
+}
+
+static void *
+sync_thread (void * arg)
+{
+    dc1394clocksync_t * s = arg;
+    struct timeval tv;
+    struct timespec deadline;
+
+    pthread_mutex_lock (&s->mutex);
+    while (!s->stop) {
+        gettimeofday (&tv, NULL);
+        deadline.tv_sec = tv.tv_sec + s->period / 1000;
+        deadline.tv_nsec = tv.tv_usec * 1000 + (s->period % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!s->stop &&
+               pthread_cond_timedwait (&s->cond, &s->mutex, &deadline) != ETIMEDOUT)
+            ;
+        if (s->stop)
+            break;
+        pthread_mutex_unlock (&s->mutex);
+        dc1394_clocksync_sample (s);
+        pthread_mutex_lock (&s->mutex);
+    }
+    pthread_mutex_unlock (&s->mutex);
+    return NULL;
+}
+
+dc1394clocksync_t *
+dc1394_clocksync_new (dc1394camera_t * camera, uint32_t period)
+{
+    dc1394clocksync_t * s;
+
+    if (period > SYNC_MAX_PERIOD) {
+        dc1394_log_error ("Clock sync: a period of %u ms would miss cycle "
+                "timer wraps", period);
+        return NULL;
+    }
+
+    s = calloc (1, sizeof (dc1394clocksync_t));
+    if (!s)
+        return NULL;
+    s->camera = camera;
+    s->period = period;
+    pthread_mutex_init (&s->mutex, NULL);
+    pthread_cond_init (&s->cond, NULL);
+
+    if (dc1394_clocksync_sample (s) != DC1394_SUCCESS)
+        goto error;
+
+    if (period > 0 && pthread_create (&s->thread, NULL, sync_thread, s) != 0) {
+        dc1394_log_error ("Clock sync: could not start the sampling thread");
+        goto error;
+    }
+    return s;
+
+error:
+    pthread_cond_destroy (&s->cond);
+    pthread_mutex_destroy (&s->mutex);
+    free (s);
+    return NULL;
+}
+
+void
+dc1394_clocksync_free (dc1394clocksync_t * s)
+{
+    if (!s)
+        return;
+    if (s->period > 0) {
+        pthread_mutex_lock (&s->mutex);
+        s->stop = 1;
+        pthread_cond_signal (&s->cond);
+        pthread_mutex_unlock (&s->mutex);
+        pthread_join (s->thread, NULL);
+    }
+    pthread_cond_destroy (&s->cond);
+    pthread_mutex_destroy (&s->mutex);
+    free (s);
+}
+
+dc1394error_t
+dc1394_clocksync_cycle_to_host (dc1394clocksync_t * s, uint32_t cycle_timer,
+        dc1394host_clock_t clock, uint64_t * host_time)
+{
+    int64_t ticks;
+    double host;
+
+    if (clock < DC1394_HOST_CLOCK_MIN || clock > DC1394_HOST_CLOCK_MAX)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&s->mutex);
+    ticks = unwrap (cycle_timer_to_ticks (cycle_timer),
+            model_ticks (s, s->info.last_sample));
+    host = s->base_host + (ticks - s->base_ticks - s->intercept) / s->rate;
+    if (clock == DC1394_HOST_CLOCK_REALTIME)
+        host += s->realtime_offset;
+    pthread_mutex_unlock (&s->mutex);
+
+    *host_time = host + 0.5;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_clocksync_host_to_cycle (dc1394clocksync_t * s, uint64_t host_time,
+        dc1394host_clock_t clock, uint32_t * cycle_timer)
+{
+    int64_t host = host_time;
+    double ticks;
+
+    if (clock < DC1394_HOST_CLOCK_MIN || clock > DC1394_HOST_CLOCK_MAX)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&s->mutex);
+    if (clock == DC1394_HOST_CLOCK_REALTIME)
+        host -= s->realtime_offset;
+    ticks = model_ticks (s, host);
+    pthread_mutex_unlock (&s->mutex);
+
+    *cycle_timer = ticks_to_cycle_timer ((int64_t) (ticks + 0.5));
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_clocksync_get_info (dc1394clocksync_t * s, dc1394clocksync_info_t * info)
+{
+    pthread_mutex_lock (&s->mutex);
+    memcpy (info, &s->info, sizeof (dc1394clocksync_info_t));
+    pthread_mutex_unlock (&s->mutex);
+    return DC1394_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Synchronization of the bus cycle timer with the host clocks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_CLOCKSYNC_H__
+#define __DC1394_CLOCKSYNC_H__
+
+/*! \file dc1394/clocksync.h
+    \brief Conversions between the bus cycle time and the host clocks
+
+    A clock sync service samples the IEEE 1394 cycle timer of the bus of a camera together with the host
+    clock, rejects the samples that were delayed on their way, and fits a linear model to the others. The
+    model takes out both the offset and the drift between the cycle master and the host, so that cycle times
+    can be converted to host time with microsecond accuracy. All the cameras of a bus share its cycle timer:
+    one service per bus is enough.
+*/
+
+#include <dc1394/log.h>
+
+/**
+ * Frequency of the cycle timer offset field. The cycle timer wraps around every 128 seconds.
+ */
+#define DC1394_CYCLE_TIMER_TICKS_PER_SECOND  24576000
+
+/**
+ * A clock sync service for the bus of one camera
+ */
+typedef struct __dc1394clocksync_t dc1394clocksync_t;
+
+/**
+ * Host clocks to convert from or to. Times are in microseconds; the realtime clock is the one of
+ * gettimeofday() used for frame timestamps.
+ */
+typedef enum {
+    DC1394_HOST_CLOCK_REALTIME=832,
+    DC1394_HOST_CLOCK_MONOTONIC
+} dc1394host_clock_t;
+#define DC1394_HOST_CLOCK_MIN    DC1394_HOST_CLOCK_REALTIME
+#define DC1394_HOST_CLOCK_MAX    DC1394_HOST_CLOCK_MONOTONIC
+#define DC1394_HOST_CLOCK_NUM   (DC1394_HOST_CLOCK_MAX - DC1394_HOST_CLOCK_MIN + 1)
+
+/**
+ * State of the drift model. drift is the rate of the cycle timer relative to the host clock minus one, in
+ * parts per million; residual is the mean absolute error of the fit in microseconds.
+ */
+typedef struct
+{
+    uint32_t                 num_samples;        /* samples the model is currently fitted to */
+    uint64_t                 total_samples;      /* one per burst of reads, of which the fastest is kept */
+    uint64_t                 rejected_samples;   /* kept reads that the model rejected as outliers */
+    uint32_t                 resets;             /* restarts of the model after a jump of either clock */
+    double                   drift;
+    double                   residual;
+    uint64_t                 last_sample;        /* monotonic time of the newest sample, in microseconds */
+} dc1394clocksync_info_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates a clock sync service for the bus of a camera and takes its first sample. If period is not 0, a
+ * thread samples the cycle timer every period milliseconds (at most 10000); otherwise samples are only taken
+ * by dc1394_clocksync_sample(). Returns NULL if the platform cannot read the cycle timer. On the raw1394
+ * backend the cycle timer is read through the camera handle, which must then not be used from another
+ * thread at the same time: use a period of 0 and sample from the thread that owns the camera.
+ */
+dc1394clocksync_t * dc1394_clocksync_new (dc1394camera_t * camera, uint32_t period);
+
+/**
+ * Stops the sampling thread and frees the service.
+ */
+void dc1394_clocksync_free (dc1394clocksync_t * sync);
+
+/**
+ * Takes a sample now and updates the model. The interval between two samples must be below 64 seconds.
+ */
+dc1394error_t dc1394_clocksync_sample (dc1394clocksync_t * sync);
+
+/**
+ * Converts a cycle timer value to host time. The cycle timer wraps around every 128 seconds: the value is
+ * taken as the one closest to the newest sample, so it must be less than 64 seconds away from it.
+ */
+dc1394error_t dc1394_clocksync_cycle_to_host (dc1394clocksync_t * sync, uint32_t cycle_timer,
+        dc1394host_clock_t clock, uint64_t * host_time);
+
+/**
+ * Converts a host time to the value of the cycle timer at that time.
+ */
+dc1394error_t dc1394_clocksync_host_to_cycle (dc1394clocksync_t * sync, uint64_t host_time,
+        dc1394host_clock_t clock, uint32_t * cycle_timer);
+
+/**
+ * Gets the state of the drift model.
+ */
+dc1394error_t dc1394_clocksync_get_info (dc1394clocksync_t * sync, dc1394clocksync_info_t * info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 #include "internal.h"
 #include "offsets.h"
@@ -53,9 +55,13 @@ dc1394_reset_bus (dc1394camera_t * camera)
 {
     dc1394camera_priv_t * priv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = priv->platform->dispatch;
+    dc1394error_t err;
     if (!d->reset_bus)
         return DC1394_FUNCTION_NOT_SUPPORTED;
-    return d->reset_bus (priv->pcam);
+    err = d->reset_bus (priv->pcam);
+    /* Not all platforms see the new generation before the next transaction */
+    dc1394_camera_flush_register_cache (camera);
+    return err;
 }
 
 dc1394error_t
@@ -197,62 +203,58 @@ dc1394_camera_print_info(dc1394camera_t *camera, FILE* fd)
  Collects the available features for the camera
  described by node and stores them in features.
 *****************************************************/
-dc1394error_t
-dc1394_feature_get_all(dc1394camera_t *camera, dc1394featureset_t *features)
-{
-    uint32_t i, j;
-    dc1394error_t err=DC1394_SUCCESS;
-
-    for (i= DC1394_FEATURE_MIN, j= 0; i <= DC1394_FEATURE_MAX; i++, j++)  {
-        features->feature[j].id= i;
-        err=dc1394_feature_get(camera, &features->feature[j]);
-        DC1394_ERR_RTN(err, "Could not get camera feature");
-    }
+/*
+  Position of the inquiry and value registers of a feature in the blocks read
+  by dc1394_feature_get_all(): the 16 high features, then the 18 quadlets from
+  zoom to capture quality, with a gap before capture size.
+*/
+#define FEATURE_BLOCK_HI_NUM     16
+#define FEATURE_BLOCK_LO_NUM     18
+#define FEATURE_BLOCK_NUM        (FEATURE_BLOCK_HI_NUM + FEATURE_BLOCK_LO_NUM)
 
-    return err;
+static int
+feature_block_index (dc1394feature_t feature)
+{
+    if (feature < DC1394_FEATURE_ZOOM)
+        return feature - DC1394_FEATURE_MIN;
+    else if (feature >= DC1394_FEATURE_CAPTURE_SIZE)
+        return FEATURE_BLOCK_HI_NUM + feature + 12 - DC1394_FEATURE_ZOOM;
+    else
+        return FEATURE_BLOCK_HI_NUM + feature - DC1394_FEATURE_ZOOM;
 }
 
-/*****************************************************
- dc1394_get_camera_feature
-
- Stores the bounds and options associated with the
- feature described by feature->id
-*****************************************************/
-dc1394error_t
-dc1394_feature_get(dc1394camera_t *camera, dc1394feature_info_t *feature)
+/* Fills in a present feature from its inquiry and value registers */
+static dc1394error_t
+feature_decode (dc1394camera_t *camera, dc1394feature_info_t *feature,
+        uint32_t inquiry, uint32_t value)
 {
-    uint64_t offset;
-    uint32_t value;
-    dc1394error_t err;
-
-    if ( (feature->id < DC1394_FEATURE_MIN) || (feature->id > DC1394_FEATURE_MAX) ) {
-        return DC1394_INVALID_FEATURE;
-    }
-
-    // check presence
-    err=dc1394_feature_is_present(camera, feature->id, &(feature->available));
-    DC1394_ERR_RTN(err, "Could not check feature presence");
+    dc1394error_t err=DC1394_SUCCESS;
 
-    if (feature->available == DC1394_FALSE) {
-        return DC1394_SUCCESS;
+    feature->modes.num=0;
+    if (feature->id != DC1394_FEATURE_TRIGGER) {
+        if (inquiry & 0x01000000UL)
+            feature->modes.modes[feature->modes.num++]=DC1394_FEATURE_MODE_MANUAL;
+        if (inquiry & 0x02000000UL)
+            feature->modes.modes[feature->modes.num++]=DC1394_FEATURE_MODE_AUTO;
+        if (inquiry & 0x10000000UL)
+            feature->modes.modes[feature->modes.num++]=DC1394_FEATURE_MODE_ONE_PUSH_AUTO;
     }
 
-    // get capabilities
-    FEATURE_TO_INQUIRY_OFFSET(feature->id, offset);
-    err=dc1394_get_control_register(camera, offset, &value);
-    DC1394_ERR_RTN(err, "Could not check feature characteristics");
-
-    dc1394_feature_get_modes(camera, feature->id, &feature->modes);
-    dc1394_feature_get_mode(camera, feature->id, &feature->current_mode);
+    if (value & 0x04000000UL)
+        feature->current_mode= DC1394_FEATURE_MODE_ONE_PUSH_AUTO;
+    else if (value & 0x01000000UL)
+        feature->current_mode= DC1394_FEATURE_MODE_AUTO;
+    else
+        feature->current_mode= DC1394_FEATURE_MODE_MANUAL;
 
     switch (feature->id) {
     case DC1394_FEATURE_TRIGGER:
-        feature->polarity_capable= (value & 0x02000000UL) ? DC1394_TRUE : DC1394_FALSE;
+        feature->polarity_capable= (inquiry & 0x02000000UL) ? DC1394_TRUE : DC1394_FALSE;
         int i, j;
         uint32_t value_tmp;
 
         feature->trigger_modes.num=0;
-        value_tmp= (value & (0xFFFF));
+        value_tmp= (inquiry & (0xFFFF));
 
         for (i=DC1394_TRIGGER_MODE_MIN;i<=DC1394_TRIGGER_MODE_MAX;i++) {
             j = i - DC1394_TRIGGER_MODE_MIN;
@@ -270,20 +272,14 @@ dc1394_feature_get(dc1394camera_t *camera, dc1394feature_info_t *feature)
         feature->polarity_capable = 0;
         feature->trigger_mode     = 0;
 
-        feature->min= (value & 0xFFF000UL) >> 12;
-        feature->max= (value & 0xFFFUL);
+        feature->min= (inquiry & 0xFFF000UL) >> 12;
+        feature->max= (inquiry & 0xFFFUL);
         break;
     }
 
-    feature->absolute_capable = (value & 0x40000000UL) ? DC1394_TRUE : DC1394_FALSE;
-    feature->readout_capable  = (value & 0x08000000UL) ? DC1394_TRUE : DC1394_FALSE;
-    feature->on_off_capable   = (value & 0x04000000UL) ? DC1394_TRUE : DC1394_FALSE;
-
-    // get current values
-    FEATURE_TO_VALUE_OFFSET(feature->id, offset);
-
-    err=dc1394_get_control_register(camera, offset, &value);
-    DC1394_ERR_RTN(err, "Could not get feature register");
+    feature->absolute_capable = (inquiry & 0x40000000UL) ? DC1394_TRUE : DC1394_FALSE;
+    feature->readout_capable  = (inquiry & 0x08000000UL) ? DC1394_TRUE : DC1394_FALSE;
+    feature->on_off_capable   = (inquiry & 0x04000000UL) ? DC1394_TRUE : DC1394_FALSE;
 
     switch (feature->id) {
     case DC1394_FEATURE_TRIGGER:
@@ -323,6 +319,121 @@ dc1394_feature_get(dc1394camera_t *camera, dc1394feature_info_t *feature)
         break;
     }
 
+    return err;
+}
+
+dc1394error_t
+dc1394_feature_get_all(dc1394camera_t *camera, dc1394featureset_t *features)
+{
+    uint32_t presence[2], inquiry[FEATURE_BLOCK_NUM], value[FEATURE_BLOCK_NUM];
+    uint32_t absoffset[FEATURE_BLOCK_NUM];
+    int abs_read=0;
+    uint32_t i, j;
+    dc1394error_t err=DC1394_SUCCESS;
+
+    /*
+      Read the presence, inquiry and value registers of all the features in
+      5 block transactions instead of several quadlet reads per feature. If
+      the camera rejects block reads, fall back to the feature by feature
+      path.
+    */
+    if (dc1394_get_control_registers (camera, REG_CAMERA_FEATURE_HI_INQ,
+                presence, 2) != DC1394_SUCCESS ||
+        dc1394_get_control_registers (camera, REG_CAMERA_FEATURE_HI_BASE_INQ,
+                inquiry, FEATURE_BLOCK_HI_NUM) != DC1394_SUCCESS ||
+        dc1394_get_control_registers (camera, REG_CAMERA_FEATURE_LO_BASE_INQ,
+                inquiry + FEATURE_BLOCK_HI_NUM, FEATURE_BLOCK_LO_NUM) != DC1394_SUCCESS ||
+        dc1394_get_control_registers (camera, REG_CAMERA_FEATURE_HI_BASE,
+                value, FEATURE_BLOCK_HI_NUM) != DC1394_SUCCESS ||
+        dc1394_get_control_registers (camera, REG_CAMERA_FEATURE_LO_BASE,
+                value + FEATURE_BLOCK_HI_NUM, FEATURE_BLOCK_LO_NUM) != DC1394_SUCCESS) {
+        for (i= DC1394_FEATURE_MIN, j= 0; i <= DC1394_FEATURE_MAX; i++, j++)  {
+            features->feature[j].id= i;
+            err=dc1394_feature_get(camera, &features->feature[j]);
+            DC1394_ERR_RTN(err, "Could not get camera feature");
+        }
+        return err;
+    }
+
+    for (i= DC1394_FEATURE_MIN, j= 0; i <= DC1394_FEATURE_MAX; i++, j++)  {
+        dc1394feature_info_t *feature = &features->feature[j];
+        int k = feature_block_index (i);
+
+        feature->id= i;
+        // same AND of the three locations as dc1394_feature_is_present()
+        feature->available=
+            is_feature_bit_set (presence[i < DC1394_FEATURE_ZOOM ? 0 : 1], i) &&
+            (inquiry[k] & 0x80000000UL) && (value[k] & 0x80000000UL);
+        if (feature->available == DC1394_FALSE)
+            continue;
+
+        err=feature_decode (camera, feature, inquiry[k], value[k]);
+        DC1394_ERR_RTN(err, "Could not get camera feature");
+
+        if (feature->absolute_capable>0) {
+            uint32_t abs[3];
+
+            if (!abs_read) {
+                err=dc1394_get_control_registers (camera, REG_CAMERA_FEATURE_ABS_HI_BASE,
+                        absoffset, FEATURE_BLOCK_HI_NUM);
+                DC1394_ERR_RTN(err, "Could not get absolute CSR offsets");
+                err=dc1394_get_control_registers (camera, REG_CAMERA_FEATURE_ABS_LO_BASE,
+                        absoffset + FEATURE_BLOCK_HI_NUM, FEATURE_BLOCK_LO_NUM);
+                DC1394_ERR_RTN(err, "Could not get absolute CSR offsets");
+                abs_read=1;
+            }
+            // min, max and value are contiguous in the absolute CSR
+            err=dc1394_get_registers (camera, (uint64_t) absoffset[k] * 4 + REG_CAMERA_ABS_MIN,
+                    abs, 3);
+            DC1394_ERR_RTN(err, "Could not get feature absolute registers");
+            memcpy (&feature->abs_min, &abs[0], 4);
+            memcpy (&feature->abs_max, &abs[1], 4);
+            memcpy (&feature->abs_value, &abs[2], 4);
+            feature->abs_control = (value[k] & 0x40000000UL) ? DC1394_ON : DC1394_OFF;
+        }
+    }
+
+    return err;
+}
+
+/*****************************************************
+ dc1394_get_camera_feature
+
+ Stores the bounds and options associated with the
+ feature described by feature->id
+*****************************************************/
+dc1394error_t
+dc1394_feature_get(dc1394camera_t *camera, dc1394feature_info_t *feature)
+{
+    uint64_t offset;
+    uint32_t inquiry, value;
+    dc1394error_t err;
+
+    if ( (feature->id < DC1394_FEATURE_MIN) || (feature->id > DC1394_FEATURE_MAX) ) {
+        return DC1394_INVALID_FEATURE;
+    }
+
+    // check presence
+    err=dc1394_feature_is_present(camera, feature->id, &(feature->available));
+    DC1394_ERR_RTN(err, "Could not check feature presence");
+
+    if (feature->available == DC1394_FALSE) {
+        return DC1394_SUCCESS;
+    }
+
+    // get capabilities
+    FEATURE_TO_INQUIRY_OFFSET(feature->id, offset);
+    err=dc1394_get_control_register(camera, offset, &inquiry);
+    DC1394_ERR_RTN(err, "Could not check feature characteristics");
+
+    // get current values
+    FEATURE_TO_VALUE_OFFSET(feature->id, offset);
+    err=dc1394_get_control_register(camera, offset, &value);
+    DC1394_ERR_RTN(err, "Could not get feature register");
+
+    err=feature_decode(camera, feature, inquiry, value);
+    DC1394_ERR_RTN(err, "Could not get camera feature");
+
     if (feature->absolute_capable>0) {
         err=dc1394_feature_get_absolute_boundaries(camera, feature->id, &feature->abs_min, &feature->abs_max);
         DC1394_ERR_RTN(err, "Could not get feature absolute min/max");
@@ -958,6 +1069,8 @@ dc1394_video_set_transmission(dc1394camera_t *camera, dc1394switch_t pwr)
         err=dc1394_set_control_register(camera, REG_CAMERA_ISO_EN, DC1394_FEATURE_OFF);
         DC1394_ERR_RTN(err, "Could not stop ISO transmission");
     }
+    // restarted by the capture after a bus reset
+    DC1394_CAMERA_PRIV (camera)->capture_streaming = pwr == DC1394_ON;
 
     return err;
 }
@@ -1913,6 +2026,256 @@ dc1394_feature_set_absolute_value(dc1394camera_t *camera, dc1394feature_t featur
 }
 
 
+/*****************************************************
+ Feature batches
+
+ Each feature keeps a mask of the bits of its value
+ register that were set and their new state, so that
+ the register can be rebuilt from its current content
+ in one read for the whole batch.
+*****************************************************/
+struct __dc1394feature_batch_t {
+    dc1394camera_t * camera;
+    uint32_t mask[FEATURE_BLOCK_NUM];
+    uint32_t bits[FEATURE_BLOCK_NUM];
+    int abs_set[FEATURE_BLOCK_NUM];
+    uint32_t abs_value[FEATURE_BLOCK_NUM];
+};
+
+/* Do not wait for a frame boundary if the last frame is older than this */
+#define FEATURE_BATCH_MAX_FRAME_AGE  1000000
+
+static uint64_t
+feature_block_offset (int k)
+{
+    if (k < FEATURE_BLOCK_HI_NUM)
+        return REG_CAMERA_FEATURE_HI_BASE + k * 0x04U;
+    return REG_CAMERA_FEATURE_LO_BASE + (k - FEATURE_BLOCK_HI_NUM) * 0x04U;
+}
+
+static void
+feature_batch_record (dc1394feature_batch_t *batch, dc1394feature_t feature,
+        uint32_t mask, uint32_t bits)
+{
+    int k = feature_block_index (feature);
+    batch->mask[k] |= mask;
+    batch->bits[k] = (batch->bits[k] & ~mask) | (bits & mask);
+}
+
+dc1394feature_batch_t *
+dc1394_feature_batch_new(dc1394camera_t *camera)
+{
+    dc1394feature_batch_t *batch;
+
+    if (camera == NULL)
+        return NULL;
+    batch = calloc (1, sizeof (dc1394feature_batch_t));
+    if (batch)
+        batch->camera = camera;
+    return batch;
+}
+
+void
+dc1394_feature_batch_free(dc1394feature_batch_t *batch)
+{
+    free (batch);
+}
+
+dc1394error_t
+dc1394_feature_batch_set_value(dc1394feature_batch_t *batch, dc1394feature_t feature, uint32_t value)
+{
+    dc1394error_t err;
+
+    if ( (feature<DC1394_FEATURE_MIN) || (feature>DC1394_FEATURE_MAX) )
+        return DC1394_INVALID_FEATURE;
+
+    if ((feature==DC1394_FEATURE_WHITE_BALANCE)||
+        (feature==DC1394_FEATURE_WHITE_SHADING)||
+        (feature==DC1394_FEATURE_TEMPERATURE)) {
+        err=DC1394_INVALID_FEATURE;
+        DC1394_ERR_RTN(err, "You should use the specific functions to write from multiple-value features");
+    }
+
+    feature_batch_record (batch, feature, 0xFFFUL, value);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_feature_batch_whitebalance_set_value(dc1394feature_batch_t *batch, uint32_t u_b_value, uint32_t v_r_value)
+{
+    feature_batch_record (batch, DC1394_FEATURE_WHITE_BALANCE, 0xFFFFFFUL,
+            ((u_b_value & 0xFFFUL) << 12) | (v_r_value & 0xFFFUL));
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_feature_batch_set_power(dc1394feature_batch_t *batch, dc1394feature_t feature, dc1394switch_t pwr)
+{
+    if ( (feature<DC1394_FEATURE_MIN) || (feature>DC1394_FEATURE_MAX) )
+        return DC1394_INVALID_FEATURE;
+
+    feature_batch_record (batch, feature, 0x02000000UL, pwr ? 0x02000000UL : 0);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_feature_batch_set_mode(dc1394feature_batch_t *batch, dc1394feature_t feature, dc1394feature_mode_t mode)
+{
+    if ( (feature<DC1394_FEATURE_MIN) || (feature>DC1394_FEATURE_MAX) )
+        return DC1394_INVALID_FEATURE;
+
+    if ( (mode<DC1394_FEATURE_MODE_MIN) || (mode>DC1394_FEATURE_MODE_MAX) )
+        return DC1394_INVALID_FEATURE_MODE;
+
+    if (feature == DC1394_FEATURE_TRIGGER) {
+        return DC1394_INVALID_FEATURE;
+    }
+
+    switch (mode) {
+    case DC1394_FEATURE_MODE_AUTO:
+        feature_batch_record (batch, feature, 0x01000000UL, 0x01000000UL);
+        break;
+    case DC1394_FEATURE_MODE_MANUAL:
+        feature_batch_record (batch, feature, 0x01000000UL, 0);
+        break;
+    case DC1394_FEATURE_MODE_ONE_PUSH_AUTO:
+        feature_batch_record (batch, feature, 0x04000000UL, 0x04000000UL);
+        break;
+    }
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_feature_batch_set_absolute_control(dc1394feature_batch_t *batch, dc1394feature_t feature, dc1394switch_t pwr)
+{
+    if ( (feature<DC1394_FEATURE_MIN) || (feature>DC1394_FEATURE_MAX) )
+        return DC1394_INVALID_FEATURE;
+
+    feature_batch_record (batch, feature, 0x40000000UL, pwr ? 0x40000000UL : 0);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_feature_batch_set_absolute_value(dc1394feature_batch_t *batch, dc1394feature_t feature, float value)
+{
+    int k;
+
+    if ( (feature > DC1394_FEATURE_MAX) || (feature < DC1394_FEATURE_MIN) ) {
+        return DC1394_INVALID_FEATURE;
+    }
+
+    k = feature_block_index (feature);
+    batch->abs_set[k] = 1;
+    memcpy (&batch->abs_value[k], &value, 4);
+    return DC1394_SUCCESS;
+}
+
+/* Sleeps until just after the next frame is expected to be received */
+static void
+feature_batch_wait_frame (dc1394camera_t *camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    uint64_t last = cpriv->last_frame_timestamp;
+    uint64_t interval = cpriv->last_frame_interval;
+    uint64_t now, next;
+    struct timeval tv;
+
+    if (cpriv->capture_num_buffers == 0 || last == 0 || interval == 0)
+        return;
+    gettimeofday (&tv, NULL);
+    now = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    if (now < last || now - last > FEATURE_BATCH_MAX_FRAME_AGE)
+        return;
+    next = last + ((now - last) / interval + 1) * interval;
+    usleep (next - now);
+}
+
+dc1394error_t
+dc1394_feature_batch_apply(dc1394feature_batch_t *batch, dc1394bool_t at_frame_boundary)
+{
+    dc1394camera_t *camera = batch->camera;
+    uint32_t current[FEATURE_BLOCK_NUM], value[FEATURE_BLOCK_NUM];
+    dc1394register_transaction_t t[FEATURE_BLOCK_NUM * 2];
+    int hi = 0, lo = 0, n = 0, k, start;
+    dc1394error_t err;
+
+    for (k = 0; k < FEATURE_BLOCK_NUM; k++) {
+        if (!batch->mask[k])
+            continue;
+        if (k < FEATURE_BLOCK_HI_NUM)
+            hi = 1;
+        else
+            lo = 1;
+    }
+
+    // read the current registers before waiting, so that the writes go out together
+    if (hi) {
+        err=dc1394_get_control_registers(camera, REG_CAMERA_FEATURE_HI_BASE,
+                current, FEATURE_BLOCK_HI_NUM);
+        DC1394_ERR_RTN(err, "Could not get feature registers");
+    }
+    if (lo) {
+        err=dc1394_get_control_registers(camera, REG_CAMERA_FEATURE_LO_BASE,
+                current + FEATURE_BLOCK_HI_NUM, FEATURE_BLOCK_LO_NUM);
+        DC1394_ERR_RTN(err, "Could not get feature registers");
+    }
+
+    // coalesce the changed registers that are adjacent into block writes
+    for (k = 0; k < FEATURE_BLOCK_NUM; k++) {
+        value[k] = (current[k] & ~batch->mask[k]) | batch->bits[k];
+        if (!batch->mask[k] || value[k] == current[k])
+            continue;
+        start = k;
+        while (k + 1 < FEATURE_BLOCK_NUM && k + 1 != FEATURE_BLOCK_HI_NUM &&
+               batch->mask[k + 1]) {
+            value[k + 1] = (current[k + 1] & ~batch->mask[k + 1]) | batch->bits[k + 1];
+            if (value[k + 1] == current[k + 1])
+                break;
+            k++;
+        }
+        t[n].camera = camera;
+        t[n].offset = camera->command_registers_base + feature_block_offset (start);
+        t[n].value = &value[start];
+        t[n].num_regs = k - start + 1;
+        t[n].write = DC1394_TRUE;
+        n++;
+    }
+
+    for (k = 0; k < FEATURE_BLOCK_NUM; k++) {
+        dc1394feature_t feature;
+        uint64_t absoffset;
+
+        if (!batch->abs_set[k])
+            continue;
+        if (k < FEATURE_BLOCK_HI_NUM)
+            feature = DC1394_FEATURE_MIN + k;
+        else if (k - FEATURE_BLOCK_HI_NUM >= 16)
+            feature = DC1394_FEATURE_ZOOM + k - FEATURE_BLOCK_HI_NUM - 12;
+        else
+            feature = DC1394_FEATURE_ZOOM + k - FEATURE_BLOCK_HI_NUM;
+        err=QueryAbsoluteCSROffset(camera, feature, &absoffset);
+        DC1394_ERR_RTN(err, "Could not get absolute CSR offset");
+        t[n].camera = camera;
+        t[n].offset = absoffset + REG_CAMERA_ABS_VALUE;
+        t[n].value = &batch->abs_value[k];
+        t[n].num_regs = 1;
+        t[n].write = DC1394_TRUE;
+        n++;
+    }
+
+    if (at_frame_boundary)
+        feature_batch_wait_frame (camera);
+
+    err=dc1394_register_transactions(t, n, 0);
+    DC1394_ERR_RTN(err, "Could not apply feature batch");
+
+    memset (batch->mask, 0, sizeof (batch->mask));
+    memset (batch->bits, 0, sizeof (batch->bits));
+    memset (batch->abs_set, 0, sizeof (batch->abs_set));
+    return err;
+}
+
+
 dc1394error_t
 dc1394_pio_set(dc1394camera_t *camera, uint32_t value)
 {
@@ -1963,6 +2326,10 @@ dc1394_new (void)
 #ifdef HAVE_LIBUSB
     usb_init (d);
 #endif
+    replay_init (d);
+    sim_init (d);
+
+    dc1394_set_descriptor_cache (d, getenv ("DC1394_DESCRIPTOR_CACHE"));
 
     int i;
     int initializations = 0;
@@ -1993,6 +2360,7 @@ dc1394_new (void)
 void
 dc1394_free (dc1394_t * d)
 {
+    dc1394_camera_monitor_stop (d);
     free_enumeration (d);
     int i;
     for (i = 0; i < d->num_platforms; i++) {
@@ -2002,6 +2370,7 @@ dc1394_free (dc1394_t * d)
     }
     free (d->platforms);
     d->platforms = NULL;
+    free (d->descriptor_cache);
     free (d);
 }
 
@@ -2053,58 +2422,33 @@ get_leaf_string (platform_camera_t * pcam, const platform_dispatch_t * disp,
     return str;
 }
 
-dc1394camera_t *
-dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
+/*
+  Walks the unit dependent directory for the command registers base, the
+  vendor and model leaves and the sub software version
+*/
+static dc1394error_t
+read_unit_dependent_directory (dc1394camera_t * camera)
 {
-    int i;
-    camera_info_t * info = NULL;
-    platform_camera_t * pcam;
-    const platform_dispatch_t * disp;
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    platform_camera_t * pcam = cpriv->pcam;
+    const platform_dispatch_t * disp = cpriv->platform->dispatch;
     uint32_t command_regs_base = 0;
     uint32_t vendor_name_offset = 0;
     uint32_t model_name_offset = 0;
     uint32_t unit_sub_sw_version = 0;
-    uint32_t ghigh, glow, quad;
+    uint32_t quad;
     uint32_t offset, num_entries;
-    dc1394camera_t * camera;
-    dc1394camera_priv_t * cpriv;
-
-    if (!d->num_cameras)
-        refresh_enumeration (d);
-
-    for (i = 0; i < d->num_cameras; i++) {
-        if (d->cameras[i].guid == guid &&
-            (unit < 0 || d->cameras[i].unit == unit)) {
-            info = d->cameras + i;
-            break;
-        }
-    }
-    if (!info)
-        return NULL;
-
-    disp = info->platform->dispatch;
-    pcam = disp->camera_new (info->platform->p, info->device,
-            info->unit_dependent_directory);
-    if (!pcam)
-        return NULL;
-
-    /* Check to make sure the GUID still matches. */
-    if (disp->camera_read (pcam, 0x40C, &ghigh, 1) < 0 ||
-        disp->camera_read (pcam, 0x410, &glow, 1) < 0)
-        goto fail;
-
-    if (ghigh != (info->guid >> 32) || glow != (info->guid & 0xffffffff))
-        goto fail;
+    int i;
 
-    if (disp->camera_read (pcam, info->unit_dependent_directory,
+    if (disp->camera_read (pcam, camera->unit_dependent_directory,
                 &quad, 1) < 0)
-        goto fail;
+        return DC1394_FAILURE;
 
     num_entries = quad >> 16;
-    offset = info->unit_dependent_directory + 4;
+    offset = camera->unit_dependent_directory + 4;
     for (i = 0; i < num_entries; i++) {
         if (disp->camera_read (pcam, offset + 4 * i, &quad, 1) < 0)
-            goto fail;
+            return DC1394_FAILURE;
         if ((quad >> 24) == 0x40)
             command_regs_base = quad & 0xffffff;
         else if ((quad >> 24) == 0x81) {
@@ -2127,9 +2471,56 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
     }
 
     if (!command_regs_base)
+        return DC1394_FAILURE;
+
+    camera->unit_sub_sw_version = unit_sub_sw_version;
+    camera->command_registers_base = command_regs_base * 4;
+    camera->vendor = get_leaf_string (pcam, disp, vendor_name_offset);
+    camera->model = get_leaf_string (pcam, disp, model_name_offset);
+    return DC1394_SUCCESS;
+}
+
+dc1394camera_t *
+dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
+{
+    int i;
+    camera_info_t * info = NULL;
+    platform_camera_t * pcam;
+    const platform_dispatch_t * disp;
+    uint32_t ghigh, glow;
+    dc1394camera_t * camera = NULL;
+    dc1394camera_priv_t * cpriv;
+
+    if (!d->num_cameras)
+        refresh_enumeration (d);
+
+    for (i = 0; i < d->num_cameras; i++) {
+        if (d->cameras[i].guid == guid &&
+            (unit < 0 || d->cameras[i].unit == unit)) {
+            info = d->cameras + i;
+            break;
+        }
+    }
+    if (!info)
+        return NULL;
+
+    disp = info->platform->dispatch;
+    pcam = disp->camera_new (info->platform->p, info->device,
+            info->unit_dependent_directory);
+    if (!pcam)
+        return NULL;
+
+    /* Check to make sure the GUID still matches. */
+    if (disp->camera_read (pcam, 0x40C, &ghigh, 1) < 0 ||
+        disp->camera_read (pcam, 0x410, &glow, 1) < 0)
+        goto fail;
+
+    if (ghigh != (info->guid >> 32) || glow != (info->guid & 0xffffffff))
         goto fail;
 
     camera = calloc (1, sizeof (dc1394camera_priv_t));
+    if (!camera)
+        goto fail;
     cpriv = DC1394_CAMERA_PRIV (camera);
 
     cpriv->pcam = pcam;
@@ -2138,15 +2529,18 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
     camera->unit = info->unit;
     camera->unit_spec_ID = info->unit_spec_ID;
     camera->unit_sw_version = info->unit_sw_version;
-    camera->unit_sub_sw_version = unit_sub_sw_version;
     camera->unit_directory = info->unit_directory;
     camera->unit_dependent_directory = info->unit_dependent_directory;
-    camera->command_registers_base = command_regs_base * 4;
     camera->vendor_id = info->vendor_id;
     camera->model_id = info->model_id;
 
-    camera->vendor = get_leaf_string (pcam, disp, vendor_name_offset);
-    camera->model = get_leaf_string (pcam, disp, model_name_offset);
+    /* The descriptors saved by a previous run spare the directory walk and
+       the reads of the inquiry registers */
+    if ((!d->descriptor_cache ||
+         descriptor_cache_load (camera, d->descriptor_cache) !=
+            DC1394_SUCCESS) &&
+        read_unit_dependent_directory (camera) != DC1394_SUCCESS)
+        goto fail;
 
     if (camera->unit_spec_ID == 0xA02D) {
         if (info->unit_sw_version == 0x100)
@@ -2157,8 +2551,8 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
             camera->iidc_version = DC1394_IIDC_VERSION_1_30;
             // only add sub_sw_version if it is valid. Otherwise
             // consider that it's IIDC 1.30 (hence add nothing)
-            if ((unit_sub_sw_version >> 4)<=9)
-                camera->iidc_version += unit_sub_sw_version >> 4;
+            if ((camera->unit_sub_sw_version >> 4)<=9)
+                camera->iidc_version += camera->unit_sub_sw_version >> 4;
         }
     }
     else
@@ -2167,9 +2561,19 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
     disp->camera_set_parent (cpriv->pcam, camera);
     update_camera_info (camera);
 
+    if (cpriv->descriptor_path && !cpriv->descriptor_entries)
+        descriptor_cache_save (camera);
+
     return camera;
 
  fail:
+    if (camera) {
+        register_cache_free (camera);
+        free (DC1394_CAMERA_PRIV (camera)->descriptor_path);
+        free (camera->vendor);
+        free (camera->model);
+        free (camera);
+    }
     disp->camera_free (pcam);
     return NULL;
 }
@@ -2189,10 +2593,22 @@ dc1394_camera_free(dc1394camera_t *camera)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
 
+    if (cpriv->capture_thread)
+        dc1394_capture_stop_thread (camera);
+
     if (cpriv->iso_persist)
         dc1394_iso_release_all (camera);
 
+    /* Keep the inquiry registers read since the camera was opened */
+    if (cpriv->descriptor_path &&
+        register_cache_export (camera, NULL, NULL, 0) >
+            cpriv->descriptor_entries)
+        descriptor_cache_save (camera);
+
     cpriv->platform->dispatch->camera_free (cpriv->pcam);
+    register_cache_free (camera);
+    register_trace_free (camera);
+    free (cpriv->descriptor_path);
     free (camera->vendor);
     free (camera->model);
     free (camera);
@@ -195,6 +195,11 @@ typedef struct __dc1394featureset_t
     dc1394feature_info_t    feature[DC1394_FEATURE_NUM];
 } dc1394featureset_t;
 
+/**
+ * Feature settings collected to be applied together
+ */
+typedef struct __dc1394feature_batch_t dc1394feature_batch_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -338,6 +343,61 @@ dc1394error_t dc1394_feature_get_absolute_control(dc1394camera_t *camera, dc1394
  */
 dc1394error_t dc1394_feature_set_absolute_control(dc1394camera_t *camera, dc1394feature_t feature, dc1394switch_t pwr);
 
+/***************************************************************************
+     Feature batches
+ ***************************************************************************/
+
+/**
+ * Creates an empty batch of feature settings for a camera. The dc1394_feature_batch_set_*() functions take
+ * the same arguments as their dc1394_feature_*() counterparts but only record the setting; nothing is sent
+ * to the camera until dc1394_feature_batch_apply().
+ */
+dc1394feature_batch_t * dc1394_feature_batch_new(dc1394camera_t *camera);
+
+/**
+ * Frees a batch
+ */
+void dc1394_feature_batch_free(dc1394feature_batch_t *batch);
+
+/**
+ * Records the value of a feature
+ */
+dc1394error_t dc1394_feature_batch_set_value(dc1394feature_batch_t *batch, dc1394feature_t feature, uint32_t value);
+
+/**
+ * Records the white balance values
+ */
+dc1394error_t dc1394_feature_batch_whitebalance_set_value(dc1394feature_batch_t *batch, uint32_t u_b_value, uint32_t v_r_value);
+
+/**
+ * Records the power of a feature
+ */
+dc1394error_t dc1394_feature_batch_set_power(dc1394feature_batch_t *batch, dc1394feature_t feature, dc1394switch_t pwr);
+
+/**
+ * Records the control mode of a feature
+ */
+dc1394error_t dc1394_feature_batch_set_mode(dc1394feature_batch_t *batch, dc1394feature_t feature, dc1394feature_mode_t mode);
+
+/**
+ * Records the absolute control mode of a feature
+ */
+dc1394error_t dc1394_feature_batch_set_absolute_control(dc1394feature_batch_t *batch, dc1394feature_t feature, dc1394switch_t pwr);
+
+/**
+ * Records the absolute value of a feature
+ */
+dc1394error_t dc1394_feature_batch_set_absolute_value(dc1394feature_batch_t *batch, dc1394feature_t feature, float value);
+
+/**
+ * Applies the settings of a batch and empties it. The current feature registers are read first, then the
+ * changed ones are written back-to-back, adjacent registers in single block writes, and the absolute values
+ * last. If at_frame_boundary is true and frames are being captured, the writes are held until the predicted
+ * end of the next frame transfer, from the timestamps of the frames dequeued so far. IIDC cameras have no
+ * register latch, so this narrows the window in which a frame can see part of the batch but does not close it.
+ */
+dc1394error_t dc1394_feature_batch_apply(dc1394feature_batch_t *batch, dc1394bool_t at_frame_boundary);
+
 /***************************************************************************
      Trigger
  ***************************************************************************/
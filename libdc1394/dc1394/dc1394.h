@@ -49,6 +49,10 @@
 #include <dc1394/conversions.h>
 #include <dc1394/format7.h>
 #include <dc1394/iso.h>
+#include <dc1394/recorder.h>
+#include <dc1394/stream.h>
+#include <dc1394/clocksync.h>
+#include <dc1394/share.h>
 #include <dc1394/log.h>
 #include <dc1394/register.h>
 #include <dc1394/video.h>
@@ -0,0 +1,312 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Cache of the static descriptors of the cameras between process runs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "control.h"
+#include "internal.h"
+#include "offsets.h"
+#include "platform.h"
+#include "log.h"
+
+/*
+  One file per camera unit, named after its GUID and unit number, in the host
+  byte order: a file written on another machine is rejected by its magic. The
+  header is followed by the vendor and model strings, then by the offsets and
+  the values of the constant registers found in the shadow of the camera.
+*/
+#define DESCRIPTOR_MAGIC            0x44433934      /* "DC94" */
+#define DESCRIPTOR_VERSION          1
+#define DESCRIPTOR_NO_STRING        0xffffffff
+#define DESCRIPTOR_MAX_STRING       1024
+#define DESCRIPTOR_MAX_REGISTERS    512
+
+/* The registers read to validate a file: the header of the unit dependent
+   directory, which holds its CRC, and the two main inquiry registers */
+enum {
+    DESCRIPTOR_CHECK_DIRECTORY = 0,
+    DESCRIPTOR_CHECK_BASIC_FUNC,
+    DESCRIPTOR_CHECK_V_FORMAT,
+    DESCRIPTOR_NUM_CHECKS
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t guid;
+    uint32_t unit;
+    uint32_t unit_spec_ID;
+    uint32_t unit_sw_version;
+    uint32_t unit_sub_sw_version;
+    uint32_t command_registers_base;
+    uint32_t check[DESCRIPTOR_NUM_CHECKS];
+    uint32_t vendor_len;
+    uint32_t model_len;
+    uint32_t num_registers;
+    uint32_t reserved;
+} descriptor_header_t;
+
+dc1394error_t
+dc1394_set_descriptor_cache (dc1394_t * d, const char * directory)
+{
+    char * dir = NULL;
+
+    if (!d)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    if (directory && *directory) {
+        dir = strdup (directory);
+        if (!dir)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    free (d->descriptor_cache);
+    d->descriptor_cache = dir;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+descriptor_read_checks (dc1394camera_t * camera,
+        uint32_t command_registers_base, uint32_t * check)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * disp = cpriv->platform->dispatch;
+
+    if (disp->camera_read (cpriv->pcam, camera->unit_dependent_directory,
+                check + DESCRIPTOR_CHECK_DIRECTORY, 1) < 0 ||
+        disp->camera_read (cpriv->pcam,
+                command_registers_base + REG_CAMERA_BASIC_FUNC_INQ,
+                check + DESCRIPTOR_CHECK_BASIC_FUNC, 1) < 0 ||
+        disp->camera_read (cpriv->pcam,
+                command_registers_base + REG_CAMERA_V_FORMAT_INQ,
+                check + DESCRIPTOR_CHECK_V_FORMAT, 1) < 0)
+        return DC1394_FAILURE;
+    return DC1394_SUCCESS;
+}
+
+static char *
+descriptor_read_string (FILE * f, uint32_t len)
+{
+    char * str;
+
+    if (len == DESCRIPTOR_NO_STRING || len > DESCRIPTOR_MAX_STRING)
+        return NULL;
+    str = malloc (len + 1);
+    if (!str)
+        return NULL;
+    if (len && fread (str, len, 1, f) != 1) {
+        free (str);
+        return NULL;
+    }
+    str[len] = '\0';
+    return str;
+}
+
+/*
+  Fills in the descriptors of a camera from its file in directory. The file
+  is used only if it was written for the same GUID, unit and software
+  version, and if the registers it was validated with still read the same.
+  The path is remembered in any case, for descriptor_cache_save().
+*/
+dc1394error_t
+descriptor_cache_load (dc1394camera_t * camera, const char * directory)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    descriptor_header_t h;
+    uint32_t check[DESCRIPTOR_NUM_CHECKS];
+    uint64_t * offsets = NULL;
+    uint32_t * values = NULL;
+    char * vendor = NULL, * model = NULL;
+    size_t len;
+    FILE * f;
+
+    len = strlen (directory) + 64;
+    cpriv->descriptor_path = malloc (len);
+    if (!cpriv->descriptor_path)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    snprintf (cpriv->descriptor_path, len, "%s/%016"PRIx64"-%u.desc",
+            directory, camera->guid, camera->unit);
+
+    f = fopen (cpriv->descriptor_path, "rb");
+    if (!f)
+        return DC1394_FAILURE;
+
+    if (fread (&h, sizeof (h), 1, f) != 1 ||
+        h.magic != DESCRIPTOR_MAGIC || h.version != DESCRIPTOR_VERSION ||
+        h.guid != camera->guid || h.unit != camera->unit ||
+        h.unit_spec_ID != camera->unit_spec_ID ||
+        h.unit_sw_version != camera->unit_sw_version ||
+        !h.command_registers_base ||
+        h.num_registers > DESCRIPTOR_MAX_REGISTERS)
+        goto miss;
+
+    if (descriptor_read_checks (camera, h.command_registers_base,
+                check) != DC1394_SUCCESS ||
+        memcmp (check, h.check, sizeof (check)))
+        goto miss;
+
+    vendor = descriptor_read_string (f, h.vendor_len);
+    model = descriptor_read_string (f, h.model_len);
+    if ((h.vendor_len != DESCRIPTOR_NO_STRING && !vendor) ||
+        (h.model_len != DESCRIPTOR_NO_STRING && !model))
+        goto miss;
+
+    if (h.num_registers) {
+        offsets = malloc (h.num_registers * sizeof (uint64_t));
+        values = malloc (h.num_registers * sizeof (uint32_t));
+        if (!offsets || !values ||
+            fread (offsets, sizeof (uint64_t), h.num_registers, f) !=
+                h.num_registers ||
+            fread (values, sizeof (uint32_t), h.num_registers, f) !=
+                h.num_registers)
+            goto miss;
+    }
+    fclose (f);
+
+    camera->command_registers_base = h.command_registers_base;
+    camera->unit_sub_sw_version = h.unit_sub_sw_version;
+    camera->vendor = vendor;
+    camera->model = model;
+    register_cache_import (camera, offsets, values, h.num_registers);
+    cpriv->descriptor_entries = h.num_registers;
+    free (offsets);
+    free (values);
+
+    dc1394_log_debug ("Loaded the descriptors of camera 0x%"PRIx64
+            " from %s", camera->guid, cpriv->descriptor_path);
+    return DC1394_SUCCESS;
+
+ miss:
+    fclose (f);
+    free (vendor);
+    free (model);
+    free (offsets);
+    free (values);
+    dc1394_log_debug ("Descriptors in %s do not match camera 0x%"PRIx64,
+            cpriv->descriptor_path, camera->guid);
+    return DC1394_FAILURE;
+}
+
+static int
+descriptor_write_string (FILE * f, const char * str)
+{
+    return !str || !*str || fwrite (str, strlen (str), 1, f) == 1;
+}
+
+/*
+  Writes the descriptors of a camera and the constant registers currently in
+  its shadow. The file is replaced at once so that a process opening the same
+  camera never reads half of it.
+*/
+void
+descriptor_cache_save (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    descriptor_header_t h;
+    uint64_t * offsets = NULL;
+    uint32_t * values = NULL;
+    char * tmp = NULL;
+    char * slash;
+    size_t len;
+    FILE * f;
+    int ok;
+
+    if (!cpriv->descriptor_path)
+        return;
+
+    memset (&h, 0, sizeof (h));
+    h.magic = DESCRIPTOR_MAGIC;
+    h.version = DESCRIPTOR_VERSION;
+    h.guid = camera->guid;
+    h.unit = camera->unit;
+    h.unit_spec_ID = camera->unit_spec_ID;
+    h.unit_sw_version = camera->unit_sw_version;
+    h.unit_sub_sw_version = camera->unit_sub_sw_version;
+    h.command_registers_base = camera->command_registers_base;
+    h.vendor_len = camera->vendor ? strlen (camera->vendor) :
+        DESCRIPTOR_NO_STRING;
+    h.model_len = camera->model ? strlen (camera->model) :
+        DESCRIPTOR_NO_STRING;
+    if ((camera->vendor && h.vendor_len > DESCRIPTOR_MAX_STRING) ||
+        (camera->model && h.model_len > DESCRIPTOR_MAX_STRING))
+        return;
+
+    if (descriptor_read_checks (camera, h.command_registers_base,
+                h.check) != DC1394_SUCCESS)
+        return;
+
+    offsets = malloc (DESCRIPTOR_MAX_REGISTERS * sizeof (uint64_t));
+    values = malloc (DESCRIPTOR_MAX_REGISTERS * sizeof (uint32_t));
+    len = strlen (cpriv->descriptor_path) + 32;
+    tmp = malloc (len);
+    if (!offsets || !values || !tmp)
+        goto out;
+    h.num_registers = register_cache_export (camera, offsets, values,
+            DESCRIPTOR_MAX_REGISTERS);
+    if (h.num_registers > DESCRIPTOR_MAX_REGISTERS)
+        h.num_registers = DESCRIPTOR_MAX_REGISTERS;
+
+    /* Create the directory itself, but not its parents */
+    strcpy (tmp, cpriv->descriptor_path);
+    slash = strrchr (tmp, '/');
+    if (slash && slash != tmp) {
+        *slash = '\0';
+        if (mkdir (tmp, 0755) < 0 && errno != EEXIST) {
+            dc1394_log_warning ("Could not create %s: %s", tmp,
+                    strerror (errno));
+            goto out;
+        }
+    }
+
+    snprintf (tmp, len, "%s.%d", cpriv->descriptor_path, (int) getpid ());
+    f = fopen (tmp, "wb");
+    if (!f) {
+        dc1394_log_warning ("Could not write %s: %s", tmp, strerror (errno));
+        goto out;
+    }
+    ok = fwrite (&h, sizeof (h), 1, f) == 1 &&
+        descriptor_write_string (f, camera->vendor) &&
+        descriptor_write_string (f, camera->model) &&
+        fwrite (offsets, sizeof (uint64_t), h.num_registers, f) ==
+            h.num_registers &&
+        fwrite (values, sizeof (uint32_t), h.num_registers, f) ==
+            h.num_registers;
+    if (fclose (f) != 0)
+        ok = 0;
+    if (!ok || rename (tmp, cpriv->descriptor_path) < 0) {
+        dc1394_log_warning ("Could not write %s", cpriv->descriptor_path);
+        unlink (tmp);
+        goto out;
+    }
+    cpriv->descriptor_entries = h.num_registers;
+
+ out:
+    free (offsets);
+    free (values);
+    free (tmp);
+}
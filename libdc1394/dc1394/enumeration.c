@@ -22,6 +22,11 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <dc1394/control.h>
 #include "internal.h"
@@ -175,17 +180,9 @@ done:
 
 static int
 identify_camera (dc1394_t * d, platform_info_t * platform,
-        platform_device_t * dev)
+        platform_device_t * dev, uint32_t * quads, int num_quads)
 {
     uint64_t guid;
-    uint32_t quads[256];
-    int num_quads = 256;
-    if (platform->dispatch->device_get_config_rom (dev, quads,
-                &num_quads) < 0) {
-        dc1394_log_warning ("Failed to get config ROM from %s device",
-                platform->name);
-        return -1;
-    }
 
     dc1394_log_debug ("Got %d quads of config ROM", num_quads);
 
@@ -242,38 +239,169 @@ free_enumeration (dc1394_t * d)
     d->cameras = NULL;
 }
 
-int
-refresh_enumeration (dc1394_t * d)
+/*
+  Runs fn for each index below num, on up to max_threads threads including
+  the calling one. Indices are handed out in order; the call returns once
+  all of them are done. If no thread can be started, everything is run by
+  the caller.
+*/
+typedef struct {
+    pthread_mutex_t mutex;
+    int next;
+    int num;
+    void (*fn) (void *, int);
+    void * arg;
+} parallel_t;
+
+static void *
+parallel_worker (void * arg)
 {
-    free_enumeration (d);
-
-    dc1394_log_debug ("Enumerating cameras...");
+    parallel_t * p = arg;
     int i;
-    for (i = 0; i < d->num_platforms; i++) {
-        platform_info_t * p = d->platforms + i;
-        if (!p->p)
-            continue;
-        dc1394_log_debug("Enumerating platform %s", p->name);
-        p->device_list = p->dispatch->get_device_list (p->p);
-        if (!p->device_list) {
-            dc1394_log_warning("Platform %s failed to get device list",
-                    p->name);
+
+    for (;;) {
+        pthread_mutex_lock (&p->mutex);
+        i = p->next < p->num ? p->next++ : -1;
+        pthread_mutex_unlock (&p->mutex);
+        if (i < 0)
+            return NULL;
+        p->fn (p->arg, i);
+    }
+}
+
+void
+run_parallel (int num, int max_threads, void (*fn) (void *, int), void * arg)
+{
+    pthread_t threads[ENUMERATION_MAX_THREADS];
+    parallel_t p;
+    int i, num_threads = 0;
+
+    if (max_threads > ENUMERATION_MAX_THREADS)
+        max_threads = ENUMERATION_MAX_THREADS;
+    if (num <= 1 || max_threads <= 1) {
+        for (i = 0; i < num; i++)
+            fn (arg, i);
+        return;
+    }
+
+    pthread_mutex_init (&p.mutex, NULL);
+    p.next = 0;
+    p.num = num;
+    p.fn = fn;
+    p.arg = arg;
+    while (num_threads < max_threads - 1 && num_threads < num - 1 &&
+           pthread_create (threads + num_threads, NULL, parallel_worker,
+               &p) == 0)
+        num_threads++;
+
+    parallel_worker (&p);
+    for (i = 0; i < num_threads; i++)
+        pthread_join (threads[i], NULL);
+    pthread_mutex_destroy (&p.mutex);
+}
+
+/* The config ROM of every device of every platform, fetched concurrently */
+typedef struct {
+    platform_info_t * platform;
+    platform_device_t * device;
+    int index;                      /* in the device list of the platform */
+    int num_quads;                  /* -1 if the ROM could not be read */
+    uint32_t quads[256];
+} device_rom_t;
+
+static void
+get_device_list (void * arg, int i)
+{
+    platform_info_t * p = (platform_info_t *) arg + i;
+
+    if (!p->p)
+        return;
+    dc1394_log_debug("Enumerating platform %s", p->name);
+    p->device_list = p->dispatch->get_device_list (p->p);
+    if (!p->device_list) {
+        dc1394_log_warning("Platform %s failed to get device list",
+                p->name);
+        return;
+    }
+    dc1394_log_debug ("Platform %s has %d device(s)",
+            p->name, p->device_list->num_devices);
+}
+
+static void
+get_device_rom (void * arg, int i)
+{
+    device_rom_t * rom = (device_rom_t *) arg + i;
+
+    rom->num_quads = 256;
+    if (rom->platform->dispatch->device_get_config_rom (rom->device,
+                rom->quads, &rom->num_quads) < 0)
+        rom->num_quads = -1;
+}
+
+/*
+  Reads the device lists of num_platforms platforms and adds their cameras.
+  Every device is probed at once, so that this takes as long as the slowest
+  one. The cameras are then added in the order of the platforms and of their
+  device lists, as if probed one by one.
+*/
+static int
+probe_platforms (dc1394_t * d, platform_info_t * platforms, int num_platforms)
+{
+    device_rom_t * roms;
+    int i, j, num_devices = 0;
+
+    run_parallel (num_platforms, num_platforms, get_device_list, platforms);
+
+    for (i = 0; i < num_platforms; i++)
+        if (platforms[i].device_list)
+            num_devices += platforms[i].device_list->num_devices;
+    if (!num_devices)
+        return 0;
+
+    roms = malloc (num_devices * sizeof (device_rom_t));
+    if (!roms)
+        return -1;
+    num_devices = 0;
+    for (i = 0; i < num_platforms; i++) {
+        platform_info_t * p = platforms + i;
+        if (!p->device_list)
             continue;
+        for (j = 0; j < p->device_list->num_devices; j++) {
+            roms[num_devices].platform = p;
+            roms[num_devices].device = p->device_list->devices[j];
+            roms[num_devices].index = j;
+            num_devices++;
         }
+    }
 
-        platform_device_t ** list = p->device_list->devices;
-        int j;
-        dc1394_log_debug ("Platform %s has %d device(s)",
-                p->name, p->device_list->num_devices);
-        for (j = 0; j < p->device_list->num_devices; j++)
-            if (identify_camera (d, p, list[j]) < 0)
-                dc1394_log_debug ("Failed to identify %s device %d",
-                        p->name, j);
+    run_parallel (num_devices, ENUMERATION_MAX_THREADS, get_device_rom,
+            roms);
+
+    for (i = 0; i < num_devices; i++) {
+        device_rom_t * rom = roms + i;
+        if (rom->num_quads < 0)
+            dc1394_log_warning ("Failed to get config ROM from %s device",
+                    rom->platform->name);
+        if (rom->num_quads < 0 ||
+            identify_camera (d, rom->platform, rom->device, rom->quads,
+                rom->num_quads) < 0)
+            dc1394_log_debug ("Failed to identify %s device %d",
+                    rom->platform->name, rom->index);
     }
+    free (roms);
 
     return 0;
 }
 
+int
+refresh_enumeration (dc1394_t * d)
+{
+    free_enumeration (d);
+
+    dc1394_log_debug ("Enumerating cameras...");
+    return probe_platforms (d, d->platforms, d->num_platforms);
+}
+
 dc1394error_t
 dc1394_camera_enumerate (dc1394_t * d, dc1394camera_list_t **list)
 {
@@ -311,3 +439,319 @@ dc1394_camera_free_list (dc1394camera_list_t *list)
     free (list);
 }
 
+/*
+  Hotplug monitor. A thread waits on the descriptors of the platforms and
+  only flags those that changed; the camera list is updated from the thread
+  of the caller, in dc1394_camera_monitor_get_events(), so that it is never
+  modified behind dc1394_camera_new().
+*/
+struct _camera_monitor_t {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    int stop_pipe[2];
+    int event_pipe[2];              /* readable while something is pending */
+    int signaled;
+    int * fds;                      /* per platform, -1 if not watched */
+    int * changed;                  /* per platform, set by the thread */
+
+    dc1394camera_id_t * known;      /* the cameras already reported */
+    int num_known;
+    dc1394camera_event_t * events;  /* not read yet */
+    int num_events;
+};
+
+static void
+monitor_signal (camera_monitor_t * m)
+{
+    if (!m->signaled && write (m->event_pipe[1], "", 1) == 1)
+        m->signaled = 1;
+}
+
+static void *
+monitor_thread (void * arg)
+{
+    dc1394_t * d = arg;
+    camera_monitor_t * m = d->monitor;
+    struct pollfd fds[d->num_platforms + 1];
+    int platforms[d->num_platforms + 1];
+    int i, n;
+
+    for (;;) {
+        n = 0;
+        fds[n].fd = m->stop_pipe[0];
+        fds[n].events = POLLIN;
+        n++;
+        for (i = 0; i < d->num_platforms; i++) {
+            if (m->fds[i] < 0)
+                continue;
+            fds[n].fd = m->fds[i];
+            fds[n].events = POLLIN;
+            platforms[n] = i;
+            n++;
+        }
+
+        if (poll (fds, n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            dc1394_log_error ("Hotplug monitor failed: %s", strerror (errno));
+            return NULL;
+        }
+        if (fds[0].revents)
+            return NULL;
+
+        for (i = 1; i < n; i++) {
+            platform_info_t * p = d->platforms + platforms[i];
+            if (fds[i].revents & (POLLERR | POLLNVAL)) {
+                dc1394_log_warning ("Hotplug monitor of platform %s failed",
+                        p->name);
+                m->fds[platforms[i]] = -1;
+                continue;
+            }
+            if (!fds[i].revents || !p->dispatch->monitor_changed (p->p))
+                continue;
+            pthread_mutex_lock (&m->mutex);
+            m->changed[platforms[i]] = 1;
+            monitor_signal (m);
+            pthread_mutex_unlock (&m->mutex);
+        }
+    }
+}
+
+static int
+camera_id_index (const dc1394camera_id_t * ids, int num, uint64_t guid,
+        int unit)
+{
+    int i;
+    for (i = 0; i < num; i++)
+        if (ids[i].guid == guid && ids[i].unit == unit)
+            return i;
+    return -1;
+}
+
+/* Queues the differences between the cameras reported so far and the
+   current list, and makes the latter the reported one */
+static dc1394error_t
+monitor_update (dc1394_t * d)
+{
+    camera_monitor_t * m = d->monitor;
+    dc1394camera_event_t * events;
+    dc1394camera_id_t * known;
+    int i, n = m->num_events;
+
+    events = realloc (m->events, (m->num_events + m->num_known +
+                d->num_cameras + 1) * sizeof (dc1394camera_event_t));
+    if (!events)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    m->events = events;
+    known = malloc ((d->num_cameras + 1) * sizeof (dc1394camera_id_t));
+    if (!known)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+
+    for (i = 0; i < d->num_cameras; i++) {
+        known[i].guid = d->cameras[i].guid;
+        known[i].unit = d->cameras[i].unit;
+    }
+    for (i = 0; i < m->num_known; i++) {
+        if (camera_id_index (known, d->num_cameras, m->known[i].guid,
+                    m->known[i].unit) >= 0)
+            continue;
+        events[n].type = DC1394_CAMERA_REMOVED;
+        events[n].id = m->known[i];
+        n++;
+    }
+    for (i = 0; i < d->num_cameras; i++) {
+        if (camera_id_index (m->known, m->num_known, known[i].guid,
+                    known[i].unit) >= 0)
+            continue;
+        events[n].type = DC1394_CAMERA_ARRIVED;
+        events[n].id = known[i];
+        n++;
+    }
+    for (i = m->num_events; i < n; i++)
+        dc1394_log_debug ("Camera %"PRIx64":%d %s", events[i].id.guid,
+                events[i].id.unit, events[i].type == DC1394_CAMERA_ARRIVED ?
+                "arrived" : "removed");
+
+    free (m->known);
+    m->known = known;
+    m->num_known = d->num_cameras;
+    m->num_events = n;
+    return DC1394_SUCCESS;
+}
+
+static void
+monitor_free (dc1394_t * d, camera_monitor_t * m)
+{
+    int i;
+
+    for (i = 0; i < d->num_platforms; i++) {
+        platform_info_t * p = d->platforms + i;
+        if (m->fds && m->fds[i] >= 0)
+            p->dispatch->monitor_stop (p->p);
+    }
+    for (i = 0; i < 2; i++) {
+        if (m->stop_pipe[i] >= 0)
+            close (m->stop_pipe[i]);
+        if (m->event_pipe[i] >= 0)
+            close (m->event_pipe[i]);
+    }
+    pthread_mutex_destroy (&m->mutex);
+    free (m->fds);
+    free (m->changed);
+    free (m->known);
+    free (m->events);
+    free (m);
+}
+
+dc1394error_t
+dc1394_camera_monitor_start (dc1394_t * d)
+{
+    camera_monitor_t * m;
+    int i, num_watched = 0;
+
+    if (d->monitor)
+        return DC1394_SUCCESS;
+
+    m = calloc (1, sizeof (camera_monitor_t));
+    if (!m)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    pthread_mutex_init (&m->mutex, NULL);
+    m->stop_pipe[0] = m->stop_pipe[1] = -1;
+    m->event_pipe[0] = m->event_pipe[1] = -1;
+    m->fds = malloc (d->num_platforms * sizeof (int));
+    m->changed = calloc (d->num_platforms, sizeof (int));
+    if (!m->fds || !m->changed) {
+        monitor_free (d, m);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    /* Watch before taking the initial list, so that nothing is missed */
+    for (i = 0; i < d->num_platforms; i++) {
+        platform_info_t * p = d->platforms + i;
+        m->fds[i] = -1;
+        if (!p->p || !p->dispatch->monitor_start ||
+            !p->dispatch->monitor_stop || !p->dispatch->monitor_changed)
+            continue;
+        m->fds[i] = p->dispatch->monitor_start (p->p);
+        if (m->fds[i] >= 0) {
+            dc1394_log_debug ("Watching platform %s for hotplug", p->name);
+            num_watched++;
+        }
+    }
+    if (!num_watched) {
+        monitor_free (d, m);
+        dc1394_log_error ("No platform can notify cameras coming and going");
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    }
+
+    if (pipe (m->stop_pipe) < 0 || pipe (m->event_pipe) < 0) {
+        monitor_free (d, m);
+        return DC1394_FAILURE;
+    }
+    fcntl (m->event_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl (m->event_pipe[1], F_SETFL, O_NONBLOCK);
+
+    if (!d->num_cameras)
+        refresh_enumeration (d);
+    d->monitor = m;
+    if (monitor_update (d) != DC1394_SUCCESS ||
+        pthread_create (&m->thread, NULL, monitor_thread, d) != 0) {
+        d->monitor = NULL;
+        monitor_free (d, m);
+        return DC1394_FAILURE;
+    }
+    /* The cameras already there are not news */
+    m->num_events = 0;
+    return DC1394_SUCCESS;
+}
+
+void
+dc1394_camera_monitor_stop (dc1394_t * d)
+{
+    camera_monitor_t * m = d->monitor;
+
+    if (!m)
+        return;
+    if (write (m->stop_pipe[1], "", 1) == 1)
+        pthread_join (m->thread, NULL);
+    else
+        pthread_cancel (m->thread);
+    d->monitor = NULL;
+    monitor_free (d, m);
+}
+
+int
+dc1394_camera_monitor_get_fileno (dc1394_t * d)
+{
+    if (!d->monitor)
+        return -1;
+    return d->monitor->event_pipe[0];
+}
+
+/* Reads the device list of one platform again, leaving the cameras of the
+   others where they are */
+static void
+refresh_platform (dc1394_t * d, platform_info_t * p)
+{
+    int i, n = 0;
+
+    for (i = 0; i < d->num_cameras; i++) {
+        if (d->cameras[i].platform == p)
+            destroy_camera_info (d->cameras + i);
+        else
+            d->cameras[n++] = d->cameras[i];
+    }
+    d->num_cameras = n;
+    if (p->device_list)
+        p->dispatch->free_device_list (p->device_list);
+    p->device_list = NULL;
+
+    dc1394_log_debug ("Devices of platform %s changed", p->name);
+    probe_platforms (d, p, 1);
+}
+
+dc1394error_t
+dc1394_camera_monitor_get_events (dc1394_t * d, dc1394camera_event_t * events,
+        uint32_t * num_events)
+{
+    camera_monitor_t * m = d->monitor;
+    int changed[d->num_platforms];
+    char buf[16];
+    dc1394error_t err;
+    uint32_t n;
+    int i;
+
+    if (!m || !num_events || (*num_events && !events))
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    /* Notifications that come while the lists are read signal again */
+    pthread_mutex_lock (&m->mutex);
+    while (read (m->event_pipe[0], buf, sizeof (buf)) > 0)
+        ;
+    m->signaled = 0;
+    memcpy (changed, m->changed, sizeof (changed));
+    memset (m->changed, 0, sizeof (changed));
+    pthread_mutex_unlock (&m->mutex);
+
+    for (i = 0; i < d->num_platforms; i++)
+        if (changed[i])
+            refresh_platform (d, d->platforms + i);
+
+    err = monitor_update (d);
+    DC1394_ERR_RTN (err, "Could not update the camera list");
+
+    n = *num_events < m->num_events ? *num_events : m->num_events;
+    if (n)
+        memcpy (events, m->events, n * sizeof (dc1394camera_event_t));
+    m->num_events -= n;
+    memmove (m->events, m->events + n,
+            m->num_events * sizeof (dc1394camera_event_t));
+    *num_events = n;
+
+    if (m->num_events) {
+        pthread_mutex_lock (&m->mutex);
+        monitor_signal (m);
+        pthread_mutex_unlock (&m->mutex);
+    }
+    return DC1394_SUCCESS;
+}
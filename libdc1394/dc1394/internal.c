@@ -20,6 +20,8 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <string.h>
+
 #include "internal.h"
 #include "utils.h"
 #include "log.h"
@@ -283,3 +285,57 @@ capture_basic_setup (dc1394camera_t * camera, dc1394video_frame_t * frame)
     return DC1394_SUCCESS;
 }
 
+
+void
+stream_header_from_frame (stream_frame_header_t * h,
+        const dc1394video_frame_t * f)
+{
+    h->magic = STREAM_FRAME_MAGIC;
+    h->id = f->id;
+    h->timestamp = f->timestamp;
+    h->total_bytes = f->total_bytes;
+    h->size[0] = f->size[0];
+    h->size[1] = f->size[1];
+    h->position[0] = f->position[0];
+    h->position[1] = f->position[1];
+    h->color_coding = f->color_coding;
+    h->color_filter = f->color_filter;
+    h->yuv_byte_order = f->yuv_byte_order;
+    h->data_depth = f->data_depth;
+    h->stride = f->stride;
+    h->video_mode = f->video_mode;
+    h->image_bytes = f->image_bytes;
+    h->padding_bytes = f->padding_bytes;
+    h->packet_size = f->packet_size;
+    h->packets_per_frame = f->packets_per_frame;
+    h->frames_behind = f->frames_behind;
+    h->little_endian = f->little_endian;
+    h->data_in_padding = f->data_in_padding;
+}
+
+void
+stream_header_to_frame (dc1394video_frame_t * f,
+        const stream_frame_header_t * h)
+{
+    memset (f, 0, sizeof (dc1394video_frame_t));
+    f->size[0] = h->size[0];
+    f->size[1] = h->size[1];
+    f->position[0] = h->position[0];
+    f->position[1] = h->position[1];
+    f->color_coding = h->color_coding;
+    f->color_filter = h->color_filter;
+    f->yuv_byte_order = h->yuv_byte_order;
+    f->data_depth = h->data_depth;
+    f->stride = h->stride;
+    f->video_mode = h->video_mode;
+    f->total_bytes = h->total_bytes;
+    f->image_bytes = h->image_bytes;
+    f->padding_bytes = h->padding_bytes;
+    f->packet_size = h->packet_size;
+    f->packets_per_frame = h->packets_per_frame;
+    f->timestamp = h->timestamp;
+    f->frames_behind = h->frames_behind;
+    f->id = h->id;
+    f->little_endian = h->little_endian;
+    f->data_in_padding = h->data_in_padding;
+}
@@ -34,6 +34,12 @@ typedef struct _platform_info_t {
     platform_t * p;
 } platform_info_t;
 
+typedef struct _capture_thread_t capture_thread_t;
+typedef struct _capture_refs_t capture_refs_t;
+typedef struct _register_cache_t register_cache_t;
+typedef struct _register_trace_t register_trace_t;
+typedef struct _camera_monitor_t camera_monitor_t;
+
 typedef struct _dc1394camera_priv_t {
     dc1394camera_t camera;
 
@@ -43,6 +49,31 @@ typedef struct _dc1394camera_priv_t {
     uint64_t allocated_channels;
     int allocated_bandwidth;
     int iso_persist;
+
+    uint32_t capture_num_buffers;
+    capture_thread_t * capture_thread;
+    capture_refs_t * capture_refs;
+
+    register_cache_t * register_cache;
+    int register_cache_off;
+    register_trace_t * register_trace;
+    int register_trace_on;
+
+    char * descriptor_path;
+    uint32_t descriptor_entries;
+
+    dc1394capture_stats_t capture_stats;
+    uint64_t last_frame_timestamp;
+    uint64_t last_frame_interval;
+
+    /* bus reset recovery of the capture */
+    uint32_t capture_generation;
+    uint32_t capture_iso_channel;
+    int capture_streaming;
+    uint64_t capture_gap_start;     /* last frame before a reset */
+    uint64_t capture_reset_time;
+    volatile uint32_t capture_reset_generation;  /* seen by the receive thread */
+    volatile int capture_reset_pending;
 } dc1394camera_priv_t;
 
 #define DC1394_CAMERA_PRIV(c) ((dc1394camera_priv_t *)c)
@@ -68,6 +99,9 @@ struct __dc1394_t {
 
     int num_cameras;
     camera_info_t * cameras;
+
+    char * descriptor_cache;
+    camera_monitor_t * monitor;
 };
 
 void juju_init(dc1394_t *d);
@@ -75,6 +109,8 @@ void linux_init(dc1394_t *d);
 void macosx_init(dc1394_t *d);
 void windows_init(dc1394_t *d);
 void usb_init(dc1394_t *d);
+void replay_init(dc1394_t *d);
+void sim_init(dc1394_t *d);
 
 void register_platform (dc1394_t * d, const platform_dispatch_t * dispatch,
         const char * name);
@@ -82,6 +118,11 @@ void register_platform (dc1394_t * d, const platform_dispatch_t * dispatch,
 void free_enumeration (dc1394_t * d);
 int refresh_enumeration (dc1394_t * d);
 
+/* Threads used to probe devices during enumeration, at most */
+#define ENUMERATION_MAX_THREADS  16
+void run_parallel (int num, int max_threads, void (*fn) (void *, int),
+        void * arg);
+
 /* Definitions which application developers shouldn't care about */
 #define CONFIG_ROM_BASE             0xFFFFF0000000ULL
 
@@ -182,10 +223,118 @@ get_format_from_mode(uint32_t mode, uint32_t *format);
 dc1394bool_t
 is_feature_bit_set(uint32_t value, uint32_t feature);
 
+dc1394error_t
+QueryAbsoluteCSROffset(dc1394camera_t *camera, dc1394feature_t feature, uint64_t *offset);
+
 /*
 dc1394bool_t
 _dc1394_iidc_check_video_mode(dc1394camera_t *camera, dc1394video_mode_t *mode);
 */
 dc1394error_t capture_basic_setup (dc1394camera_t * camera, dc1394video_frame_t * frame);
 
+/* Recorded stream files (see recorder.c and stream.c). All blocks are
+   DC1394_RECORDER_BLOCK_SIZE bytes and values are in host byte order:
+     block 0            file header
+     per frame          a frame header block followed by the payload,
+                        padded to a whole number of blocks
+     trailing index     one uint64_t per frame: offset of its header block,
+                        padded to a whole number of blocks
+     last block         index footer
+   The index and footer are written when the recorder is freed; without
+   them the frames can still be found by walking the frame headers. */
+#define STREAM_FILE_MAGIC          "DC1394RS"
+#define STREAM_INDEX_MAGIC         "DC1394IX"
+#define STREAM_FRAME_MAGIC         0x4d415246   /* "FRAM" */
+#define STREAM_VERSION             1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t block_size;
+} stream_file_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    uint64_t timestamp;
+    uint64_t total_bytes;
+    uint32_t size[2];
+    uint32_t position[2];
+    uint32_t color_coding;
+    uint32_t color_filter;
+    uint32_t yuv_byte_order;
+    uint32_t data_depth;
+    uint32_t stride;
+    uint32_t video_mode;
+    uint32_t image_bytes;
+    uint32_t padding_bytes;
+    uint32_t packet_size;
+    uint32_t packets_per_frame;
+    uint32_t frames_behind;
+    uint32_t little_endian;
+    uint32_t data_in_padding;
+    uint32_t reserved;
+} stream_frame_header_t;
+
+typedef struct {
+    char     magic[8];
+    uint64_t num_frames;
+    uint64_t index_offset;
+} stream_index_footer_t;
+
+void stream_header_from_frame (stream_frame_header_t * h,
+        const dc1394video_frame_t * f);
+void stream_header_to_frame (dc1394video_frame_t * f,
+        const stream_frame_header_t * h);
+
+/* Accounts a frame that was taken from the backend ring */
+void capture_stats_frame_dequeued (dc1394camera_t * camera,
+        dc1394video_frame_t * frame);
+
+/* Accounts frames that were captured but never given to the user, from
+   the backends as well as from the receive thread */
+void capture_stats_frames_dropped (dc1394camera_t * camera, uint32_t count);
+
+/* Accounts a backend left without a buffer to receive into */
+void capture_stats_ring_overrun (dc1394camera_t * camera);
+
+/* Recovers the capture if the bus was reset since the last check, in
+   capture.c. Returns DC1394_SUCCESS if there was nothing to do. The
+   recovery sends register transactions, so it is never run by the receive
+   thread: that thread only notices the reset, which returns 1, and leaves
+   the recovery to the next check of the application. */
+dc1394error_t capture_check_bus_reset (dc1394camera_t * camera);
+int capture_notice_bus_reset (dc1394camera_t * camera);
+
+/* Allocates again the channels and bandwidth recorded for a camera, which
+   the bus forgets when it is reset, in iso.c */
+dc1394error_t iso_reallocate (dc1394camera_t * camera);
+
+/* Gives a frame handed to the user its first reference */
+void capture_refs_frame_delivered (dc1394camera_t * camera,
+        dc1394video_frame_t * frame);
+
+/* Frees the register shadow and the transaction trace of a camera */
+void register_cache_free (dc1394camera_t * camera);
+void register_trace_free (dc1394camera_t * camera);
+
+/* The constant registers of the shadow, for the descriptor cache. Export
+   returns the number of entries, and fills at most max_entries of them. */
+uint32_t register_cache_export (dc1394camera_t * camera, uint64_t * offsets,
+        uint32_t * values, uint32_t max_entries);
+void register_cache_import (dc1394camera_t * camera, const uint64_t * offsets,
+        const uint32_t * values, uint32_t num_entries);
+
+/* On-disk descriptors of the cameras, in descriptor.c */
+dc1394error_t descriptor_cache_load (dc1394camera_t * camera,
+        const char * directory);
+void descriptor_cache_save (dc1394camera_t * camera);
+
+/* Used by capture.c when a receive thread owns the backend ring */
+int capture_thread_get_fileno (capture_thread_t * t);
+dc1394error_t capture_thread_dequeue (capture_thread_t * t,
+        dc1394capture_policy_t policy, dc1394video_frame_t ** frame);
+dc1394error_t capture_thread_enqueue (capture_thread_t * t,
+        dc1394video_frame_t * frame);
+
 #endif /* _DC1394_INTERNAL_H */
@@ -130,3 +130,31 @@ dc1394_iso_release_all (dc1394camera_t * camera)
 
     return DC1394_SUCCESS;
 }
+
+dc1394error_t
+iso_reallocate (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394error_t err;
+    int i, channel;
+
+    if (cpriv->allocated_channels && !d->iso_allocate_channel)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    for (i = 0; i < 64; i++) {
+        if (!(cpriv->allocated_channels & ((uint64_t)1 << i)))
+            continue;
+        err = d->iso_allocate_channel (cpriv->pcam, (uint64_t)1 << i, &channel);
+        if (err != DC1394_SUCCESS)
+            return DC1394_NO_ISO_CHANNEL;
+    }
+
+    if (cpriv->allocated_bandwidth) {
+        if (!d->iso_allocate_bandwidth)
+            return DC1394_FUNCTION_NOT_SUPPORTED;
+        err = d->iso_allocate_bandwidth (cpriv->pcam, cpriv->allocated_bandwidth);
+        if (err != DC1394_SUCCESS)
+            return DC1394_NO_BANDWIDTH;
+    }
+    return DC1394_SUCCESS;
+}
@@ -33,41 +33,72 @@
 #include <errno.h>
 #include <poll.h>
 #include <inttypes.h>
+#include <sys/time.h>
 
 #include "juju/juju.h"
 
 #define ptr_to_u64(p) ((__u64)(unsigned long)(p))
 #define u64_to_ptr(p) ((void *)(unsigned long)(p))
 
-static dc1394error_t
-init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto)
+/* Builds the packet descriptors of a frame, or returns NULL */
+static struct fw_cdev_iso_packet *
+frame_packets(const dc1394video_frame_t *proto, size_t *size)
 {
     int N = 8;        /* Number of iso packets per fw_cdev_iso_packet. */
-    struct juju_frame *f = craw->frames + index;
+    struct fw_cdev_iso_packet *packets;
     size_t total;
     int i, count;
 
-    memcpy (&f->frame, proto, sizeof f->frame);
-    f->frame.image = craw->buffer + index * proto->total_bytes;
-    f->frame.id = index;
     count = (proto->packets_per_frame + N - 1) / N;
-    f->size = count * sizeof *f->packets;
-    f->packets = malloc(f->size);
-    if (f->packets == NULL)
-        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    *size = count * sizeof *packets;
+    packets = malloc(*size);
+    if (packets == NULL)
+        return NULL;
 
-    memset(f->packets, 0, f->size);
+    memset(packets, 0, *size);
 
     total = proto->packets_per_frame;
     for (i = 0; i < count; i++) {
         if (total < N)
             N = total;
-        f->packets[i].control = FW_CDEV_ISO_HEADER_LENGTH(4 * N)
+        packets[i].control = FW_CDEV_ISO_HEADER_LENGTH(4 * N)
             | FW_CDEV_ISO_PAYLOAD_LENGTH(proto->packet_size * N);
         total -= N;
     }
-    f->packets[0].control |= FW_CDEV_ISO_SKIP;
-    f->packets[i - 1].control |= FW_CDEV_ISO_INTERRUPT;
+    packets[0].control |= FW_CDEV_ISO_SKIP;
+    packets[i - 1].control |= FW_CDEV_ISO_INTERRUPT;
+
+    return packets;
+}
+
+/* Gives a frame the metadata of a layout, keeping its own buffer, index
+   and timestamp */
+static void
+frame_set_layout(platform_camera_t *craw, int index,
+        const dc1394video_frame_t *proto)
+{
+    struct juju_frame *f = craw->frames + index;
+    uint64_t timestamp = f->frame.timestamp;
+
+    memcpy (&f->frame, proto, sizeof f->frame);
+    f->frame.image = craw->buffer + index * craw->frame_bytes;
+    f->frame.id = index;
+    f->frame.timestamp = timestamp;
+}
+
+static dc1394error_t
+init_frame(platform_camera_t *craw, int index, const dc1394video_frame_t *proto)
+{
+    struct juju_frame *f = craw->frames + index;
+
+    memcpy (&f->frame, proto, sizeof f->frame);
+    f->frame.image = craw->buffer + index * craw->frame_bytes;
+    f->frame.id = index;
+    f->held = 0;
+    f->stale = 0;
+    f->packets = frame_packets(proto, &f->size);
+    if (f->packets == NULL)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
 
     return DC1394_SUCCESS;
 }
@@ -80,6 +111,48 @@ release_frame(platform_camera_t *craw, int index)
     free(f->packets);
 }
 
+/* Releases the first count frames along with the ring */
+static void
+free_frames(platform_camera_t *craw, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        release_frame(craw, i);
+    free (craw->frames);
+    craw->frames = NULL;
+    free (craw->queue);
+    craw->queue = NULL;
+}
+
+/* Throws away the events of a stopped iso context */
+static void
+drain_iso_events (platform_camera_t *craw)
+{
+    struct pollfd fds;
+    struct {
+        struct fw_cdev_event_iso_interrupt i;
+        __u32 headers[256];
+    } iso;
+
+    fds.fd = craw->iso_fd;
+    fds.events = POLLIN;
+    while (poll(&fds, 1, 0) > 0)
+        if (read(craw->iso_fd, &iso, sizeof iso) < 0)
+            break;
+}
+
+/* Unmaps the DMA ring and closes the iso context along with it */
+void
+dc1394_juju_capture_release_buffers (platform_camera_t *craw)
+{
+    if (craw->frames)
+        free_frames(craw, craw->num_frames);
+    munmap(craw->buffer, craw->buffer_size);
+    close(craw->iso_fd);
+    craw->buffers_kept = 0;
+}
+
 dc1394error_t
 queue_frame (platform_camera_t *craw, int index)
 {
@@ -98,23 +171,90 @@ queue_frame (platform_camera_t *craw, int index)
         return DC1394_IOCTL_FAILURE;
     }
 
+    f->held = 0;
+    craw->queue[(craw->queue_first + craw->queued) % craw->num_frames] = index;
+    craw->queued++;
+
     return DC1394_SUCCESS;
 }
 
+/* Takes the oldest frame out of the kernel's queue */
+static int
+take_frame (platform_camera_t *craw)
+{
+    int index = craw->queue[craw->queue_first];
+
+    craw->queue_first = (craw->queue_first + 1) % craw->num_frames;
+    craw->queued--;
+    craw->ready_frames--;
+    return index;
+}
+
+static dc1394error_t
+start_iso_context (platform_camera_t *craw)
+{
+    struct fw_cdev_start_iso start_iso;
+
+    start_iso.cycle   = -1;
+    start_iso.tags = FW_CDEV_ISO_CONTEXT_MATCH_ALL_TAGS;
+    start_iso.sync = 1;
+    start_iso.handle = craw->iso_handle;
+    if (ioctl(craw->iso_fd, FW_CDEV_IOC_START_ISO, &start_iso) < 0) {
+        dc1394_log_error("error starting iso");
+        return DC1394_IOCTL_FAILURE;
+    }
+    return DC1394_SUCCESS;
+}
+
+/* The device is opened once more for its bus reset events, which the
+   descriptor of the transactions would otherwise take from the capture.
+   Without it the capture simply goes on without recovery. */
+static void
+open_reset_fd (platform_camera_t * craw)
+{
+    struct fw_cdev_get_info get_info;
+    struct fw_cdev_event_bus_reset reset;
+
+    craw->reset_generation = craw->generation;
+    craw->reset_node_id = craw->node_id;
+    craw->reset_fd = open (craw->filename, O_RDWR | O_NONBLOCK);
+    if (craw->reset_fd < 0) {
+        dc1394_log_warning ("could not watch %s for bus resets: %m",
+                craw->filename);
+        return;
+    }
+
+    memset (&get_info, 0, sizeof get_info);
+    get_info.version = FW_CDEV_VERSION;
+    get_info.bus_reset = ptr_to_u64 (&reset);
+    if (ioctl (craw->reset_fd, FW_CDEV_IOC_GET_INFO, &get_info) < 0) {
+        dc1394_log_warning ("could not watch %s for bus resets: %m",
+                craw->filename);
+        close (craw->reset_fd);
+        craw->reset_fd = -1;
+        return;
+    }
+    craw->reset_generation = reset.generation;
+    craw->reset_node_id = reset.node_id;
+}
+
 dc1394error_t
 dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         uint32_t flags)
 {
     struct fw_cdev_create_iso_context create;
-    struct fw_cdev_start_iso start_iso;
     dc1394error_t err;
     dc1394video_frame_t proto;
-    int i, j, retval;
+    struct juju_frame *f;
+    unsigned char *image;
+    unsigned int channel;
+    int i;
     dc1394camera_t * camera = craw->camera;
 
     if (flags & DC1394_CAPTURE_FLAGS_DEFAULT)
         flags = DC1394_CAPTURE_FLAGS_CHANNEL_ALLOC |
-            DC1394_CAPTURE_FLAGS_BANDWIDTH_ALLOC;
+            DC1394_CAPTURE_FLAGS_BANDWIDTH_ALLOC |
+            (flags & DC1394_CAPTURE_FLAGS_KEEP_BUFFERS);
 
     craw->flags = flags;
 
@@ -145,10 +285,47 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         return DC1394_FAILURE;
     }
 
-    if (dc1394_video_get_iso_channel (camera, &craw->iso_channel)
-            != DC1394_SUCCESS)
+    if (dc1394_video_get_iso_channel (camera, &channel) != DC1394_SUCCESS)
         return DC1394_FAILURE;
 
+    // buffers kept by the last capture_stop are reused if the context
+    // listens to the right channel and the new ring fits in the mapping
+    if (craw->buffers_kept && (channel != craw->iso_channel ||
+            proto.total_bytes * num_dma_buffers > craw->buffer_size))
+        dc1394_juju_capture_release_buffers (craw);
+    craw->iso_channel = channel;
+
+    if (craw->buffers_kept) {
+        drain_iso_events (craw);
+        craw->buffers_kept = 0;
+        i = 0;
+        if (num_dma_buffers == craw->num_frames &&
+                proto.total_bytes == craw->frame_bytes) {
+            // frames left stale by a change of layout may still have
+            // packets of another size
+            for (i = 0; i < num_dma_buffers; i++) {
+                f = craw->frames + i;
+                if (proto.packet_size != f->frame.packet_size ||
+                        proto.packets_per_frame != f->frame.packets_per_frame)
+                    break;
+            }
+        }
+        if (i == num_dma_buffers) {
+            // same layout: the packet descriptors are still valid
+            for (i = 0; i < num_dma_buffers; i++) {
+                f = craw->frames + i;
+                image = f->frame.image;
+                memcpy (&f->frame, &proto, sizeof f->frame);
+                f->frame.image = image;
+                f->frame.id = i;
+                f->stale = 0;
+            }
+            goto frames_ready;
+        }
+        free_frames(craw, craw->num_frames);
+        goto buffer_ready;
+    }
+
     craw->iso_fd = open(craw->filename, O_RDWR);
     if (craw->iso_fd < 0) {
         dc1394_log_error("error opening file: %s", strerror (errno));
@@ -167,9 +344,6 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
 
     craw->iso_handle = create.handle;
 
-    craw->num_frames = num_dma_buffers;
-    craw->current = -1;
-    craw->ready_frames = 0;
     craw->buffer_size = proto.total_bytes * num_dma_buffers;
     craw->buffer =
         mmap(NULL, craw->buffer_size, PROT_READ, MAP_SHARED, craw->iso_fd, 0);
@@ -177,10 +351,17 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     if (craw->buffer == MAP_FAILED)
         goto error_fd;
 
+buffer_ready:
+    craw->num_frames = num_dma_buffers;
+    craw->frame_bytes = proto.total_bytes;
+
     err = DC1394_MEMORY_ALLOCATION_FAILURE;
     craw->frames = malloc (num_dma_buffers * sizeof *craw->frames);
-    if (craw->frames == NULL)
+    craw->queue = malloc (num_dma_buffers * sizeof *craw->queue);
+    if (craw->frames == NULL || craw->queue == NULL) {
+        free_frames(craw, 0);
         goto error_mmap;
+    }
 
     for (i = 0; i < num_dma_buffers; i++) {
         err = init_frame(craw, i, &proto);
@@ -190,11 +371,17 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         }
     }
     if (err != DC1394_SUCCESS) {
-        for (j = 0; j < i; j++)
-            release_frame(craw, j);
+        free_frames(craw, i);
         goto error_mmap;
     }
 
+frames_ready:
+    craw->layout = proto;
+    craw->queue_first = 0;
+    craw->queued = 0;
+    craw->ready_frames = 0;
+    craw->held_frames = 0;
+
     for (i = 0; i < num_dma_buffers; i++) {
         err = queue_frame(craw, i);
         if (err != DC1394_SUCCESS) {
@@ -207,16 +394,9 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     // the camera struct:
     craw->capture_is_set = 1;
 
-    start_iso.cycle   = -1;
-    start_iso.tags = FW_CDEV_ISO_CONTEXT_MATCH_ALL_TAGS;
-    start_iso.sync = 1;
-    start_iso.handle = craw->iso_handle;
-    retval = ioctl(craw->iso_fd, FW_CDEV_IOC_START_ISO, &start_iso);
-    err = DC1394_IOCTL_FAILURE;
-    if (retval < 0) {
-        dc1394_log_error("error starting iso");
+    err = start_iso_context (craw);
+    if (err != DC1394_SUCCESS)
         goto error_frames;
-    }
 
     // if auto iso is requested, start ISO
     if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
@@ -225,11 +405,12 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         craw->iso_auto_started=1;
     }
 
+    open_reset_fd (craw);
+
     return DC1394_SUCCESS;
 
 error_frames:
-    for (i = 0; i < num_dma_buffers; i++)
-        release_frame(craw, i);
+    free_frames(craw, num_dma_buffers);
 error_mmap:
     munmap(craw->buffer, craw->buffer_size);
 error_fd:
@@ -251,10 +432,15 @@ dc1394_juju_capture_stop(platform_camera_t *craw)
     if (ioctl(craw->iso_fd, FW_CDEV_IOC_STOP_ISO, &stop) < 0)
         return DC1394_IOCTL_FAILURE;
 
-    munmap(craw->buffer, craw->buffer_size);
-    close(craw->iso_fd);
-    free (craw->frames);
-    craw->frames = NULL;
+    if (craw->reset_fd >= 0) {
+        close (craw->reset_fd);
+        craw->reset_fd = -1;
+    }
+
+    if (craw->flags & DC1394_CAPTURE_FLAGS_KEEP_BUFFERS)
+        craw->buffers_kept = 1;
+    else
+        dc1394_juju_capture_release_buffers (craw);
     craw->capture_is_set = 0;
 
     // stop ISO if it was started automatically
@@ -268,18 +454,69 @@ dc1394_juju_capture_stop(platform_camera_t *craw)
 }
 
 
-dc1394error_t
-dc1394_juju_capture_dequeue (platform_camera_t * craw,
-        dc1394capture_policy_t policy, dc1394video_frame_t **frame_return)
+/* The host time of a bus cycle a little in the past: the cycle timer is
+   read along with the system clock and the cycles elapsed since are taken
+   off. Completions older than the 8 seconds the cycle count spans would
+   come out late, but the iso context is long overrun by then. */
+static uint64_t
+cycle_to_host_time (platform_camera_t * craw, uint32_t cycle)
+{
+    struct fw_cdev_get_cycle_timer tm;
+    struct timeval now;
+    uint32_t current, elapsed;
+
+    if (ioctl (craw->iso_fd, FW_CDEV_IOC_GET_CYCLE_TIMER, &tm) < 0) {
+        gettimeofday (&now, NULL);
+        return (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+    }
+    current = ((tm.cycle_timer >> 25) & 7) * 8000 +
+        ((tm.cycle_timer >> 12) & 0x1fff);
+    cycle = ((cycle >> 13) & 7) * 8000 + (cycle & 0x1fff);
+    elapsed = (current + 64000 - cycle) % 64000;
+    return tm.local_time - (uint64_t) elapsed * 125;
+}
+
+/* Reads one event from the iso context. A frame is timestamped with the
+   cycle in which its last packet completed, so that frames which waited in
+   the kernel before being read keep the time they arrived at. */
+static dc1394error_t
+read_iso_event (platform_camera_t * craw)
 {
-    struct pollfd fds[1];
     struct juju_frame *f;
-    int err, timeout, len;
+    int len;
     struct {
         struct fw_cdev_event_iso_interrupt i;
         __u32 headers[256];
     } iso;
 
+    len = read (craw->iso_fd, &iso, sizeof iso);
+    if (len < 0) {
+        dc1394_log_error("failed to read a response: %m");
+        return DC1394_FAILURE;
+    }
+
+    if (iso.i.type == FW_CDEV_EVENT_ISO_INTERRUPT &&
+            craw->ready_frames < craw->queued) {
+        f = craw->frames + craw->queue[(craw->queue_first +
+                craw->ready_frames) % craw->num_frames];
+        f->frame.timestamp = cycle_to_host_time (craw, iso.i.cycle);
+        craw->ready_frames++;
+        // the kernel has no buffer left for the frames that follow
+        if (craw->ready_frames == craw->queued)
+            capture_stats_ring_overrun (craw->camera);
+    }
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_juju_capture_dequeue (platform_camera_t * craw,
+        dc1394capture_policy_t policy, dc1394video_frame_t **frame_return)
+{
+    struct pollfd fds[1];
+    struct juju_frame *f;
+    int err, timeout;
+
     if ( (policy<DC1394_CAPTURE_POLICY_MIN) || (policy>DC1394_CAPTURE_POLICY_MAX) )
         return DC1394_INVALID_CAPTURE_POLICY;
 
@@ -294,6 +531,7 @@ dc1394_juju_capture_dequeue (platform_camera_t * craw,
         timeout = 0;
         break;
     case DC1394_CAPTURE_POLICY_WAIT:
+    case DC1394_CAPTURE_POLICY_LATEST:
     default:
         timeout = -1;
         break;
@@ -308,22 +546,29 @@ dc1394_juju_capture_dequeue (platform_camera_t * craw,
             return DC1394_SUCCESS;
         }
 
-        len = read (craw->iso_fd, &iso, sizeof iso);
-        if (len < 0) {
-            dc1394_log_error("failed to read a response: %m");
+        if (read_iso_event (craw) != DC1394_SUCCESS)
             return DC1394_FAILURE;
+    }
+
+    if (policy == DC1394_CAPTURE_POLICY_LATEST) {
+        // collect the interrupts that are already pending without blocking,
+        // then give all stale frames back to the DMA engine right away
+        while (poll(fds, 1, 0) > 0) {
+            if (read_iso_event (craw) != DC1394_SUCCESS)
+                return DC1394_FAILURE;
         }
 
-        if (iso.i.type == FW_CDEV_EVENT_ISO_INTERRUPT)
-            craw->ready_frames++;
+        while (craw->ready_frames > 1) {
+            if (queue_frame (craw, take_frame (craw)) != DC1394_SUCCESS)
+                return DC1394_IOCTL_FAILURE;
+            capture_stats_frames_dropped (craw->camera, 1);
+        }
     }
 
-    craw->current = (craw->current + 1) % craw->num_frames;
-    f = craw->frames + craw->current;
-    craw->ready_frames--;
-
+    f = craw->frames + take_frame (craw);
+    f->held = 1;
     f->frame.frames_behind = craw->ready_frames;
-    f->frame.timestamp = 0;
+    craw->held_frames++;
 
     *frame_return = &f->frame;
 
@@ -335,14 +580,37 @@ dc1394_juju_capture_enqueue (platform_camera_t * craw,
         dc1394video_frame_t * frame)
 {
     dc1394camera_t * camera = craw->camera;
+    struct fw_cdev_iso_packet *packets;
+    struct juju_frame *f;
+    size_t size;
     int err;
 
     err = DC1394_INVALID_ARGUMENT_VALUE;
     if (frame->camera != camera)
         DC1394_ERR_RTN(err, "camera does not match frame's camera");
+    if (frame->id >= craw->num_frames || !craw->frames[frame->id].held)
+        DC1394_ERR_RTN(err, "frame is not held by the user");
+
+    // the layout changed while the user held the frame
+    f = craw->frames + frame->id;
+    if (f->stale) {
+        if (f->frame.packet_size != craw->layout.packet_size ||
+                f->frame.packets_per_frame != craw->layout.packets_per_frame) {
+            err = DC1394_MEMORY_ALLOCATION_FAILURE;
+            packets = frame_packets (&craw->layout, &size);
+            if (packets == NULL)
+                DC1394_ERR_RTN(err, "Could not lay the frame out again");
+            free (f->packets);
+            f->packets = packets;
+            f->size = size;
+        }
+        frame_set_layout (craw, frame->id, &craw->layout);
+        f->stale = 0;
+    }
 
     err = queue_frame (craw, frame->id);
     DC1394_ERR_RTN(err, "Failed to queue frame");
+    craw->held_frames--;
 
     return DC1394_SUCCESS;
 }
@@ -353,3 +621,173 @@ dc1394_juju_capture_get_fileno (platform_camera_t * craw)
     return craw->iso_fd;
 }
 
+int
+dc1394_juju_capture_get_reset_fileno (platform_camera_t * craw)
+{
+    return craw->reset_fd;
+}
+
+dc1394error_t
+dc1394_juju_capture_check_reset (platform_camera_t * craw,
+        uint32_t * generation)
+{
+    struct fw_cdev_event_bus_reset reset;
+
+    while (craw->reset_fd >= 0 &&
+           read (craw->reset_fd, &reset, sizeof reset) > 0) {
+        if (reset.type != FW_CDEV_EVENT_BUS_RESET)
+            continue;
+        craw->reset_node_id = reset.node_id;
+        __sync_synchronize ();
+        craw->reset_generation = reset.generation;
+    }
+    *generation = craw->reset_generation;
+    return DC1394_SUCCESS;
+}
+
+/* The descriptor of the transactions may not have read the reset yet */
+dc1394error_t
+dc1394_juju_capture_follow_reset (platform_camera_t * craw,
+        uint32_t generation)
+{
+    if (generation == craw->reset_generation) {
+        __sync_synchronize ();
+        craw->generation = generation;
+        craw->node_id = craw->reset_node_id;
+    }
+    return DC1394_SUCCESS;
+}
+
+
+/* Queues the given frames again, in order, and restarts the context */
+static dc1394error_t
+restart_iso_context (platform_camera_t * craw, const int * order, int count)
+{
+    dc1394error_t err;
+    int k;
+
+    craw->queue_first = 0;
+    craw->queued = 0;
+    craw->ready_frames = 0;
+    for (k = 0; k < count; k++) {
+        err = queue_frame (craw, order[k]);
+        if (err != DC1394_SUCCESS)
+            return err;
+    }
+    return start_iso_context (craw);
+}
+
+/* Swaps the packet descriptors of the queued frames with the spare ones
+   and gives them the metadata of a layout */
+static void
+swap_frame_packets (platform_camera_t * craw, const int * order,
+        struct fw_cdev_iso_packet ** packets, size_t * sizes, int count,
+        const dc1394video_frame_t * proto)
+{
+    struct fw_cdev_iso_packet *p;
+    struct juju_frame *f;
+    size_t size;
+    int k;
+
+    for (k = 0; k < count; k++) {
+        f = craw->frames + order[k];
+        p = f->packets;
+        size = f->size;
+        f->packets = packets[k];
+        f->size = sizes[k];
+        packets[k] = p;
+        sizes[k] = size;
+        frame_set_layout (craw, order[k], proto);
+    }
+}
+
+/* Lays the frames out again for a new region of interest without closing
+   the iso context or unmapping the buffers. If the packets of a frame are
+   unchanged only the metadata is updated. Otherwise the context is stopped,
+   completions of the old layout are dropped and the frames that were in the
+   kernel are queued again, in their order, with new packet descriptors.
+   If that fails the old layout is restored. Frames held by the user keep
+   their metadata and get the new layout when they are enqueued. */
+dc1394error_t
+dc1394_juju_capture_set_layout (platform_camera_t * craw,
+        const dc1394video_frame_t * proto)
+{
+    struct fw_cdev_stop_iso stop;
+    struct fw_cdev_iso_packet **packets;
+    size_t *sizes;
+    int *order;
+    int i, k, count;
+    dc1394error_t err;
+
+    if (craw->capture_is_set == 0)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    if (proto->total_bytes > craw->frame_bytes) {
+        dc1394_log_error("frames of %"PRIu64" bytes do not fit in the "
+                "%zu byte capture buffers", proto->total_bytes,
+                craw->frame_bytes);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    if (proto->packet_size == craw->layout.packet_size &&
+            proto->packets_per_frame == craw->layout.packets_per_frame) {
+        for (i = 0; i < craw->num_frames; i++) {
+            if (craw->frames[i].held)
+                craw->frames[i].stale = 1;
+            else
+                frame_set_layout (craw, i, proto);
+        }
+        craw->layout = *proto;
+        return DC1394_SUCCESS;
+    }
+
+    // everything that can fail is allocated before the context is touched
+    count = craw->queued;
+    order = malloc (craw->num_frames * sizeof *order);
+    sizes = malloc (craw->num_frames * sizeof *sizes);
+    packets = calloc (craw->num_frames, sizeof *packets);
+    err = DC1394_MEMORY_ALLOCATION_FAILURE;
+    if (order == NULL || sizes == NULL || packets == NULL)
+        goto out;
+    for (k = 0; k < count; k++) {
+        order[k] = craw->queue[(craw->queue_first + k) % craw->num_frames];
+        packets[k] = frame_packets (proto, sizes + k);
+        if (packets[k] == NULL)
+            goto out;
+    }
+
+    err = DC1394_IOCTL_FAILURE;
+    stop.handle = craw->iso_handle;
+    if (ioctl(craw->iso_fd, FW_CDEV_IOC_STOP_ISO, &stop) < 0)
+        goto out;
+    drain_iso_events (craw);
+
+    swap_frame_packets (craw, order, packets, sizes, count, proto);
+    err = restart_iso_context (craw, order, count);
+    if (err != DC1394_SUCCESS) {
+        dc1394_log_error("Could not lay the frames out again, restoring "
+                "the previous layout");
+        ioctl(craw->iso_fd, FW_CDEV_IOC_STOP_ISO, &stop);
+        drain_iso_events (craw);
+        swap_frame_packets (craw, order, packets, sizes, count,
+                &craw->layout);
+        if (restart_iso_context (craw, order, count) != DC1394_SUCCESS)
+            dc1394_log_error("Could not restart the capture, it must be "
+                    "stopped");
+        goto out;
+    }
+
+    for (i = 0; i < craw->num_frames; i++)
+        if (craw->frames[i].held)
+            craw->frames[i].stale = 1;
+    craw->layout = *proto;
+
+out:
+    if (packets)
+        for (k = 0; k < count; k++)
+            free (packets[k]);
+    free (packets);
+    free (sizes);
+    free (order);
+    return err;
+}
@@ -28,6 +28,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/inotify.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
 
@@ -66,6 +67,8 @@ dc1394_juju_new (void)
     }
 
     platform_t * p = calloc (1, sizeof (platform_t));
+    if (p)
+        p->inotify_fd = -1;
     return p;
 }
 static void
@@ -74,11 +77,97 @@ dc1394_juju_free (platform_t * p)
     free (p);
 }
 
+/* Device files are created and removed by the kernel as nodes come and go;
+   udev then sets their permissions, which is when they can be opened */
+static int
+dc1394_juju_monitor_start (platform_t * p)
+{
+    p->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (p->inotify_fd < 0) {
+        dc1394_log_warning ("Juju: inotify_init1: %m");
+        return -1;
+    }
+    if (inotify_add_watch (p->inotify_fd, "/dev",
+                IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+        dc1394_log_warning ("Juju: Failed to watch /dev: %m");
+        close (p->inotify_fd);
+        p->inotify_fd = -1;
+    }
+    return p->inotify_fd;
+}
+
+static void
+dc1394_juju_monitor_stop (platform_t * p)
+{
+    if (p->inotify_fd >= 0)
+        close (p->inotify_fd);
+    p->inotify_fd = -1;
+}
+
+static int
+dc1394_juju_monitor_changed (platform_t * p)
+{
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    const struct inotify_event * ev;
+    int changed = 0;
+    ssize_t len;
+    char * ptr;
+
+    while ((len = read (p->inotify_fd, buf, sizeof (buf))) > 0) {
+        for (ptr = buf; ptr < buf + len;
+             ptr += sizeof (struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *) ptr;
+            if (ev->len && strncmp (ev->name, "fw", 2) == 0) {
+                dc1394_log_debug ("Juju: /dev/%s changed", ev->name);
+                changed = 1;
+            }
+        }
+    }
+    return changed;
+}
+
 struct _platform_device_t {
     uint32_t config_rom[256];
     char filename[32];
 };
 
+/* Opens one device and reads its config ROM. Each device is read from a
+   thread of its own, since a node that is slow to answer its ROM delays
+   GET_INFO on its device file. */
+static void
+read_device (void * arg, int i)
+{
+    platform_device_t ** devices = arg;
+    platform_device_t * device = devices[i];
+    struct fw_cdev_get_info get_info;
+    struct fw_cdev_event_bus_reset reset;
+    int fd;
+
+    devices[i] = NULL;
+    fd = open(device->filename, O_RDWR);
+    if (fd < 0) {
+        dc1394_log_debug("Juju: Failed to open %s: %s", device->filename,
+                strerror (errno));
+        free (device);
+        return;
+    }
+    dc1394_log_debug("Juju: Opened %s successfully", device->filename);
+
+    get_info.version = FW_CDEV_VERSION;
+    get_info.rom = ptr_to_u64(&device->config_rom);
+    get_info.rom_length = 1024;
+    get_info.bus_reset = ptr_to_u64(&reset);
+    if (ioctl(fd, FW_CDEV_IOC_GET_INFO, &get_info) < 0) {
+        dc1394_log_error("GET_CONFIG_ROM failed for %s: %m",
+                device->filename);
+        free (device);
+        close(fd);
+        return;
+    }
+    close (fd);
+    devices[i] = device;
+}
+
 static platform_device_list_t *
 dc1394_juju_get_device_list (platform_t * p)
 {
@@ -86,6 +175,7 @@ dc1394_juju_get_device_list (platform_t * p)
     struct dirent * de;
     platform_device_list_t * list;
     uint32_t allocated_size = 64;
+    int num_devices = 0, i;
 
     list = calloc (1, sizeof (platform_device_list_t));
     if (!list)
@@ -105,47 +195,19 @@ dc1394_juju_get_device_list (platform_t * p)
     }
 
     while ((de = readdir(dir))) {
-        char filename[32];
-        int fd;
         platform_device_t * device;
-        struct fw_cdev_get_info get_info;
-        struct fw_cdev_event_bus_reset reset;
 
         if (strncmp(de->d_name, "fw", 2) != 0)
             continue;
 
-        snprintf(filename, sizeof filename, "/dev/%s", de->d_name);
-        fd = open(filename, O_RDWR);
-        if (fd < 0) {
-            dc1394_log_debug("Juju: Failed to open %s: %s", filename,
-                    strerror (errno));
-            continue;
-        }
-        dc1394_log_debug("Juju: Opened %s successfully", filename);
-
         device = malloc (sizeof (platform_device_t));
-        if (!device) {
-            close (fd);
-            continue;
-        }
-
-        get_info.version = FW_CDEV_VERSION;
-        get_info.rom = ptr_to_u64(&device->config_rom);
-        get_info.rom_length = 1024;
-        get_info.bus_reset = ptr_to_u64(&reset);
-        if (ioctl(fd, FW_CDEV_IOC_GET_INFO, &get_info) < 0) {
-            dc1394_log_error("GET_CONFIG_ROM failed for %s: %m",filename);
-            free (device);
-            close(fd);
+        if (!device)
             continue;
-        }
-        close (fd);
+        snprintf(device->filename, sizeof device->filename, "/dev/%s",
+                de->d_name);
+        list->devices[num_devices++] = device;
 
-        strcpy (device->filename, filename);
-        list->devices[list->num_devices] = device;
-        list->num_devices++;
-
-        if (list->num_devices >= allocated_size) {
+        if (num_devices >= allocated_size) {
             allocated_size += 64;
             list->devices = realloc (list->devices, allocated_size * sizeof (platform_device_t *));
             if (!list->devices)
@@ -154,6 +216,14 @@ dc1394_juju_get_device_list (platform_t * p)
     }
     closedir(dir);
 
+    run_parallel (num_devices, ENUMERATION_MAX_THREADS, read_device,
+            list->devices);
+
+    /* Keep the devices that answered, in the order of the directory */
+    for (i = 0; i < num_devices; i++)
+        if (list->devices[i])
+            list->devices[list->num_devices++] = list->devices[i];
+
     return list;
 }
 
@@ -206,12 +276,17 @@ dc1394_juju_camera_new (platform_t * p, platform_device_t * device, uint32_t uni
     camera->fd = fd;
     camera->generation = reset.generation;
     camera->node_id = reset.node_id;
+    camera->reset_fd = -1;
     strcpy (camera->filename, device->filename);
     return camera;
 }
 
 static void dc1394_juju_camera_free (platform_camera_t * cam)
 {
+    if (cam->buffers_kept)
+        dc1394_juju_capture_release_buffers (cam);
+    if (cam->reset_fd >= 0)
+        close (cam->reset_fd);
     close (cam->fd);
     free (cam);
 }
@@ -255,6 +330,10 @@ _juju_await_response (platform_camera_t * cam, uint32_t * out, int num_quads)
         break;
 
     case FW_CDEV_EVENT_RESPONSE:
+        // a late response of the asynchronous path is not ours
+        if (u.response.r.closure != 0)
+            break;
+        cam->last_rcode = u.response.r.rcode;
         if (u.response.r.rcode == RCODE_CONFLICT_ERROR)
             return -RCODE_CONFLICT_ERROR; // retry
         if (u.response.r.rcode == RCODE_BUSY)
@@ -288,6 +367,9 @@ do_transaction(platform_camera_t * cam, int tcode, uint64_t offset, const uint32
     request.length = num_quads * 4;
     request.tcode = tcode;
     request.generation = cam->generation;
+    request.closure = 0;
+    cam->last_rcode = 0;
+    cam->last_retries = 0;
 
     while (retry > 0) {
         int retval;
@@ -308,6 +390,7 @@ do_transaction(platform_camera_t * cam, int tcode, uint64_t offset, const uint32
                 -retval, tcode, offset);
         usleep (500);
         retry--;
+        cam->last_retries++;
     }
 
     dc1394_log_error("Max retries for tcode 0x%x, offset %"PRIx64,
@@ -342,6 +425,115 @@ dc1394_juju_camera_write (platform_camera_t * cam, uint64_t offset, const uint32
     return do_transaction(cam, tcode, offset, quads, NULL, num_quads);
 }
 
+/*
+  The asynchronous path: requests are sent with the transaction as closure
+  and any number of them may be in flight on the device file. Responses come
+  back in completion order and are matched through the closure.
+*/
+static dc1394error_t
+dc1394_juju_transaction_submit (platform_camera_t * cam,
+        platform_transaction_t * t)
+{
+    struct fw_cdev_send_request request;
+    uint32_t in_buffer[t->write ? t->num_quads : 0];
+    int i;
+
+    if (t->num_quads > JUJU_MAX_TRANSACTION_QUADS)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    for (i = 0; t->write && i < t->num_quads; i++)
+        in_buffer[i] = htonl (t->quads[i]);
+
+    memset (&request, 0, sizeof request);
+    if (t->write)
+        request.tcode = t->num_quads > 1 ?
+            TCODE_WRITE_BLOCK_REQUEST : TCODE_WRITE_QUADLET_REQUEST;
+    else
+        request.tcode = t->num_quads > 1 ?
+            TCODE_READ_BLOCK_REQUEST : TCODE_READ_QUADLET_REQUEST;
+    request.length = t->num_quads * 4;
+    request.offset = CONFIG_ROM_BASE + t->offset;
+    request.closure = ptr_to_u64 (t);
+    request.data = ptr_to_u64 (in_buffer);
+    request.generation = cam->generation;
+
+    if (ioctl (cam->fd, FW_CDEV_IOC_SEND_REQUEST, &request) < 0) {
+        dc1394_log_error("failed to send request: %m");
+        return DC1394_FAILURE;
+    }
+    return DC1394_SUCCESS;
+}
+
+static int
+dc1394_juju_transaction_get_fileno (platform_camera_t * cam)
+{
+    return cam->fd;
+}
+
+static dc1394error_t
+dc1394_juju_transaction_complete (platform_camera_t * cam,
+        platform_transaction_t ** done)
+{
+    union {
+        struct {
+            struct fw_cdev_event_response r;
+            __u32 buffer[JUJU_MAX_TRANSACTION_QUADS];
+        } response;
+        struct fw_cdev_event_bus_reset reset;
+    } u;
+    platform_transaction_t * t;
+    int i;
+
+    *done = NULL;
+    if (read (cam->fd, &u, sizeof u) < 0) {
+        dc1394_log_error("failed to read response for %s: %m",cam->filename);
+        return DC1394_FAILURE;
+    }
+
+    switch (u.reset.type) {
+    case FW_CDEV_EVENT_BUS_RESET:
+        cam->generation = u.reset.generation;
+        cam->node_id = u.reset.node_id;
+        return DC1394_SUCCESS;
+
+    case FW_CDEV_EVENT_RESPONSE:
+        t = u64_to_ptr (u.response.r.closure);
+        t->retry = 0;
+        t->rcode = u.response.r.rcode;
+        switch (u.response.r.rcode) {
+        case RCODE_COMPLETE:
+            for (i = 0; !t->write && i < u.response.r.length/4 &&
+                    i < t->num_quads; i++)
+                t->quads[i] = ntohl (u.response.r.data[i]);
+            t->result = DC1394_SUCCESS;
+            break;
+        case RCODE_CONFLICT_ERROR:
+        case RCODE_BUSY:
+        case RCODE_GENERATION:
+            // sent again by the caller, with the new generation if any
+            t->retry = 1;
+            break;
+        default:
+            dc1394_log_debug ("Juju: response error, rcode 0x%x",
+                    u.response.r.rcode);
+            t->result = DC1394_FAILURE;
+            break;
+        }
+        *done = t;
+        return DC1394_SUCCESS;
+    }
+
+    return DC1394_SUCCESS;
+}
+
+static void
+dc1394_juju_transaction_get_status (platform_camera_t * cam, uint32_t * rcode,
+        uint32_t * retries)
+{
+    *rcode = cam->last_rcode;
+    *retries = cam->last_retries;
+}
+
 static dc1394error_t
 dc1394_juju_reset_bus (platform_camera_t * cam)
 {
@@ -354,6 +546,20 @@ dc1394_juju_reset_bus (platform_camera_t * cam)
         return DC1394_FAILURE;
 }
 
+static dc1394error_t
+dc1394_juju_read_cycle_timer (platform_camera_t * cam,
+        uint32_t * cycle_timer, uint64_t * local_time)
+{
+    struct fw_cdev_get_cycle_timer tm;
+
+    if (ioctl(cam->fd, FW_CDEV_IOC_GET_CYCLE_TIMER, &tm) < 0)
+        return DC1394_IOCTL_FAILURE;
+
+    *cycle_timer = tm.cycle_timer;
+    *local_time = tm.local_time;
+    return DC1394_SUCCESS;
+}
+
 static dc1394error_t
 dc1394_juju_camera_get_node(platform_camera_t *cam, uint32_t *node,
         uint32_t * generation)
@@ -373,6 +579,9 @@ juju_dispatch = {
     .get_device_list = dc1394_juju_get_device_list,
     .free_device_list = dc1394_juju_free_device_list,
     .device_get_config_rom = dc1394_juju_device_get_config_rom,
+    .monitor_start = dc1394_juju_monitor_start,
+    .monitor_stop = dc1394_juju_monitor_stop,
+    .monitor_changed = dc1394_juju_monitor_changed,
 
     .camera_new = dc1394_juju_camera_new,
     .camera_free = dc1394_juju_camera_free,
@@ -380,8 +589,13 @@ juju_dispatch = {
 
     .camera_read = dc1394_juju_camera_read,
     .camera_write = dc1394_juju_camera_write,
+    .transaction_submit = dc1394_juju_transaction_submit,
+    .transaction_get_fileno = dc1394_juju_transaction_get_fileno,
+    .transaction_complete = dc1394_juju_transaction_complete,
+    .transaction_get_status = dc1394_juju_transaction_get_status,
 
     .reset_bus = dc1394_juju_reset_bus,
+    .read_cycle_timer = dc1394_juju_read_cycle_timer,
     .camera_print_info = dc1394_juju_camera_print_info,
     .camera_get_node = dc1394_juju_camera_get_node,
 
@@ -390,6 +604,10 @@ juju_dispatch = {
     .capture_dequeue = dc1394_juju_capture_dequeue,
     .capture_enqueue = dc1394_juju_capture_enqueue,
     .capture_get_fileno = dc1394_juju_capture_get_fileno,
+    .capture_set_layout = dc1394_juju_capture_set_layout,
+    .capture_get_reset_fileno = dc1394_juju_capture_get_reset_fileno,
+    .capture_check_reset = dc1394_juju_capture_check_reset,
+    .capture_follow_reset = dc1394_juju_capture_follow_reset,
 };
 
 void
@@ -30,8 +30,11 @@
 #include "register.h"
 #include "offsets.h"
 
+/* Largest asynchronous payload, that of S400 */
+#define JUJU_MAX_TRANSACTION_QUADS  512
+
 struct _platform_t {
-    int dummy;
+    int inotify_fd;             /* watches /dev for hotplug, or -1 */
 };
 
 struct _platform_camera_t {
@@ -39,6 +42,8 @@ struct _platform_camera_t {
     char filename[32];
     int generation;
     uint32_t node_id;
+    uint32_t last_rcode;
+    uint32_t last_retries;
 
     dc1394camera_t * camera;
 
@@ -47,14 +52,23 @@ struct _platform_camera_t {
     struct juju_frame        * frames;
     unsigned char        * buffer;
     size_t buffer_size;
+    size_t frame_bytes;
     uint32_t flags;
     unsigned int num_frames;
-    int current;
+    int * queue;                /* the frames in the kernel, oldest first */
+    int queue_first;
+    int queued;
     int ready_frames;
+    int held_frames;
+    dc1394video_frame_t layout; /* of the frames given to the kernel */
 
     unsigned int iso_channel;
     int capture_is_set;
+    int buffers_kept;
     int iso_auto_started;
+    int reset_fd;               /* bus reset events while capturing, or -1 */
+    uint32_t reset_generation;  /* the last one seen on reset_fd */
+    uint32_t reset_node_id;
 };
 
 
@@ -62,6 +76,8 @@ struct juju_frame {
     dc1394video_frame_t                 frame;
     size_t                         size;
     struct fw_cdev_iso_packet        *packets;
+    int held;                   /* dequeued and not given back yet */
+    int stale;                  /* takes craw->layout when enqueued */
 };
 
 dc1394error_t
@@ -74,6 +90,9 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
 dc1394error_t
 dc1394_juju_capture_stop(platform_camera_t *craw);
 
+void
+dc1394_juju_capture_release_buffers (platform_camera_t *craw);
+
 dc1394error_t
 dc1394_juju_capture_dequeue (platform_camera_t * craw,
         dc1394capture_policy_t policy, dc1394video_frame_t **frame_return);
@@ -85,4 +104,19 @@ dc1394_juju_capture_enqueue (platform_camera_t * craw,
 int
 dc1394_juju_capture_get_fileno (platform_camera_t * craw);
 
+dc1394error_t
+dc1394_juju_capture_set_layout (platform_camera_t * craw,
+        const dc1394video_frame_t * proto);
+
+int
+dc1394_juju_capture_get_reset_fileno (platform_camera_t * craw);
+
+dc1394error_t
+dc1394_juju_capture_check_reset (platform_camera_t * craw,
+        uint32_t * generation);
+
+dc1394error_t
+dc1394_juju_capture_follow_reset (platform_camera_t * craw,
+        uint32_t generation);
+
 #endif
@@ -35,6 +35,9 @@
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <arpa/inet.h>
 #if HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
@@ -133,6 +136,8 @@ capture_linux_setup(platform_camera_t * craw, uint32_t num_dma_buffers)
     craw->capture.dma_frame_size= vmmap.buf_size;
     craw->capture.num_dma_buffers= vmmap.nb_buffers;
     craw->capture.dma_last_buffer= -1;
+    craw->capture.dma_frames_held = 0;
+    craw->capture.dma_overrun = 0;
     vwait.channel= craw->iso_channel;
 
     /* QUEUE the buffers */
@@ -270,6 +275,14 @@ dc1394_linux_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     if (err != DC1394_SUCCESS)
         goto fail;
 
+    // a handle of its own sees the bus resets without taking the responses
+    // of the register transactions
+    craw->capture.handle = raw1394_new_handle_on_port (craw->port);
+    if (craw->capture.handle)
+        raw1394_update_generation (craw->capture.handle, craw->generation);
+    else
+        dc1394_log_warning ("Could not watch the bus for resets");
+
     // if auto iso is requested, start ISO
     if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
         err=dc1394_video_set_transmission(camera, DC1394_ON);
@@ -361,7 +374,10 @@ dc1394_linux_capture_stop(platform_camera_t *craw)
         }
 
         // free the additional capture handle
-        raw1394_destroy_handle(craw->capture.handle);
+        if (craw->capture.handle) {
+            raw1394_destroy_handle(craw->capture.handle);
+            craw->capture.handle = NULL;
+        }
     }
     else {
         return DC1394_CAPTURE_IS_NOT_SET;
@@ -420,7 +436,39 @@ dc1394_linux_capture_dequeue (platform_camera_t * craw,
         }
     }
 
+    // every buffer filled or held leaves the DMA engine nowhere to write
+    if (!capture->dma_overrun && capture->dma_frames_held + vwait.buffer + 1 >=
+            capture->num_dma_buffers) {
+        capture_stats_ring_overrun (craw->camera);
+        capture->dma_overrun = 1;
+    }
+
+    // LATEST policy: vwait.buffer tells how many newer buffers are already
+    // filled. Take each of them and give the older one back to the DMA engine.
+    while ((policy == DC1394_CAPTURE_POLICY_LATEST) && (vwait.buffer > 0)) {
+        struct video1394_wait vnext;
+
+        memset(&vnext, 0, sizeof(vnext));
+        vnext.channel = craw->iso_channel;
+        vnext.buffer = (cb + 1) % capture->num_dma_buffers;
+        if (ioctl(capture->dma_fd, VIDEO1394_IOC_LISTEN_POLL_BUFFER, &vnext) != 0)
+            break;
+
+        vwait.buffer = cb;
+        if (ioctl(capture->dma_fd, VIDEO1394_IOC_LISTEN_QUEUE_BUFFER, &vwait) < 0) {
+            capture->dma_last_buffer = (cb + 1) % capture->num_dma_buffers;
+            dc1394_log_error("VIDEO1394_IOC_LISTEN_QUEUE_BUFFER ioctl failed!");
+            return DC1394_IOCTL_FAILURE;
+        }
+        capture_stats_frames_dropped (craw->camera, 1);
+
+        cb = (cb + 1) % capture->num_dma_buffers;
+        frame_tmp = capture->frames + cb;
+        vwait = vnext;
+    }
+
     capture->dma_last_buffer = cb;
+    capture->dma_frames_held++;
 
     frame_tmp->frames_behind = vwait.buffer;
     frame_tmp->timestamp = (uint64_t) vwait.filltime.tv_sec * 1000000 + vwait.filltime.tv_usec;
@@ -451,6 +499,8 @@ dc1394_linux_capture_enqueue (platform_camera_t * craw,
         dc1394_log_error("VIDEO1394_IOC_LISTEN_QUEUE_BUFFER ioctl failed!");
         return DC1394_IOCTL_FAILURE;
     }
+    craw->capture.dma_frames_held--;
+    craw->capture.dma_overrun = 0;
 
     return DC1394_SUCCESS;
 }
@@ -461,3 +511,69 @@ dc1394_linux_capture_get_fileno (platform_camera_t * craw)
     return craw->capture.dma_fd;
 }
 
+
+int
+dc1394_linux_capture_get_reset_fileno (platform_camera_t * craw)
+{
+    if (!craw->capture.handle)
+        return -1;
+    return raw1394_get_fd (craw->capture.handle);
+}
+
+/* Nodes are numbered again on a reset, so the camera is looked up by its
+   GUID among the nodes of its port */
+static void
+find_node (platform_camera_t * craw)
+{
+    quadlet_t guid[2];
+    uint64_t value;
+    int node, num_nodes;
+
+    num_nodes = raw1394_get_nodecount (craw->handle);
+    for (node = -1; node < num_nodes; node++) {
+        int n = node < 0 ? craw->node : node;
+        if (raw1394_read (craw->handle, 0xffc0 | n,
+                    CONFIG_ROM_BASE + 0x40C, 8, guid) < 0)
+            continue;
+        value = ((uint64_t) ntohl (guid[0]) << 32) | ntohl (guid[1]);
+        if (value == craw->camera->guid) {
+            craw->node = n;
+            return;
+        }
+    }
+    dc1394_log_warning ("Camera 0x%"PRIx64" not found after a bus reset",
+            craw->camera->guid);
+}
+
+dc1394error_t
+dc1394_linux_capture_check_reset (platform_camera_t * craw,
+        uint32_t * generation)
+{
+    struct pollfd fds;
+
+    if (!craw->capture.handle) {
+        *generation = craw->generation;
+        return DC1394_SUCCESS;
+    }
+    // the default handler of the bus reset events updates the generation
+    // of the handle, which only the receive side uses
+    fds.fd = raw1394_get_fd (craw->capture.handle);
+    fds.events = POLLIN;
+    while (poll (&fds, 1, 0) > 0)
+        if (raw1394_loop_iterate (craw->capture.handle) < 0)
+            break;
+    *generation = raw1394_get_generation (craw->capture.handle);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_linux_capture_follow_reset (platform_camera_t * craw,
+        uint32_t generation)
+{
+    if (generation == craw->generation)
+        return DC1394_SUCCESS;
+    craw->generation = generation;
+    raw1394_update_generation (craw->handle, generation);
+    find_node (craw);
+    return DC1394_SUCCESS;
+}
@@ -100,13 +100,52 @@ read_retry (struct raw1394_handle * handle, nodeid_t node, nodeaddr_t addr,
     return -1;
 }
 
+/* Reads the config ROM of one node, on a handle of its own so that the nodes
+   of all ports are read at the same time */
+static void
+read_device (void * arg, int i)
+{
+    platform_device_t ** devices = arg;
+    platform_device_t * device = devices[i];
+    raw1394handle_t handle;
+    uint32_t quad;
+    int k;
+
+    devices[i] = NULL;
+    handle = raw1394_new_handle_on_port (device->port);
+    if (!handle)
+        goto fail;
+
+    if (read_retry (handle, 0xFFC0 | device->node, CONFIG_ROM_BASE + 0x400,
+                4, &quad) < 0)
+        goto fail;
+
+    device->config_rom[0] = ntohl (quad);
+    device->generation = raw1394_get_generation (handle);
+    for (k = 1; k < 256; k++) {
+        if (read_retry (handle, 0xFFC0 | device->node,
+                    CONFIG_ROM_BASE + 0x400 + 4*k, 4, &quad) < 0)
+            break;
+        device->config_rom[k] = ntohl (quad);
+    }
+    device->num_quads = k;
+    raw1394_destroy_handle (handle);
+    devices[i] = device;
+    return;
+
+ fail:
+    if (handle)
+        raw1394_destroy_handle (handle);
+    free (device);
+}
+
 static platform_device_list_t *
 dc1394_linux_get_device_list (platform_t * p)
 {
     platform_device_list_t * list;
     uint32_t allocated_size = 64;
     raw1394handle_t handle;
-    int num_ports, i;
+    int num_ports, num_devices = 0, i;
 
     handle = raw1394_new_handle ();
     if (!handle)
@@ -135,42 +174,35 @@ dc1394_linux_get_device_list (platform_t * p)
         num_nodes = raw1394_get_nodecount (handle);
         dc1394_log_debug ("linux: Port %d opened with %d node(s)",
                 i, num_nodes);
+        raw1394_destroy_handle (handle);
+
         for (j = 0; j < num_nodes; j++) {
             platform_device_t * device;
-            uint32_t quad;
-            int k;
-
-            if (read_retry (handle, 0xFFC0 | j, CONFIG_ROM_BASE + 0x400, 4, &quad) < 0)
-                continue;
 
             device = malloc (sizeof (platform_device_t));
             if (!device)
                 continue;
-
-            device->config_rom[0] = ntohl (quad);
             device->port = i;
             device->node = j;
-            device->generation = raw1394_get_generation (handle);
-            for (k = 1; k < 256; k++) {
-                if (read_retry (handle, 0xFFC0 | j, CONFIG_ROM_BASE + 0x400 + 4*k, 4, &quad) < 0)
-                    break;
-                device->config_rom[k] = ntohl (quad);
-            }
-            device->num_quads = k;
-
-            list->devices[list->num_devices] = device;
-            list->num_devices++;
+            list->devices[num_devices++] = device;
 
-            if (list->num_devices >= allocated_size) {
+            if (num_devices >= allocated_size) {
                 allocated_size += 64;
                 list->devices = realloc (list->devices, allocated_size * sizeof (platform_device_t *));
                 if (!list->devices)
                     return NULL;
             }
         }
-        raw1394_destroy_handle (handle);
     }
 
+    run_parallel (num_devices, ENUMERATION_MAX_THREADS, read_device,
+            list->devices);
+
+    /* Keep the nodes that answered, in the order of the ports and nodes */
+    for (i = 0; i < num_devices; i++)
+        if (list->devices[i])
+            list->devices[list->num_devices++] = list->devices[i];
+
     return list;
 }
 
@@ -479,6 +511,9 @@ linux_dispatch = {
     .capture_dequeue = dc1394_linux_capture_dequeue,
     .capture_enqueue = dc1394_linux_capture_enqueue,
     .capture_get_fileno = dc1394_linux_capture_get_fileno,
+    .capture_get_reset_fileno = dc1394_linux_capture_get_reset_fileno,
+    .capture_check_reset = dc1394_linux_capture_check_reset,
+    .capture_follow_reset = dc1394_linux_capture_follow_reset,
 
     .iso_set_persist = dc1394_linux_iso_set_persist,
     .iso_allocate_channel = dc1394_linux_iso_allocate_channel,
@@ -45,6 +45,8 @@ typedef struct __dc1394_capture
     unsigned int             dma_frame_size;
     unsigned int             num_dma_buffers;
     unsigned int             dma_last_buffer;
+    unsigned int             dma_frames_held;   /* dequeued, not given back */
+    int                      dma_overrun;       /* counted, until an enqueue */
     int                      dma_fd;
     raw1394handle_t          handle;
     uint32_t                 flags;
@@ -90,4 +92,15 @@ dc1394_linux_capture_enqueue (platform_camera_t * craw,
 int
 dc1394_linux_capture_get_fileno (platform_camera_t * craw);
 
+int
+dc1394_linux_capture_get_reset_fileno (platform_camera_t * craw);
+
+dc1394error_t
+dc1394_linux_capture_check_reset (platform_camera_t * craw,
+        uint32_t * generation);
+
+dc1394error_t
+dc1394_linux_capture_follow_reset (platform_camera_t * craw,
+        uint32_t generation);
+
 #endif
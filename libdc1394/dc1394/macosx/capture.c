@@ -638,6 +638,23 @@ dc1394_macosx_capture_dequeue (platform_camera_t * craw,
         return DC1394_FAILURE;
     }
     capture->frames_ready--;
+
+    /* LATEST policy: give the stale buffers back and move on to the newest
+     * filled one. */
+    while (policy == DC1394_CAPTURE_POLICY_LATEST && capture->frames_ready > 0) {
+        capture->frames_ready--;
+        MPExitCriticalRegion (capture->mutex);
+
+        read (capture->notify_pipe[0], &ch, 1);
+        capture->last_dequeued = next;
+        dc1394_macosx_capture_enqueue (craw, frame_tmp);
+        capture_stats_frames_dropped (craw->camera, 1);
+
+        next = NEXT_BUFFER (capture, next);
+        buffer = capture->buffers + next;
+        frame_tmp = capture->frames + next;
+        MPEnterCriticalRegion (capture->mutex, kDurationForever);
+    }
     frame_tmp->frames_behind = capture->frames_ready;
     MPExitCriticalRegion (capture->mutex);
 
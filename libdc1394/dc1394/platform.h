@@ -36,6 +36,36 @@ typedef struct _platform_device_list_t {
     int num_devices;
 } platform_device_list_t;
 
+/* A register transaction of the asynchronous path. The platform sets result
+   when it completes, or retry if the node was busy and it must be sent again,
+   and rcode to the IEEE 1394 response code if it knows it. */
+typedef struct _platform_transaction_t {
+    int write;
+    uint64_t offset;
+    uint32_t * quads;
+    uint32_t num_quads;
+    dc1394error_t result;
+    int retry;
+    uint32_t rcode;
+} platform_transaction_t;
+
+/* Hotplug, for the platforms that can notice devices coming and going:
+   monitor_start() returns a descriptor that is readable when they may have,
+   or -1. monitor_changed() consumes what made it readable and returns
+   whether the device list has to be read again. It is called from another
+   thread than the rest of the platform, but never at the same time as
+   monitor_start() or monitor_stop().
+
+   Bus resets during capture: capture_get_reset_fileno() returns a descriptor
+   that is readable after a reset of the bus of the camera, or -1, and
+   capture_check_reset() consumes the notifications without blocking and
+   returns the generation of the last reset seen. Neither sends anything nor
+   changes what the register access uses, so they may be called from the
+   receive thread. capture_follow_reset() then makes the register access
+   follow the bus to that generation, from the thread of the application.
+
+   capture_set_transfers() is for the platforms that receive a frame in
+   several transfers; it is only called while capture is not set up. */
 typedef struct _platform_dispatch_t {
     platform_t * (*platform_new)(void);
     void (*platform_free)(platform_t *);
@@ -44,6 +74,10 @@ typedef struct _platform_dispatch_t {
     void (*free_device_list)(platform_device_list_t *);
     int (*device_get_config_rom)(platform_device_t *, uint32_t *, int *);
 
+    int (*monitor_start)(platform_t *);
+    void (*monitor_stop)(platform_t *);
+    int (*monitor_changed)(platform_t *);
+
     platform_camera_t * (*camera_new)(platform_t *, platform_device_t *,
             uint32_t);
     void (*camera_free)(platform_camera_t *);
@@ -54,6 +88,14 @@ typedef struct _platform_dispatch_t {
     dc1394error_t (*camera_write)(platform_camera_t *, uint64_t,
             const uint32_t *, int);
 
+    dc1394error_t (*transaction_submit)(platform_camera_t *,
+            platform_transaction_t *);
+    int (*transaction_get_fileno)(platform_camera_t *);
+    dc1394error_t (*transaction_complete)(platform_camera_t *,
+            platform_transaction_t **);
+    void (*transaction_get_status)(platform_camera_t *, uint32_t *,
+            uint32_t *);
+
     dc1394error_t (*reset_bus)(platform_camera_t *);
     dc1394error_t (*read_cycle_timer)(platform_camera_t *, uint32_t *,
             uint64_t *);
@@ -74,6 +116,12 @@ typedef struct _platform_dispatch_t {
     int (*capture_get_fileno)(platform_camera_t *);
     dc1394bool_t (*capture_is_frame_corrupt)(platform_camera_t *,
             dc1394video_frame_t *);
+    dc1394error_t (*capture_set_layout)(platform_camera_t *,
+            const dc1394video_frame_t *);
+    int (*capture_get_reset_fileno)(platform_camera_t *);
+    dc1394error_t (*capture_check_reset)(platform_camera_t *, uint32_t *);
+    dc1394error_t (*capture_follow_reset)(platform_camera_t *, uint32_t);
+    dc1394error_t (*capture_set_transfers)(platform_camera_t *, uint32_t);
 
     dc1394error_t (*iso_set_persist)(platform_camera_t *);
     dc1394error_t (*iso_allocate_channel)(platform_camera_t *, uint64_t,
@@ -0,0 +1,462 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Asynchronous recording of captured frames to disk
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* for O_DIRECT */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "control.h"
+#include "capture.h"
+#include "recorder.h"
+#include "internal.h"
+#include "log.h"
+
+#define BLOCK_ROUND(x) \
+    (((x) + DC1394_RECORDER_BLOCK_SIZE - 1) & ~(uint64_t)(DC1394_RECORDER_BLOCK_SIZE - 1))
+
+typedef struct _record_entry_t {
+    struct _record_entry_t   * next;
+    dc1394video_frame_t      * frame;     /* capture buffer, NULL once spilled */
+    dc1394video_frame_t        meta;
+    unsigned char            * data;
+    uint64_t                   size;      /* bytes of data to write */
+    uint64_t                   spilled;   /* size of the spill copy, if any */
+} record_entry_t;
+
+struct __dc1394recorder_t {
+    dc1394camera_t           * camera;
+    int                        fd;
+    int                        direct;
+
+    pthread_t                  thread;
+    pthread_mutex_t            mutex;
+    pthread_cond_t             cond;
+    int                        stop;
+    int                        error;
+
+    record_entry_t           * queue_head;   /* waiting to be written */
+    record_entry_t           * queue_tail;
+    record_entry_t           * done;         /* written, buffer not yet given back */
+    uint32_t                   max_frames;
+    uint32_t                   frames_held;
+    uint64_t                   spill_bytes;
+    uint64_t                   spill_used;
+
+    unsigned char            * bounce;       /* for buffers unfit for direct I/O */
+    uint64_t                   bounce_size;
+    unsigned char            * block;        /* one block for the headers */
+
+    uint64_t                   offset;       /* where the next frame goes */
+    uint64_t                 * index;
+    uint64_t                   num_frames;
+    uint64_t                   index_size;
+
+    uint64_t                   start_time;
+    dc1394recorder_stats_t     stats;
+};
+
+static uint64_t
+get_time (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Some file systems accept O_DIRECT at open time and only refuse it with
+   EINVAL when written to; the file is then written through the cache. */
+static int
+write_all (dc1394recorder_t * r, const unsigned char * data, uint64_t size)
+{
+    while (size > 0) {
+        ssize_t n = write (r->fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+#ifdef O_DIRECT
+            if (errno == EINVAL && r->direct) {
+                int flags = fcntl (r->fd, F_GETFL);
+                if (flags >= 0 &&
+                    fcntl (r->fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+                    dc1394_log_debug ("recorder: direct I/O refused, "
+                            "writing through the cache");
+                    r->direct = 0;
+                    continue;
+                }
+            }
+#endif
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int
+write_frame_header (dc1394recorder_t * r, const dc1394video_frame_t * f)
+{
+    stream_frame_header_t * h = (stream_frame_header_t *) r->block;
+
+    memset (r->block, 0, DC1394_RECORDER_BLOCK_SIZE);
+    stream_header_from_frame (h, f);
+    return write_all (r, r->block, DC1394_RECORDER_BLOCK_SIZE);
+}
+
+static int
+write_payload (dc1394recorder_t * r, record_entry_t * e)
+{
+    uint64_t padded = BLOCK_ROUND (e->size);
+
+    // capture buffers are usually page aligned and can be written in place
+    if (((uintptr_t) e->data % DC1394_RECORDER_BLOCK_SIZE) == 0 &&
+        e->size == padded)
+        return write_all (r, e->data, padded);
+
+    if (padded > r->bounce_size) {
+        free (r->bounce);
+        r->bounce = NULL;
+        r->bounce_size = 0;
+        if (posix_memalign ((void **) &r->bounce, DC1394_RECORDER_BLOCK_SIZE,
+                            padded) != 0) {
+            r->bounce = NULL;
+            return -1;
+        }
+        r->bounce_size = padded;
+    }
+    memcpy (r->bounce, e->data, e->size);
+    memset (r->bounce + e->size, 0, padded - e->size);
+    return write_all (r, r->bounce, padded);
+}
+
+/* Called from the writer thread only, without the lock */
+static int
+write_entry (dc1394recorder_t * r, record_entry_t * e)
+{
+    if (r->num_frames == r->index_size) {
+        uint64_t size = r->index_size ? 2 * r->index_size : 1024;
+        uint64_t * index = realloc (r->index, size * sizeof (uint64_t));
+        if (!index)
+            return -1;
+        r->index = index;
+        r->index_size = size;
+    }
+
+    if (write_frame_header (r, &e->meta) < 0 || write_payload (r, e) < 0)
+        return -1;
+
+    r->index[r->num_frames++] = r->offset;
+    r->offset += DC1394_RECORDER_BLOCK_SIZE + BLOCK_ROUND (e->size);
+    return 0;
+}
+
+/* Writes the trailing index and its footer */
+static int
+write_index (dc1394recorder_t * r)
+{
+    stream_index_footer_t * footer = (stream_index_footer_t *) r->block;
+    record_entry_t e;
+
+    memset (&e, 0, sizeof (e));
+    e.data = (unsigned char *) r->index;
+    e.size = r->num_frames * sizeof (uint64_t);
+    if (e.size > 0 && write_payload (r, &e) < 0)
+        return -1;
+
+    memset (r->block, 0, DC1394_RECORDER_BLOCK_SIZE);
+    memcpy (footer->magic, STREAM_INDEX_MAGIC, sizeof (footer->magic));
+    footer->num_frames = r->num_frames;
+    footer->index_offset = r->offset;
+    return write_all (r, r->block, DC1394_RECORDER_BLOCK_SIZE);
+}
+
+static void *
+writer_thread (void * arg)
+{
+    dc1394recorder_t * r = arg;
+    record_entry_t * e;
+    int ret;
+
+    pthread_mutex_lock (&r->mutex);
+    while (1) {
+        while (!r->queue_head && !r->stop)
+            pthread_cond_wait (&r->cond, &r->mutex);
+        if (!r->queue_head)
+            break;
+
+        e = r->queue_head;
+        r->queue_head = e->next;
+        if (!r->queue_head)
+            r->queue_tail = NULL;
+        pthread_mutex_unlock (&r->mutex);
+
+        ret = r->error ? -1 : write_entry (r, e);
+
+        pthread_mutex_lock (&r->mutex);
+        if (ret < 0) {
+            if (!r->error)
+                dc1394_log_error ("recorder: write failed: %m");
+            r->error = 1;
+        }
+        else {
+            r->stats.frames_written++;
+            r->stats.bytes_written += BLOCK_ROUND (e->size);
+        }
+        if (e->frame) {
+            e->next = r->done;
+            r->done = e;
+        }
+        else {
+            r->spill_used -= e->spilled;
+            free (e->data);
+            free (e);
+        }
+        pthread_cond_broadcast (&r->cond);
+    }
+    pthread_mutex_unlock (&r->mutex);
+
+    return NULL;
+}
+
+/* Gives the written buffers back to the capture ring. Called with the
+   lock held, from the thread that owns the capture. */
+static void
+release_written (dc1394recorder_t * r)
+{
+    record_entry_t * e;
+
+    while ((e = r->done) != NULL) {
+        r->done = e->next;
+        dc1394_capture_enqueue (r->camera, e->frame);
+        r->frames_held--;
+        free (e);
+    }
+}
+
+dc1394recorder_t *
+dc1394_recorder_new (dc1394camera_t * camera, const char * filename,
+                     uint32_t max_frames, uint64_t spill_bytes)
+{
+    dc1394recorder_t * r;
+
+    if (!camera || !filename || max_frames == 0)
+        return NULL;
+    // a frame must always be left for the camera to write to
+    if (max_frames >= DC1394_CAMERA_PRIV (camera)->capture_num_buffers) {
+        dc1394_log_error ("recorder: %u held frames need more than the %u "
+                "capture buffers", max_frames,
+                DC1394_CAMERA_PRIV (camera)->capture_num_buffers);
+        return NULL;
+    }
+
+    r = calloc (1, sizeof (dc1394recorder_t));
+    if (!r)
+        return NULL;
+
+    r->camera = camera;
+    r->max_frames = max_frames;
+    r->spill_bytes = spill_bytes;
+
+#ifdef O_DIRECT
+    r->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (r->fd >= 0)
+        r->direct = 1;
+    else
+#endif
+    r->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (r->fd < 0) {
+        dc1394_log_error ("recorder: could not open %s: %m", filename);
+        free (r);
+        return NULL;
+    }
+    if (!r->direct)
+        dc1394_log_debug ("recorder: direct I/O not available for %s", filename);
+
+    if (posix_memalign ((void **) &r->block, DC1394_RECORDER_BLOCK_SIZE,
+                        DC1394_RECORDER_BLOCK_SIZE) != 0) {
+        close (r->fd);
+        free (r);
+        return NULL;
+    }
+    stream_file_header_t * header = (stream_file_header_t *) r->block;
+    memset (r->block, 0, DC1394_RECORDER_BLOCK_SIZE);
+    memcpy (header->magic, STREAM_FILE_MAGIC, sizeof (header->magic));
+    header->version = STREAM_VERSION;
+    header->block_size = DC1394_RECORDER_BLOCK_SIZE;
+    if (write_all (r, r->block, DC1394_RECORDER_BLOCK_SIZE) < 0) {
+        dc1394_log_error ("recorder: could not write to %s: %m", filename);
+        close (r->fd);
+        free (r->block);
+        free (r);
+        return NULL;
+    }
+    r->offset = DC1394_RECORDER_BLOCK_SIZE;
+
+    pthread_mutex_init (&r->mutex, NULL);
+    pthread_cond_init (&r->cond, NULL);
+    r->start_time = get_time ();
+
+    if (pthread_create (&r->thread, NULL, writer_thread, r) != 0) {
+        dc1394_log_error ("recorder: could not create the writer thread");
+        pthread_cond_destroy (&r->cond);
+        pthread_mutex_destroy (&r->mutex);
+        close (r->fd);
+        free (r->block);
+        free (r);
+        return NULL;
+    }
+
+    return r;
+}
+
+dc1394error_t
+dc1394_recorder_free (dc1394recorder_t * r)
+{
+    dc1394error_t err = DC1394_SUCCESS;
+
+    if (!r)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&r->mutex);
+    r->stop = 1;
+    pthread_cond_broadcast (&r->cond);
+    pthread_mutex_unlock (&r->mutex);
+    pthread_join (r->thread, NULL);
+
+    release_written (r);
+    if (!r->error && write_index (r) < 0) {
+        dc1394_log_error ("recorder: could not write the index: %m");
+        r->error = 1;
+    }
+    if (r->error)
+        err = DC1394_FAILURE;
+    if (close (r->fd) < 0)
+        err = DC1394_FAILURE;
+
+    pthread_cond_destroy (&r->cond);
+    pthread_mutex_destroy (&r->mutex);
+    free (r->bounce);
+    free (r->block);
+    free (r->index);
+    free (r);
+    return err;
+}
+
+dc1394error_t
+dc1394_recorder_write (dc1394recorder_t * r, dc1394video_frame_t * frame)
+{
+    record_entry_t * e;
+    uint64_t padded;
+    int waited = 0, spilled;
+
+    if (!r || !frame)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    e = calloc (1, sizeof (record_entry_t));
+    if (!e) {
+        dc1394_capture_enqueue (r->camera, frame);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    e->frame = frame;
+    e->meta = *frame;
+    e->data = frame->image;
+    e->size = frame->total_bytes;
+    padded = BLOCK_ROUND (e->size);
+
+    pthread_mutex_lock (&r->mutex);
+    while (1) {
+        release_written (r);
+        if (r->error)
+            break;
+        if (r->frames_held < r->max_frames) {
+            r->frames_held++;
+            break;
+        }
+        if (r->spill_used + padded <= r->spill_bytes) {
+            unsigned char * copy;
+            if (posix_memalign ((void **) &copy, DC1394_RECORDER_BLOCK_SIZE,
+                                padded) == 0) {
+                memcpy (copy, frame->image, e->size);
+                memset (copy + e->size, 0, padded - e->size);
+                e->data = copy;
+                e->size = padded;
+                e->spilled = padded;
+                e->frame = NULL;
+                r->spill_used += padded;
+                r->stats.frames_spilled++;
+                break;
+            }
+        }
+        if (!waited) {
+            r->stats.backpressure_events++;
+            waited = 1;
+        }
+        pthread_cond_wait (&r->cond, &r->mutex);
+    }
+
+    if (r->error) {
+        pthread_mutex_unlock (&r->mutex);
+        dc1394_capture_enqueue (r->camera, frame);
+        free (e);
+        return DC1394_FAILURE;
+    }
+
+    spilled = (e->frame == NULL);
+    if (r->queue_tail)
+        r->queue_tail->next = e;
+    else
+        r->queue_head = e;
+    r->queue_tail = e;
+    pthread_cond_broadcast (&r->cond);
+    pthread_mutex_unlock (&r->mutex);
+
+    // a spilled frame doesn't need its capture buffer any more
+    if (spilled)
+        dc1394_capture_enqueue (r->camera, frame);
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_recorder_get_stats (dc1394recorder_t * r, dc1394recorder_stats_t * stats)
+{
+    if (!r || !stats)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&r->mutex);
+    memcpy (stats, &r->stats, sizeof (dc1394recorder_stats_t));
+    pthread_mutex_unlock (&r->mutex);
+
+    stats->elapsed_time = get_time () - r->start_time;
+    stats->throughput = 0;
+    if (stats->elapsed_time > 0)
+        stats->throughput = (double) stats->bytes_written / stats->elapsed_time;
+
+    return DC1394_SUCCESS;
+}
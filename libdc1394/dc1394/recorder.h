@@ -0,0 +1,94 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Asynchronous recording of captured frames to disk
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_RECORDER_H__
+#define __DC1394_RECORDER_H__
+
+/*! \file dc1394/recorder.h
+    \brief Functions to stream captured frames to disk from a writer thread
+
+    Frames handed to the recorder are written straight from the capture
+    buffers with direct I/O where the system supports it, and given back to
+    the capture ring once written. The file is a stream that can be read
+    back with the functions of dc1394/stream.h: each frame is stored as a
+    block of metadata followed by its block-aligned payload, and a frame
+    index is appended when the recorder is freed.
+*/
+
+#include <dc1394/log.h>
+
+/**
+ * Alignment of the frames in the recorded file
+ */
+#define DC1394_RECORDER_BLOCK_SIZE     4096
+
+/**
+ * A recorder writing the frames of one camera to a file
+ */
+typedef struct __dc1394recorder_t dc1394recorder_t;
+
+/**
+ * Recorder counters. A back-pressure event is counted each time dc1394_recorder_write() had to wait for the
+ * disk because both the frame queue and the spill buffer were full.
+ */
+typedef struct
+{
+    uint64_t                 frames_written;
+    uint64_t                 bytes_written;
+    uint64_t                 frames_spilled;       /* frames copied to RAM to release their capture buffer early */
+    uint64_t                 backpressure_events;
+    uint64_t                 elapsed_time;         /* microseconds since the recorder was created */
+    double                   throughput;           /* sustained rate in MB/s over elapsed_time */
+} dc1394recorder_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates a recorder for a camera whose capture is set up. At most max_frames capture buffers are held by
+ * the recorder at any time; this must be less than the number of DMA buffers, or NULL is returned. When
+ * that many are queued, further frames are copied to a RAM spill buffer of at most spill_bytes bytes.
+ */
+dc1394recorder_t * dc1394_recorder_new (dc1394camera_t * camera, const char * filename,
+        uint32_t max_frames, uint64_t spill_bytes);
+
+/**
+ * Waits for all queued frames to be written, gives their buffers back and frees the recorder.
+ */
+dc1394error_t dc1394_recorder_free (dc1394recorder_t * recorder);
+
+/**
+ * Queues a dequeued frame for writing. The recorder takes the frame over: it must not be enqueued by the
+ * user. Buffers whose frames have been written are given back to the capture ring from this call, so it must
+ * be called from the thread that dequeues the frames.
+ */
+dc1394error_t dc1394_recorder_write (dc1394recorder_t * recorder, dc1394video_frame_t * frame);
+
+/**
+ * Gets the counters of the recorder.
+ */
+dc1394error_t dc1394_recorder_get_stats (dc1394recorder_t * recorder, dc1394recorder_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,7 +20,16 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* for ppoll on Linux */
+#endif
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
 #include "control.h"
 #include "internal.h"
 #include "offsets.h"
@@ -60,30 +69,1113 @@
     }
 
 
+/*
+  Transaction tracing. Once started, every register transaction that goes
+  to the bus is logged in a ring and accounted in the statistics of its
+  address. Both are written without locks so that tracing can stay on: a
+  slot of the ring is claimed with an atomic increment and published with a
+  sequence number that readers check, and the statistics of an address live
+  in a fixed table whose slots are claimed by compare and swap.
+*/
+#define REGISTER_TRACE_DEFAULT_ENTRIES   1024
+#define REGISTER_TRACE_MAX_ENTRIES       (1 << 20)
+#define REGISTER_TRACE_SLOTS             256
+
+typedef struct {
+    uint64_t seq;                 /* index + 1 once written, 0 while being written */
+    dc1394register_trace_t entry;
+} register_trace_slot_t;
+
+typedef struct {
+    uint64_t key;                 /* offset + 1, 0 if unused */
+    uint64_t count;
+    uint64_t errors;
+    uint64_t retries;
+    uint64_t total_latency;
+    uint64_t max_latency;
+    uint64_t bins[DC1394_REGISTER_TRACE_BINS];
+} register_trace_stats_t;
+
+struct _register_trace_t {
+    uint32_t mask;
+    uint64_t head;
+    uint64_t dropped;             /* transactions of addresses beyond the table */
+    register_trace_slot_t * ring;
+    register_trace_stats_t stats[REGISTER_TRACE_SLOTS];
+};
+
+static uint64_t
+register_time (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Start time of a transaction, 0 if tracing is off */
+static inline uint64_t
+register_trace_begin (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+
+    if (!__atomic_load_n (&cp->register_trace_on, __ATOMIC_RELAXED))
+        return 0;
+    return register_time ();
+}
+
+static register_trace_stats_t *
+register_trace_find (register_trace_t * tr, uint64_t offset)
+{
+    uint64_t key = offset + 1;
+    uint32_t i = (uint32_t) (offset >> 2) & (REGISTER_TRACE_SLOTS - 1);
+    uint32_t n;
+
+    for (n = 0; n < REGISTER_TRACE_SLOTS; n++) {
+        register_trace_stats_t * st = &tr->stats[i];
+        uint64_t k = __atomic_load_n (&st->key, __ATOMIC_ACQUIRE);
+        if (k == key)
+            return st;
+        if (k == 0) {
+            uint64_t expected = 0;
+            if (__atomic_compare_exchange_n (&st->key, &expected, key, 0,
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+                expected == key)
+                return st;
+        }
+        i = (i + 1) & (REGISTER_TRACE_SLOTS - 1);
+    }
+    return NULL;
+}
+
+static void
+register_trace_end (dc1394camera_t * camera, uint64_t start, uint64_t offset,
+        uint32_t num_regs, int write, dc1394error_t result, uint32_t rcode,
+        uint32_t retries)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    register_trace_t * tr = cp->register_trace;
+    register_trace_slot_t * slot;
+    register_trace_stats_t * st;
+    uint64_t index, latency, max;
+    uint32_t bin;
+
+    if (!start || !tr)
+        return;
+    latency = register_time () - start;
+
+    index = __atomic_fetch_add (&tr->head, 1, __ATOMIC_RELAXED);
+    slot = &tr->ring[index & tr->mask];
+    __atomic_store_n (&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    slot->entry.timestamp = start;
+    slot->entry.offset = offset;
+    slot->entry.num_regs = num_regs;
+    slot->entry.write = write ? DC1394_TRUE : DC1394_FALSE;
+    slot->entry.rcode = rcode;
+    slot->entry.retries = retries;
+    slot->entry.latency = latency > UINT32_MAX ? UINT32_MAX : latency;
+    slot->entry.result = result;
+    __atomic_store_n (&slot->seq, index + 1, __ATOMIC_RELEASE);
+
+    st = register_trace_find (tr, offset);
+    if (!st) {
+        __atomic_fetch_add (&tr->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    for (bin = 0; bin < DC1394_REGISTER_TRACE_BINS - 1 && (latency >> (bin + 1)); bin++)
+        ;
+    __atomic_fetch_add (&st->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&st->retries, retries, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&st->total_latency, latency, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&st->bins[bin], 1, __ATOMIC_RELAXED);
+    if (result != DC1394_SUCCESS)
+        __atomic_fetch_add (&st->errors, 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n (&st->max_latency, __ATOMIC_RELAXED);
+    while (latency > max &&
+           !__atomic_compare_exchange_n (&st->max_latency, &max, latency, 1,
+               __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* The synchronous bus accesses, traced */
+static dc1394error_t
+register_bus_read (dc1394camera_t * camera, uint64_t offset,
+        uint32_t * value, uint32_t num_regs)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cp->platform->dispatch;
+    uint64_t start = register_trace_begin (camera);
+    uint32_t rcode = 0, retries = 0;
+    dc1394error_t err;
+
+    err = d->camera_read (cp->pcam, offset, value, num_regs);
+    if (start) {
+        if (d->transaction_get_status)
+            d->transaction_get_status (cp->pcam, &rcode, &retries);
+        register_trace_end (camera, start, offset, num_regs, 0, err, rcode,
+                retries);
+    }
+    return err;
+}
+
+static dc1394error_t
+register_bus_write (dc1394camera_t * camera, uint64_t offset,
+        const uint32_t * value, uint32_t num_regs)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cp->platform->dispatch;
+    uint64_t start = register_trace_begin (camera);
+    uint32_t rcode = 0, retries = 0;
+    dc1394error_t err;
+
+    err = d->camera_write (cp->pcam, offset, value, num_regs);
+    if (start) {
+        if (d->transaction_get_status)
+            d->transaction_get_status (cp->pcam, &rcode, &retries);
+        register_trace_end (camera, start, offset, num_regs, 1, err, rcode,
+                retries);
+    }
+    return err;
+}
+
+void
+register_trace_free (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+
+    if (!cp->register_trace)
+        return;
+    free (cp->register_trace->ring);
+    free (cp->register_trace);
+    cp->register_trace = NULL;
+}
+
 dc1394error_t
-dc1394_get_registers (dc1394camera_t *camera, uint64_t offset,
-                      uint32_t *value, uint32_t num_regs)
+dc1394_register_trace_start (dc1394camera_t * camera, uint32_t num_entries)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    register_trace_t * tr;
+    uint32_t size = 1;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+    if (num_entries == 0)
+        num_entries = REGISTER_TRACE_DEFAULT_ENTRIES;
+    if (num_entries > REGISTER_TRACE_MAX_ENTRIES)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    while (size < num_entries)
+        size <<= 1;
+
+    // a previous trace is cleared, and kept allocated if it is large enough
+    __atomic_store_n (&cp->register_trace_on, 0, __ATOMIC_RELAXED);
+    tr = cp->register_trace;
+    if (tr && tr->mask + 1 >= size) {
+        memset (tr->ring, 0, (tr->mask + 1) * sizeof (register_trace_slot_t));
+        memset (tr->stats, 0, sizeof (tr->stats));
+        tr->head = 0;
+        tr->dropped = 0;
+    }
+    else {
+        register_trace_free (camera);
+        tr = calloc (1, sizeof (register_trace_t));
+        if (!tr)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        tr->ring = calloc (size, sizeof (register_trace_slot_t));
+        if (!tr->ring) {
+            free (tr);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+        tr->mask = size - 1;
+        cp->register_trace = tr;
+    }
+    __atomic_store_n (&cp->register_trace_on, 1, __ATOMIC_RELEASE);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_register_trace_stop (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+    __atomic_store_n (&cp->register_trace_on, 0, __ATOMIC_RELEASE);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_register_trace_get (dc1394camera_t * camera,
+        dc1394register_trace_t * entries, uint32_t * num_entries)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    register_trace_t * tr;
+    uint64_t head, first, i;
+    uint32_t n = 0;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+    if (entries == NULL || num_entries == NULL)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    tr = cp->register_trace;
+    if (!tr) {
+        *num_entries = 0;
+        return DC1394_SUCCESS;
+    }
+
+    head = __atomic_load_n (&tr->head, __ATOMIC_ACQUIRE);
+    first = head > *num_entries ? head - *num_entries : 0;
+    if (head - first > tr->mask + 1)
+        first = head - (tr->mask + 1);
+    for (i = first; i < head; i++) {
+        register_trace_slot_t * slot = &tr->ring[i & tr->mask];
+        uint64_t seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq != i + 1)
+            continue;   // being written, or already overwritten
+        entries[n] = slot->entry;
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&slot->seq, __ATOMIC_RELAXED) == seq)
+            n++;
+    }
+    *num_entries = n;
+    return DC1394_SUCCESS;
+}
+
+static int
+register_trace_compare (const void * a, const void * b)
+{
+    const register_trace_stats_t * sa = a, * sb = b;
+
+    if (sa->total_latency != sb->total_latency)
+        return sa->total_latency < sb->total_latency ? 1 : -1;
+    return 0;
+}
+
+dc1394error_t
+dc1394_register_trace_dump (dc1394camera_t * camera, FILE * fd)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    register_trace_stats_t * stats;
+    uint64_t count = 0, retries = 0, errors = 0, total = 0;
+    int i, j, n = 0;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+    if (!cp->register_trace)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+
+    stats = malloc (sizeof (cp->register_trace->stats));
+    if (!stats)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    for (i = 0; i < REGISTER_TRACE_SLOTS; i++) {
+        register_trace_stats_t * st = &cp->register_trace->stats[i];
+        if (!__atomic_load_n (&st->key, __ATOMIC_ACQUIRE) ||
+            !__atomic_load_n (&st->count, __ATOMIC_RELAXED))
+            continue;
+        stats[n] = *st;
+        count += stats[n].count;
+        retries += stats[n].retries;
+        errors += stats[n].errors;
+        total += stats[n].total_latency;
+        n++;
+    }
+    qsort (stats, n, sizeof (register_trace_stats_t), register_trace_compare);
+
+    fprintf(fd,"------ Register transactions ------\n");
+    fprintf(fd,"Transactions                      :     %"PRIu64"\n", count);
+    fprintf(fd,"Retries                           :     %"PRIu64"\n", retries);
+    fprintf(fd,"Errors                            :     %"PRIu64"\n", errors);
+    fprintf(fd,"Total latency                     :     %"PRIu64" us\n", total);
+    if (cp->register_trace->dropped)
+        fprintf(fd,"Not accounted by address          :     %"PRIu64"\n",
+                cp->register_trace->dropped);
+    fprintf(fd,"Offset (from command base)     Count  Retries  Errors  Mean us   Max us"
+            "  Latency histogram, log2 us bins\n");
+    for (i = 0; i < n; i++) {
+        uint64_t offset = stats[i].key - 1;
+        if (offset >= camera->command_registers_base &&
+            offset - camera->command_registers_base < 0x1000)
+            fprintf(fd,"0x%012"PRIx64" (+0x%03"PRIx64") ", offset,
+                    offset - camera->command_registers_base);
+        else
+            fprintf(fd,"0x%012"PRIx64"          ", offset);
+        fprintf(fd,"%7"PRIu64"  %7"PRIu64"  %6"PRIu64"  %7"PRIu64"  %7"PRIu64" ",
+                stats[i].count, stats[i].retries, stats[i].errors,
+                stats[i].total_latency / stats[i].count, stats[i].max_latency);
+        for (j = 0; j < DC1394_REGISTER_TRACE_BINS; j++)
+            fprintf(fd," %"PRIu64, stats[i].bins[j]);
+        fprintf(fd,"\n");
+    }
+    free (stats);
+    return DC1394_SUCCESS;
+}
+
+/*
+  The register shadow. Reads of the registers that do not change while a
+  camera is open are served from memory, and so are the format, mode, rate
+  and ISO registers that only change when they are written. Entries are kept
+  in a small open addressing table indexed by the register address.
+
+  REGISTER_CONSTANT entries (video mode and feature presence, CSR offsets)
+  live until the camera is reset or the bus generation changes.
+  REGISTER_DEPENDENT entries (feature boundaries and Format7 inquiries) may
+  follow the video mode on some cameras and are also dropped whenever the
+  mode, the trigger or the frame rate is written.
+  REGISTER_SHADOW entries are updated by the writes themselves.
+*/
+#define REGISTER_CACHE_SIZE   512
+
+enum {
+    REGISTER_UNCACHED = 0,
+    REGISTER_CONSTANT,
+    REGISTER_DEPENDENT,
+    REGISTER_SHADOW
+};
+
+typedef struct {
+    uint64_t offset;
+    uint32_t value;
+    uint32_t kind;
+} register_cache_entry_t;
+
+struct _register_cache_t {
+    pthread_mutex_t mutex;
+    uint32_t generation;
+    uint32_t num_entries;
+    register_cache_entry_t entries[REGISTER_CACHE_SIZE];
+};
+
+static int
+register_cache_kind (dc1394camera_t * camera, uint64_t offset)
+{
+    uint64_t base = camera->command_registers_base;
+    int i;
+
+    if (base && offset >= base && offset - base < REG_CAMERA_FEATURE_HI_BASE) {
+        offset -= base;
+        if ((offset >= REG_CAMERA_V_FORMAT_INQ &&
+             offset < REG_CAMERA_V_CSR_INQ_BASE + 0x20U) ||
+            (offset >= REG_CAMERA_BASIC_FUNC_INQ &&
+             offset <= REG_CAMERA_OPT_FUNC_INQ) ||
+            (offset >= REG_CAMERA_ADV_FEATURE_INQ &&
+             offset <= REG_CAMERA_STROBE_CONTROL_CSR_INQ) ||
+            offset >= REG_CAMERA_FEATURE_ABS_HI_BASE)
+            return REGISTER_CONSTANT;
+        if (offset >= REG_CAMERA_FEATURE_HI_BASE_INQ &&
+            offset < REG_CAMERA_FRAME_RATE)
+            return REGISTER_DEPENDENT;
+        if (offset >= REG_CAMERA_FRAME_RATE && offset <= REG_CAMERA_ISO_DATA)
+            return REGISTER_SHADOW;
+        return REGISTER_UNCACHED;
+    }
+
+    for (i = 0; i < DC1394_VIDEO_MODE_FORMAT7_NUM; i++) {
+        uint64_t csr = camera->format7_csr[i];
+        if (!csr || offset < csr ||
+            offset - csr > REG_CAMERA_FORMAT7_VALUE_SETTING)
+            continue;
+        switch (offset - csr) {
+        case REG_CAMERA_FORMAT7_MAX_IMAGE_SIZE_INQ:
+        case REG_CAMERA_FORMAT7_UNIT_SIZE_INQ:
+        case REG_CAMERA_FORMAT7_COLOR_CODING_INQ:
+        case REG_CAMERA_FORMAT7_UNIT_POSITION_INQ:
+            return REGISTER_DEPENDENT;
+        default:
+            return REGISTER_UNCACHED;
+        }
+    }
+    return REGISTER_UNCACHED;
+}
+
+static register_cache_entry_t *
+register_cache_find (register_cache_t * c, uint64_t offset, int create)
+{
+    uint32_t i = (uint32_t) (offset >> 2) & (REGISTER_CACHE_SIZE - 1);
+
+    while (c->entries[i].kind != REGISTER_UNCACHED) {
+        if (c->entries[i].offset == offset)
+            return &c->entries[i];
+        i = (i + 1) & (REGISTER_CACHE_SIZE - 1);
+    }
+    /* Keep free slots so that probing always ends */
+    if (!create || c->num_entries >= REGISTER_CACHE_SIZE * 3 / 4)
+        return NULL;
+    c->num_entries++;
+    c->entries[i].offset = offset;
+    return &c->entries[i];
+}
+
+static void
+register_cache_drop (register_cache_t * c, uint32_t kind)
+{
+    register_cache_entry_t * old;
+    uint32_t i;
+
+    if (kind == REGISTER_UNCACHED || c->num_entries == 0) {
+        memset (c->entries, 0, sizeof (c->entries));
+        c->num_entries = 0;
+        return;
+    }
+
+    /* Removing from a linear probing table breaks the probe chains, so
+       rebuild it from the entries that are kept */
+    old = malloc (sizeof (c->entries));
+    if (!old) {
+        register_cache_drop (c, REGISTER_UNCACHED);
+        return;
+    }
+    memcpy (old, c->entries, sizeof (c->entries));
+    memset (c->entries, 0, sizeof (c->entries));
+    c->num_entries = 0;
+    for (i = 0; i < REGISTER_CACHE_SIZE; i++) {
+        register_cache_entry_t * e;
+        if (old[i].kind == REGISTER_UNCACHED || old[i].kind == kind)
+            continue;
+        e = register_cache_find (c, old[i].offset, 1);
+        e->value = old[i].value;
+        e->kind = old[i].kind;
+    }
+    free (old);
+}
+
+/* Takes the lock of the cache, dropping everything after a bus reset */
+static register_cache_t *
+register_cache_lock (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    register_cache_t * c = cp->register_cache;
+    uint32_t generation;
+
+    if (cp->register_cache_off)
+        return NULL;
+
+    if (!c) {
+        c = calloc (1, sizeof (register_cache_t));
+        if (!c)
+            return NULL;
+        pthread_mutex_init (&c->mutex, NULL);
+        /* Done by the reads of dc1394_camera_new(), before the camera
+           can be shared between threads */
+        cp->register_cache = c;
+    }
+
+    pthread_mutex_lock (&c->mutex);
+    if (cp->platform->dispatch->camera_get_node &&
+        cp->platform->dispatch->camera_get_node (cp->pcam, NULL,
+            &generation) == DC1394_SUCCESS &&
+        generation != c->generation) {
+        register_cache_drop (c, REGISTER_UNCACHED);
+        c->generation = generation;
+    }
+    return c;
+}
+
+/* Reads registers through the cache. kind is that of every register, or
+   REGISTER_UNCACHED to find it from the address of each one. */
+static dc1394error_t
+register_cache_read (dc1394camera_t * camera, uint64_t offset,
+        uint32_t * value, uint32_t num_regs, int kind)
+{
+    register_cache_t * c;
+    dc1394error_t err;
+    uint32_t i;
+
+    for (i = 0; i < num_regs && kind == REGISTER_UNCACHED; i++)
+        if (register_cache_kind (camera, offset + 4 * i) == REGISTER_UNCACHED)
+            break;
+    if (i < num_regs || !(c = register_cache_lock (camera)))
+        return register_bus_read (camera, offset, value, num_regs);
+
+    for (i = 0; i < num_regs; i++) {
+        register_cache_entry_t * e = register_cache_find (c, offset + 4 * i, 0);
+        if (!e)
+            break;
+        value[i] = e->value;
+    }
+    if (i == num_regs) {
+        pthread_mutex_unlock (&c->mutex);
+        return DC1394_SUCCESS;
+    }
+
+    err = register_bus_read (camera, offset, value, num_regs);
+    if (err == DC1394_SUCCESS) {
+        for (i = 0; i < num_regs; i++) {
+            register_cache_entry_t * e = register_cache_find (c,
+                    offset + 4 * i, 1);
+            if (!e)
+                break;
+            e->value = value[i];
+            e->kind = kind != REGISTER_UNCACHED ? kind :
+                register_cache_kind (camera, offset + 4 * i);
+        }
+    }
+    pthread_mutex_unlock (&c->mutex);
+    return err;
+}
+
+/* Serves a read from the cache only, for the asynchronous path */
+static int
+register_cache_lookup (dc1394camera_t * camera, uint64_t offset,
+        uint32_t * value, uint32_t num_regs)
+{
+    register_cache_t * c;
+    uint32_t i;
+
+    for (i = 0; i < num_regs; i++)
+        if (register_cache_kind (camera, offset + 4 * i) == REGISTER_UNCACHED)
+            return 0;
+    if (!(c = register_cache_lock (camera)))
+        return 0;
+    for (i = 0; i < num_regs; i++) {
+        register_cache_entry_t * e = register_cache_find (c, offset + 4 * i, 0);
+        if (!e)
+            break;
+        value[i] = e->value;
+    }
+    pthread_mutex_unlock (&c->mutex);
+    return i == num_regs;
+}
+
+/* Keeps the result of a read made on the asynchronous path */
+static void
+register_cache_store (dc1394camera_t * camera, uint64_t offset,
+        const uint32_t * value, uint32_t num_regs)
+{
+    register_cache_t * c;
+    uint32_t i;
+
+    for (i = 0; i < num_regs; i++)
+        if (register_cache_kind (camera, offset + 4 * i) == REGISTER_UNCACHED)
+            return;
+    if (!(c = register_cache_lock (camera)))
+        return;
+    for (i = 0; i < num_regs; i++) {
+        register_cache_entry_t * e = register_cache_find (c, offset + 4 * i, 1);
+        if (!e)
+            break;
+        e->value = value[i];
+        e->kind = register_cache_kind (camera, offset + 4 * i);
+    }
+    pthread_mutex_unlock (&c->mutex);
+}
+
+/* Follows a successful write into the cache */
+static void
+register_cache_written (dc1394camera_t * camera, uint64_t offset,
+        const uint32_t * value, uint32_t num_regs)
+{
+    uint64_t base = camera->command_registers_base;
+    register_cache_t * c;
+    uint32_t i;
+    int i7;
+
+    if (!(c = register_cache_lock (camera)))
+        return;
+
+    for (i = 0; i < num_regs; i++, offset += 4) {
+        if (base && offset >= base && offset - base < REG_CAMERA_FEATURE_HI_BASE) {
+            register_cache_entry_t * e;
+            switch (offset - base) {
+            case REG_CAMERA_INITIALIZE:
+            case REG_CAMERA_POWER:
+            case REG_CAMERA_CUR_MEM_CH:
+                /* A reset or a memory channel load may change anything */
+                register_cache_drop (c, REGISTER_UNCACHED);
+                break;
+            case REG_CAMERA_FRAME_RATE:
+            case REG_CAMERA_VIDEO_MODE:
+            case REG_CAMERA_VIDEO_FORMAT:
+            case REG_CAMERA_ISO_DATA:
+                register_cache_drop (c, REGISTER_DEPENDENT);
+                e = register_cache_find (c, offset, 1);
+                if (e) {
+                    e->value = value[i];
+                    e->kind = REGISTER_SHADOW;
+                }
+                break;
+            }
+            continue;
+        }
+        if (base && (offset == base + REG_CAMERA_TRIGGER_MODE ||
+                    offset == base + REG_CAMERA_FRAME_RATE_FEATURE)) {
+            register_cache_drop (c, REGISTER_DEPENDENT);
+            continue;
+        }
+        for (i7 = 0; i7 < DC1394_VIDEO_MODE_FORMAT7_NUM; i7++) {
+            uint64_t csr = camera->format7_csr[i7];
+            if (csr && offset >= csr &&
+                offset - csr <= REG_CAMERA_FORMAT7_VALUE_SETTING) {
+                register_cache_drop (c, REGISTER_DEPENDENT);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock (&c->mutex);
+}
+
+uint32_t
+register_cache_export (dc1394camera_t * camera, uint64_t * offsets,
+        uint32_t * values, uint32_t max_entries)
+{
+    register_cache_t * c;
+    uint32_t i, n = 0;
+
+    if (!(c = register_cache_lock (camera)))
+        return 0;
+    for (i = 0; i < REGISTER_CACHE_SIZE; i++) {
+        if (c->entries[i].kind != REGISTER_CONSTANT)
+            continue;
+        if (offsets && n < max_entries) {
+            offsets[n] = c->entries[i].offset;
+            values[n] = c->entries[i].value;
+        }
+        n++;
+    }
+    pthread_mutex_unlock (&c->mutex);
+    return n;
+}
+
+void
+register_cache_import (dc1394camera_t * camera, const uint64_t * offsets,
+        const uint32_t * values, uint32_t num_entries)
+{
+    register_cache_t * c;
+    uint32_t i;
+
+    if (!(c = register_cache_lock (camera)))
+        return;
+    for (i = 0; i < num_entries; i++) {
+        register_cache_entry_t * e;
+        if (register_cache_kind (camera, offsets[i]) != REGISTER_CONSTANT)
+            continue;
+        e = register_cache_find (c, offsets[i], 1);
+        if (!e)
+            break;
+        e->value = values[i];
+        e->kind = REGISTER_CONSTANT;
+    }
+    pthread_mutex_unlock (&c->mutex);
+}
+
+void
+register_cache_free (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+
+    if (!cp->register_cache)
+        return;
+    pthread_mutex_destroy (&cp->register_cache->mutex);
+    free (cp->register_cache);
+    cp->register_cache = NULL;
+}
+
+dc1394error_t
+dc1394_camera_set_register_cache (dc1394camera_t * camera,
+        dc1394switch_t pwr)
 {
     dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
 
     if (camera == NULL)
         return DC1394_CAMERA_NOT_INITIALIZED;
 
-    return cp->platform->dispatch->camera_read (cp->pcam, offset, value,
-            num_regs);
+    switch (pwr) {
+    case DC1394_ON:
+        cp->register_cache_off = 0;
+        return DC1394_SUCCESS;
+    case DC1394_OFF:
+        cp->register_cache_off = 1;
+        return dc1394_camera_flush_register_cache (camera);
+    default:
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+}
+
+dc1394error_t
+dc1394_camera_flush_register_cache (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    register_cache_t * c;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    c = cp->register_cache;
+    if (!c)
+        return DC1394_SUCCESS;
+    pthread_mutex_lock (&c->mutex);
+    register_cache_drop (c, REGISTER_UNCACHED);
+    pthread_mutex_unlock (&c->mutex);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_get_registers (dc1394camera_t *camera, uint64_t offset,
+                      uint32_t *value, uint32_t num_regs)
+{
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    return register_cache_read (camera, offset, value, num_regs,
+            REGISTER_UNCACHED);
 }
 
 dc1394error_t
 dc1394_set_registers (dc1394camera_t *camera, uint64_t offset,
                       const uint32_t *value, uint32_t num_regs)
 {
-    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    dc1394error_t err;
 
     if (camera == NULL)
         return DC1394_CAMERA_NOT_INITIALIZED;
 
-    return cp->platform->dispatch->camera_write (cp->pcam, offset, value,
-            num_regs);
+    err = register_bus_write (camera, offset, value, num_regs);
+    if (err == DC1394_SUCCESS)
+        register_cache_written (camera, offset, value, num_regs);
+    return err;
+}
+
+
+/*
+  Asynchronous transactions. Each camera keeps up to max_outstanding of its
+  transactions in flight and the cameras are served together, waiting on the
+  file descriptors of all of them. A write waits for the transactions before
+  it and holds back those after it, so that the settings of a camera are
+  applied in order. A transaction that finds its node busy is sent again as
+  soon as another response of that camera shows that it made progress, or
+  after an exponential backoff if none is pending.
+
+  The platform keeps a pointer to each transaction in flight, so the
+  transactions are never freed before their responses are read. When the
+  responses of a camera can not be read, the transactions of that camera
+  that were not sent yet fail, and those in flight are waited for.
+*/
+#define TRANSACTION_DEFAULT_OUTSTANDING    4
+#define TRANSACTION_MAX_OUTSTANDING       32
+#define TRANSACTION_MAX_RETRIES          300
+#define TRANSACTION_FIRST_BACKOFF         50    /* microseconds */
+#define TRANSACTION_LAST_BACKOFF        2000
+#define TRANSACTION_MAX_ERRORS             8    /* failed reads before giving up */
+#define TRANSACTION_DRAIN_TIME       2000000    /* microseconds, past a failure */
+
+enum {
+    TRANSACTION_QUEUED = 0,
+    TRANSACTION_IN_FLIGHT,
+    TRANSACTION_BUSY,
+    TRANSACTION_DONE
+};
+
+typedef struct {
+    platform_transaction_t pt;
+    int state;
+    int group;
+    uint32_t retries;
+    uint32_t backoff;
+    uint64_t resend_time;
+    uint64_t trace_start;
+} register_transaction_t;
+
+typedef struct {
+    dc1394camera_t * camera;
+    int fd;
+    uint32_t next;            /* first transaction not yet sent */
+    uint32_t in_flight;       /* sent and not done, including busy ones */
+    int barrier;              /* a write is in flight */
+    int failed;               /* only drains what is in flight */
+    int dead;                 /* its responses can no longer be read */
+    uint32_t errors;
+} register_group_t;
+
+static void
+transaction_finish (dc1394register_transaction_t * user,
+        register_transaction_t * rt, register_group_t * g,
+        dc1394error_t result, uint32_t * num_done)
+{
+    user->result = result;
+    if (rt->state != TRANSACTION_QUEUED) {
+        g->in_flight--;
+        if (rt->pt.write)
+            g->barrier = 0;
+        register_trace_end (user->camera, rt->trace_start, user->offset,
+                user->num_regs, rt->pt.write, result, rt->pt.rcode,
+                rt->retries);
+    }
+    rt->state = TRANSACTION_DONE;
+    (*num_done)++;
+    if (result != DC1394_SUCCESS)
+        return;
+    if (user->write)
+        register_cache_written (user->camera, user->offset, user->value,
+                user->num_regs);
+    else
+        register_cache_store (user->camera, user->offset, user->value,
+                user->num_regs);
+}
+
+static dc1394error_t
+transaction_send (register_group_t * g, register_transaction_t * rt)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (g->camera);
+
+    if (rt->state == TRANSACTION_QUEUED)
+        rt->trace_start = register_trace_begin (g->camera);
+    rt->state = TRANSACTION_IN_FLIGHT;
+    return cp->platform->dispatch->transaction_submit (cp->pcam, &rt->pt);
+}
+
+dc1394error_t
+dc1394_register_transactions (dc1394register_transaction_t * transactions,
+        uint32_t num_transactions, uint32_t max_outstanding)
+{
+    register_transaction_t * rts;
+    register_group_t * groups;
+    struct pollfd * fds;
+    uint32_t num_groups = 0, num_done = 0, i, j;
+    dc1394error_t err = DC1394_SUCCESS;
+    uint64_t deadline = 0;
+    int detached = 0, ret;
+
+    if (num_transactions == 0)
+        return DC1394_SUCCESS;
+    if (transactions == NULL)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    if (max_outstanding == 0)
+        max_outstanding = TRANSACTION_DEFAULT_OUTSTANDING;
+    if (max_outstanding > TRANSACTION_MAX_OUTSTANDING)
+        max_outstanding = TRANSACTION_MAX_OUTSTANDING;
+    for (i = 0; i < num_transactions; i++)
+        if (transactions[i].camera == NULL || transactions[i].value == NULL ||
+            transactions[i].num_regs == 0)
+            return DC1394_INVALID_ARGUMENT_VALUE;
+
+    rts = calloc (num_transactions, sizeof (register_transaction_t));
+    groups = calloc (num_transactions, sizeof (register_group_t));
+    fds = calloc (num_transactions, sizeof (struct pollfd));
+    if (!rts || !groups || !fds) {
+        free (rts);
+        free (groups);
+        free (fds);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    for (i = 0; i < num_transactions; i++) {
+        dc1394register_transaction_t * t = &transactions[i];
+        t->result = DC1394_FAILURE;
+        rts[i].pt.write = t->write != DC1394_FALSE;
+        rts[i].pt.offset = t->offset;
+        rts[i].pt.quads = t->value;
+        rts[i].pt.num_quads = t->num_regs;
+        rts[i].backoff = TRANSACTION_FIRST_BACKOFF;
+
+        for (j = 0; j < num_groups && groups[j].camera != t->camera; j++)
+            ;
+        if (j == num_groups) {
+            dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (t->camera);
+            const platform_dispatch_t * d = cp->platform->dispatch;
+            groups[j].camera = t->camera;
+            groups[j].next = i;
+            groups[j].fd = -1;
+            if (d->transaction_submit && d->transaction_complete &&
+                d->transaction_get_fileno)
+                groups[j].fd = d->transaction_get_fileno (cp->pcam);
+            num_groups++;
+        }
+        rts[i].group = j;
+    }
+
+    while (num_done < num_transactions) {
+        uint64_t now = register_time (), wake = 0;
+        struct timespec timeout, * ptimeout = NULL;
+        uint32_t num_fds = 0;
+
+        // after a failure the responses still due are only waited for so
+        // long; the platform answers every request well within that time
+        if (err != DC1394_SUCCESS && !deadline)
+            deadline = now + TRANSACTION_DRAIN_TIME;
+        if (deadline && now >= deadline)
+            break;
+        if (deadline && (!wake || deadline < wake))
+            wake = deadline;
+
+        for (j = 0; j < num_groups; j++) {
+            register_group_t * g = &groups[j];
+
+            // a failed camera gets nothing more sent
+            if (g->failed) {
+                for (i = 0; i < num_transactions; i++)
+                    if (rts[i].group == j && rts[i].state == TRANSACTION_BUSY)
+                        transaction_finish (&transactions[i], &rts[i], g,
+                                DC1394_FAILURE, &num_done);
+                for (; g->next < num_transactions; g->next++)
+                    if (rts[g->next].group == j)
+                        transaction_finish (&transactions[g->next],
+                                &rts[g->next], g, DC1394_FAILURE, &num_done);
+            }
+
+            // busy transactions whose backoff has elapsed
+            for (i = 0; i < num_transactions && g->in_flight; i++) {
+                if (rts[i].group != j || rts[i].state != TRANSACTION_BUSY)
+                    continue;
+                if (rts[i].resend_time <= now) {
+                    if (transaction_send (g, &rts[i]) != DC1394_SUCCESS)
+                        transaction_finish (&transactions[i], &rts[i], g,
+                                DC1394_FAILURE, &num_done);
+                }
+                else if (!wake || rts[i].resend_time < wake)
+                    wake = rts[i].resend_time;
+            }
+
+            // new transactions, in order
+            while (g->next < num_transactions && !g->barrier &&
+                   g->in_flight < max_outstanding) {
+                register_transaction_t * rt = &rts[g->next];
+                dc1394register_transaction_t * t = &transactions[g->next];
+
+                if (rt->pt.write && g->in_flight)
+                    break;
+                if (g->fd < 0) {
+                    // no asynchronous path on this platform
+                    if (t->write)
+                        t->result = dc1394_set_registers (t->camera, t->offset,
+                                t->value, t->num_regs);
+                    else
+                        t->result = dc1394_get_registers (t->camera, t->offset,
+                                t->value, t->num_regs);
+                    rt->state = TRANSACTION_DONE;
+                    num_done++;
+                }
+                else if (!t->write && register_cache_lookup (t->camera,
+                            t->offset, t->value, t->num_regs))
+                    transaction_finish (t, rt, g, DC1394_SUCCESS, &num_done);
+                else {
+                    g->in_flight++;
+                    if (rt->pt.write)
+                        g->barrier = 1;
+                    if (transaction_send (g, rt) != DC1394_SUCCESS)
+                        transaction_finish (t, rt, g, DC1394_FAILURE, &num_done);
+                }
+                for (g->next++; g->next < num_transactions &&
+                        rts[g->next].group != j; g->next++)
+                    ;
+            }
+
+            if (g->fd >= 0 && g->in_flight && !g->dead) {
+                fds[num_fds].fd = g->fd;
+                fds[num_fds].events = POLLIN;
+                fds[num_fds].revents = 0;
+                num_fds++;
+            }
+        }
+
+        // what is left, if anything, is in flight on dead groups
+        if (num_done == num_transactions || num_fds == 0)
+            break;
+
+        // wait for a response, or for the end of the first backoff
+        if (wake) {
+            now = register_time ();
+            wake = wake > now ? wake - now : 0;
+            timeout.tv_sec = wake / 1000000;
+            timeout.tv_nsec = (wake % 1000000) * 1000;
+            ptimeout = &timeout;
+        }
+#ifdef HAVE_LINUX
+        // backoffs are shorter than the millisecond resolution of poll()
+        ret = ppoll (fds, num_fds, ptimeout, NULL);
+#else
+        ret = poll (fds, num_fds, ptimeout ? (int) ((wake + 999) / 1000) : -1);
+#endif
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            dc1394_log_error ("failed to wait for register transactions: %m");
+            err = DC1394_FAILURE;
+            break;
+        }
+
+        for (i = 0; i < num_fds; i++) {
+            register_group_t * g;
+            dc1394camera_priv_t * cp;
+            platform_transaction_t * pt;
+            register_transaction_t * rt;
+            int k;
+
+            if (!(fds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+                continue;
+            for (j = 0; groups[j].fd != fds[i].fd; j++)
+                ;
+            g = &groups[j];
+            cp = DC1394_CAMERA_PRIV (g->camera);
+            if (cp->platform->dispatch->transaction_complete (cp->pcam, &pt)
+                    != DC1394_SUCCESS) {
+                err = DC1394_FAILURE;
+                g->failed = 1;
+                if (++g->errors >= TRANSACTION_MAX_ERRORS)
+                    g->dead = 1;
+                continue;
+            }
+            g->errors = 0;
+            if (!pt)
+                continue;
+            // a late response to a batch that gave up on it is not ours
+            if ((uintptr_t) pt < (uintptr_t) rts ||
+                (uintptr_t) pt >= (uintptr_t) (rts + num_transactions)) {
+                dc1394_log_debug ("Dropped a response to an earlier batch "
+                        "of register transactions");
+                continue;
+            }
+            rt = (register_transaction_t *) pt;
+            k = rt - rts;
+
+            if (g->failed) {
+                transaction_finish (&transactions[k], rt, g, DC1394_FAILURE,
+                        &num_done);
+                continue;
+            }
+            if (!pt->retry) {
+                transaction_finish (&transactions[k], rt, g, pt->result,
+                        &num_done);
+                // the node made progress: resend its busy transactions now
+                for (k = 0; k < num_transactions; k++)
+                    if (rts[k].group == j && rts[k].state == TRANSACTION_BUSY)
+                        rts[k].resend_time = 0;
+                continue;
+            }
+            if (++rt->retries > TRANSACTION_MAX_RETRIES) {
+                dc1394_log_error ("Max retries for register %"PRIx64,
+                        pt->offset);
+                transaction_finish (&transactions[k], rt, g, DC1394_FAILURE,
+                        &num_done);
+                continue;
+            }
+            rt->state = TRANSACTION_BUSY;
+            rt->resend_time = register_time () + rt->backoff;
+            if (rt->backoff < TRANSACTION_LAST_BACKOFF)
+                rt->backoff *= 2;
+        }
+    }
+
+    // whatever is still in flight is cut off from the buffers of the caller,
+    // and its memory is kept so that a late response points nowhere valid
+    for (i = 0; i < num_transactions; i++) {
+        if (rts[i].state == TRANSACTION_DONE)
+            continue;
+        if (rts[i].state == TRANSACTION_IN_FLIGHT) {
+            rts[i].pt.quads = NULL;
+            rts[i].pt.num_quads = 0;
+            detached = 1;
+        }
+        transactions[i].result = DC1394_FAILURE;
+    }
+
+    for (i = 0; i < num_transactions && err == DC1394_SUCCESS; i++)
+        err = transactions[i].result;
+
+    if (detached)
+        dc1394_log_warning ("Register transactions left in flight");
+    else
+        free (rts);
+    free (groups);
+    free (fds);
+    return err;
 }
 
 
@@ -221,6 +1313,11 @@ dc1394_get_absolute_register(dc1394camera_t *camera, unsigned int feature,
 
     QueryAbsoluteCSROffset(camera, feature, &absoffset);
 
+    /* The boundaries are shadowed like those of the feature inquiry */
+    if (offset == REG_CAMERA_ABS_MIN || offset == REG_CAMERA_ABS_MAX)
+        return register_cache_read (camera, absoffset + offset, value, 1,
+                REGISTER_DEPENDENT);
+
     return dc1394_get_registers (camera, absoffset + offset, value, 1);
 }
 
@@ -229,12 +1326,22 @@ dc1394_set_absolute_register(dc1394camera_t *camera, unsigned int feature,
         uint64_t offset, uint32_t value)
 {
     uint64_t absoffset;
+    dc1394error_t err;
+    register_cache_t * c;
+
     if (camera == NULL)
         return DC1394_CAMERA_NOT_INITIALIZED;
 
     QueryAbsoluteCSROffset(camera, feature, &absoffset);
 
-    return dc1394_set_registers (camera, absoffset + offset, &value, 1);
+    err = dc1394_set_registers (camera, absoffset + offset, &value, 1);
+    if (err == DC1394_SUCCESS && (feature == DC1394_FEATURE_FRAME_RATE ||
+                feature == DC1394_FEATURE_TRIGGER) &&
+            (c = register_cache_lock (camera))) {
+        register_cache_drop (c, REGISTER_DEPENDENT);
+        pthread_mutex_unlock (&c->mutex);
+    }
+    return err;
 }
 
 /********************************************************************************/
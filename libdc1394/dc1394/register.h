@@ -31,6 +31,42 @@
     More details soon
 */
 
+/**
+ * A register transaction for dc1394_register_transactions(). offset is an address as in dc1394_get_registers();
+ * value holds the num_regs quadlets to write, or receives those read. result is set when the transaction is done.
+ */
+typedef struct
+{
+    dc1394camera_t          *camera;
+    uint64_t                 offset;
+    uint32_t                *value;
+    uint32_t                 num_regs;
+    dc1394bool_t             write;
+    dc1394error_t            result;
+} dc1394register_transaction_t;
+
+/**
+ * Number of bins of the latency histograms of the register trace. Bin n counts the transactions that took
+ * from 2^n to 2^(n+1) microseconds; the last one also counts the longer ones.
+ */
+#define DC1394_REGISTER_TRACE_BINS   16
+
+/**
+ * A register transaction recorded by the trace. rcode is the last IEEE 1394 response code, if the platform
+ * reports it, and retries the number of times the transaction was sent again after a busy or conflict response.
+ */
+typedef struct
+{
+    uint64_t                 timestamp;     /* monotonic host time at the start, in microseconds */
+    uint64_t                 offset;
+    uint32_t                 num_regs;
+    dc1394bool_t             write;
+    uint32_t                 rcode;
+    uint32_t                 retries;
+    uint32_t                 latency;       /* microseconds */
+    dc1394error_t            result;
+} dc1394register_trace_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -65,6 +101,42 @@ static inline dc1394error_t dc1394_set_register (dc1394camera_t *camera,
     return dc1394_set_registers (camera, offset, &value, 1);
 }
 
+/**
+ * Runs a batch of register transactions, on one or several cameras, with several of them in flight at a time
+ * instead of one after the other. Up to max_outstanding transactions of each camera are pipelined (0 for the
+ * default of 4); a write waits for those before it and holds back those after it, so that each camera sees its
+ * writes in the order of the array. Returns DC1394_SUCCESS once all are done, or the first error among their
+ * results. Platforms without asynchronous transactions run them one by one.
+ */
+dc1394error_t dc1394_register_transactions (dc1394register_transaction_t *transactions,
+        uint32_t num_transactions, uint32_t max_outstanding);
+
+
+/**
+ * Starts tracing the register transactions of a camera that go to the bus. The last num_entries of them are
+ * kept (0 for 1024) and each register address gets a latency histogram. Recording takes no lock and costs
+ * a few atomic operations per transaction, so the trace can be left on. Starting again clears the trace; it
+ * must not be done while other threads access the camera.
+ */
+dc1394error_t dc1394_register_trace_start (dc1394camera_t *camera, uint32_t num_entries);
+
+/**
+ * Stops tracing. What was recorded is kept until the next start.
+ */
+dc1394error_t dc1394_register_trace_stop (dc1394camera_t *camera);
+
+/**
+ * Copies at most *num_entries of the latest transactions of the trace, oldest first, and sets *num_entries
+ * to the number copied.
+ */
+dc1394error_t dc1394_register_trace_get (dc1394camera_t *camera, dc1394register_trace_t *entries,
+        uint32_t *num_entries);
+
+/**
+ * Prints the totals of the trace and the statistics of each register, the most costly first.
+ */
+dc1394error_t dc1394_register_trace_dump (dc1394camera_t *camera, FILE *fd);
+
 
 /********************************************************************************/
 /* Get/Set Command Registers                                                    */
@@ -222,6 +294,28 @@ dc1394error_t
 dc1394_set_strobe_register(dc1394camera_t *camera, uint64_t offset, uint32_t value);
 
 
+/********************************************************************************/
+/* Register cache                                                               */
+/********************************************************************************/
+
+/**
+ * Turns the register cache of a camera on or off. The cache is on by default: the inquiry registers, the
+ * feature boundaries and the current video format, mode, frame rate and ISO settings are read over the bus
+ * once and then served from memory. It is flushed on camera and bus resets, and its mode-dependent part
+ * whenever the video mode, the trigger or the frame rate is written through the library. Turning it off
+ * also flushes it.
+ */
+dc1394error_t
+dc1394_camera_set_register_cache(dc1394camera_t *camera, dc1394switch_t pwr);
+
+/**
+ * Flushes the register cache of a camera. Needed after changing the camera configuration behind the
+ * library, e.g. with vendor specific advanced feature registers.
+ */
+dc1394error_t
+dc1394_camera_flush_register_cache(dc1394camera_t *camera);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,606 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Distribution of captured frames to other processes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* for memfd_create */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "control.h"
+#include "capture.h"
+#include "share.h"
+#include "internal.h"
+#include "log.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#if defined(HAVE_LINUX) && !defined(F_SEAL_FUTURE_WRITE)
+#define F_SEAL_FUTURE_WRITE 0x0010     /* Linux 5.1 */
+#endif
+
+/* Messages on the SOCK_SEQPACKET connection. The hello message carries
+   the file descriptor of the ring; a frame message hands a slot to the
+   subscriber until it sends a release message for it. */
+#define SHARE_MAGIC      0x44433153     /* "DC1S" */
+#define SHARE_HELLO      1
+#define SHARE_FRAME      2
+#define SHARE_RELEASE    3
+
+typedef struct {
+    uint32_t                   magic;
+    uint32_t                   type;
+    uint32_t                   slot;
+    uint32_t                   num_slots;
+    uint64_t                   slot_size;
+    stream_frame_header_t      frame;
+} share_msg_t;
+
+typedef struct {
+    int                        fd;
+    uint64_t                   held;      /* slots sent and not released */
+} share_client_t;
+
+struct __dc1394publisher_t {
+    int                        listen_fd;
+    struct sockaddr_un         addr;
+    int                        ring_fd;   /* read-only, for the subscribers */
+    unsigned char            * ring;
+    uint32_t                   num_slots;
+    uint64_t                   slot_size;
+    uint32_t                   refs[DC1394_SHARE_MAX_SLOTS];
+    uint32_t                   next_slot;
+
+    share_client_t             clients[DC1394_SHARE_MAX_SUBSCRIBERS];
+    dc1394publisher_stats_t    stats;
+};
+
+struct __dc1394subscriber_t {
+    int                        fd;
+    unsigned char            * ring;
+    size_t                     ring_size;
+    uint32_t                   num_slots;
+    uint64_t                   slot_size;
+    dc1394video_frame_t        frames[DC1394_SHARE_MAX_SLOTS];
+};
+
+static int
+share_socket_path (struct sockaddr_un * addr, const char * path)
+{
+    if (strlen (path) >= sizeof (addr->sun_path)) {
+        dc1394_log_error ("share: socket path %s is too long", path);
+        return -1;
+    }
+    memset (addr, 0, sizeof (struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy (addr->sun_path, path);
+    return 0;
+}
+
+/* An anonymous file that is only reachable through its descriptor. It is
+   mapped writable into the publisher, then the descriptor that is given to
+   the subscribers is made read-only: on Linux the memfd is sealed against
+   any later writable mapping, write or resize, since anyone could open it
+   again through /proc with write access; elsewhere a read-only descriptor
+   is opened before the shared memory object is unlinked. */
+static int
+share_create_ring (uint64_t size, unsigned char ** ring)
+{
+    int fd, ro_fd;
+#ifdef HAVE_LINUX
+    fd = memfd_create ("dc1394-share", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+    ro_fd = fd;
+#else
+    char name[64];
+    snprintf (name, sizeof (name), "/dc1394-share-%d", (int) getpid ());
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -1;
+    ro_fd = shm_open (name, O_RDONLY, 0600);
+    shm_unlink (name);
+    if (ro_fd < 0) {
+        close (fd);
+        return -1;
+    }
+#endif
+    *ring = MAP_FAILED;
+    if (ftruncate (fd, size) < 0)
+        goto error;
+    *ring = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (*ring == MAP_FAILED)
+        goto error;
+#ifdef HAVE_LINUX
+    if (fcntl (fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE | F_SEAL_SHRINK |
+                F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        dc1394_log_error ("share: could not seal the ring: %m");
+        goto error;
+    }
+#else
+    close (fd);
+#endif
+    return ro_fd;
+
+error:
+    if (*ring != MAP_FAILED)
+        munmap (*ring, size);
+    if (ro_fd != fd)
+        close (ro_fd);
+    close (fd);
+    return -1;
+}
+
+/* Without MSG_NOSIGNAL a peer that went away would raise SIGPIPE */
+static void
+share_no_sigpipe (int fd)
+{
+#if defined(SO_NOSIGPIPE)
+    int one = 1;
+    setsockopt (fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof (one));
+#else
+    (void) fd;
+#endif
+}
+
+static int
+share_send (int fd, const share_msg_t * msg, int pass_fd)
+{
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE (sizeof (int))];
+    } control;
+    struct cmsghdr * cmsg;
+
+    memset (&mh, 0, sizeof (mh));
+    iov.iov_base = (void *) msg;
+    iov.iov_len = sizeof (share_msg_t);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (pass_fd >= 0) {
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof (control.buf);
+        cmsg = CMSG_FIRSTHDR (&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+        memcpy (CMSG_DATA (cmsg), &pass_fd, sizeof (int));
+    }
+    return sendmsg (fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) ==
+        sizeof (share_msg_t) ? 0 : -1;
+}
+
+/* Returns the size received, 0 when the peer is gone, -1 on error or
+   when nothing is waiting in non-blocking mode */
+static ssize_t
+share_recv (int fd, share_msg_t * msg, int * passed_fd, int flags)
+{
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE (sizeof (int))];
+    } control;
+    struct cmsghdr * cmsg;
+    ssize_t n;
+
+    memset (&mh, 0, sizeof (mh));
+    iov.iov_base = msg;
+    iov.iov_len = sizeof (share_msg_t);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof (control.buf);
+
+    do
+        n = recvmsg (fd, &mh, flags);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return n;
+
+    for (cmsg = CMSG_FIRSTHDR (&mh); cmsg; cmsg = CMSG_NXTHDR (&mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            if (passed_fd)
+                memcpy (passed_fd, CMSG_DATA (cmsg), sizeof (int));
+            else {
+                int stray;
+                memcpy (&stray, CMSG_DATA (cmsg), sizeof (int));
+                close (stray);
+            }
+        }
+    }
+    if (n != sizeof (share_msg_t) || msg->magic != SHARE_MAGIC) {
+        errno = EPROTO;
+        return -1;
+    }
+    return n;
+}
+
+/***************************************************************************
+     Publisher
+ ***************************************************************************/
+
+dc1394publisher_t *
+dc1394_publisher_new (const char * path, uint32_t num_slots, uint64_t slot_size)
+{
+    dc1394publisher_t * p;
+    long page = sysconf (_SC_PAGESIZE);
+    int i;
+
+    if (num_slots == 0 || num_slots > DC1394_SHARE_MAX_SLOTS || slot_size == 0) {
+        dc1394_log_error ("share: a publisher has 1 to %d slots",
+                DC1394_SHARE_MAX_SLOTS);
+        return NULL;
+    }
+
+    p = calloc (1, sizeof (dc1394publisher_t));
+    if (!p)
+        return NULL;
+    for (i = 0; i < DC1394_SHARE_MAX_SUBSCRIBERS; i++)
+        p->clients[i].fd = -1;
+    p->ring_fd = -1;
+    p->num_slots = num_slots;
+    p->slot_size = (slot_size + page - 1) / page * page;
+
+    if (share_socket_path (&p->addr, path) < 0)
+        goto error;
+    p->listen_fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (p->listen_fd < 0)
+        goto error_errno;
+    fcntl (p->listen_fd, F_SETFD, FD_CLOEXEC);
+    fcntl (p->listen_fd, F_SETFL, O_NONBLOCK);
+    unlink (path);
+    if (bind (p->listen_fd, (struct sockaddr *) &p->addr,
+              sizeof (struct sockaddr_un)) < 0 ||
+        listen (p->listen_fd, DC1394_SHARE_MAX_SUBSCRIBERS) < 0)
+        goto error_socket;
+
+    p->ring_fd = share_create_ring (p->slot_size * num_slots, &p->ring);
+    if (p->ring_fd < 0)
+        goto error_bound;
+
+    return p;
+
+error_bound:
+    unlink (path);
+error_socket:
+    close (p->listen_fd);
+error_errno:
+    dc1394_log_error ("share: could not publish on %s: %s", path,
+            strerror (errno));
+error:
+    free (p);
+    return NULL;
+}
+
+static void
+publisher_drop_client (dc1394publisher_t * p, share_client_t * c)
+{
+    uint32_t i;
+
+    for (i = 0; i < p->num_slots; i++)
+        if (c->held & ((uint64_t) 1 << i))
+            p->refs[i]--;
+    close (c->fd);
+    c->fd = -1;
+    c->held = 0;
+    p->stats.subscribers--;
+}
+
+void
+dc1394_publisher_free (dc1394publisher_t * p)
+{
+    int i;
+
+    if (!p)
+        return;
+    for (i = 0; i < DC1394_SHARE_MAX_SUBSCRIBERS; i++)
+        if (p->clients[i].fd >= 0)
+            publisher_drop_client (p, p->clients + i);
+    munmap (p->ring, p->slot_size * p->num_slots);
+    close (p->ring_fd);
+    close (p->listen_fd);
+    unlink (p->addr.sun_path);
+    free (p);
+}
+
+/* Accepts the pending connections and reads the pending releases */
+static void
+publisher_service (dc1394publisher_t * p)
+{
+    share_client_t * c;
+    share_msg_t msg;
+    uint64_t bit;
+    ssize_t n;
+    int fd, i;
+
+    while ((fd = accept (p->listen_fd, NULL, NULL)) >= 0) {
+        fcntl (fd, F_SETFD, FD_CLOEXEC);
+        fcntl (fd, F_SETFL, O_NONBLOCK);
+        share_no_sigpipe (fd);
+        for (i = 0; i < DC1394_SHARE_MAX_SUBSCRIBERS; i++)
+            if (p->clients[i].fd < 0)
+                break;
+        memset (&msg, 0, sizeof (msg));
+        msg.magic = SHARE_MAGIC;
+        msg.type = SHARE_HELLO;
+        msg.num_slots = p->num_slots;
+        msg.slot_size = p->slot_size;
+        if (i == DC1394_SHARE_MAX_SUBSCRIBERS) {
+            dc1394_log_warning ("share: too many subscribers, refusing one");
+            close (fd);
+            continue;
+        }
+        if (share_send (fd, &msg, p->ring_fd) < 0) {
+            close (fd);
+            continue;
+        }
+        p->clients[i].fd = fd;
+        p->clients[i].held = 0;
+        p->stats.subscribers++;
+    }
+
+    for (i = 0; i < DC1394_SHARE_MAX_SUBSCRIBERS; i++) {
+        c = p->clients + i;
+        while (c->fd >= 0) {
+            n = share_recv (c->fd, &msg, NULL, MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0 || msg.type != SHARE_RELEASE ||
+                msg.slot >= p->num_slots) {
+                publisher_drop_client (p, c);
+                break;
+            }
+            bit = (uint64_t) 1 << msg.slot;
+            if (c->held & bit) {
+                c->held &= ~bit;
+                p->refs[msg.slot]--;
+            }
+        }
+    }
+}
+
+dc1394error_t
+dc1394_publisher_publish (dc1394publisher_t * p, const dc1394video_frame_t * frame)
+{
+    share_client_t * c;
+    share_msg_t msg;
+    uint32_t slot, i;
+
+    if (!p || !frame)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    publisher_service (p);
+    if (p->stats.subscribers == 0)
+        return DC1394_SUCCESS;
+
+    if (frame->total_bytes > p->slot_size) {
+        dc1394_log_error ("share: frames of %"PRIu64" bytes do not fit in "
+                "slots of %"PRIu64, frame->total_bytes, p->slot_size);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    for (i = 0; i < p->num_slots; i++)
+        if (p->refs[(p->next_slot + i) % p->num_slots] == 0)
+            break;
+    if (i == p->num_slots) {
+        p->stats.frames_dropped++;
+        return DC1394_SUCCESS;
+    }
+    slot = (p->next_slot + i) % p->num_slots;
+    p->next_slot = (slot + 1) % p->num_slots;
+
+    memcpy (p->ring + slot * p->slot_size, frame->image, frame->total_bytes);
+
+    memset (&msg, 0, sizeof (msg));
+    msg.magic = SHARE_MAGIC;
+    msg.type = SHARE_FRAME;
+    msg.slot = slot;
+    stream_header_from_frame (&msg.frame, frame);
+    for (i = 0; i < DC1394_SHARE_MAX_SUBSCRIBERS; i++) {
+        c = p->clients + i;
+        if (c->fd < 0)
+            continue;
+        if (share_send (c->fd, &msg, -1) == 0) {
+            c->held |= (uint64_t) 1 << slot;
+            p->refs[slot]++;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            p->stats.frames_skipped++;
+        else
+            publisher_drop_client (p, c);
+    }
+    p->stats.frames_published++;
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_publisher_get_stats (dc1394publisher_t * p, dc1394publisher_stats_t * stats)
+{
+    if (!p || !stats)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    memcpy (stats, &p->stats, sizeof (dc1394publisher_stats_t));
+    return DC1394_SUCCESS;
+}
+
+/***************************************************************************
+     Subscriber
+ ***************************************************************************/
+
+dc1394subscriber_t *
+dc1394_subscriber_new (const char * path)
+{
+    dc1394subscriber_t * s;
+    struct sockaddr_un addr;
+    share_msg_t msg;
+    int ring_fd = -1;
+
+    if (share_socket_path (&addr, path) < 0)
+        return NULL;
+    s = calloc (1, sizeof (dc1394subscriber_t));
+    if (!s)
+        return NULL;
+
+    s->fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (s->fd < 0)
+        goto error;
+    fcntl (s->fd, F_SETFD, FD_CLOEXEC);
+    share_no_sigpipe (s->fd);
+    if (connect (s->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+        goto error_socket;
+
+    // the publisher only answers when it publishes its next frame
+    if (share_recv (s->fd, &msg, &ring_fd, 0) <= 0 ||
+        msg.type != SHARE_HELLO || ring_fd < 0 ||
+        msg.num_slots == 0 || msg.num_slots > DC1394_SHARE_MAX_SLOTS) {
+        errno = EPROTO;
+        goto error_ring;
+    }
+    s->num_slots = msg.num_slots;
+    s->slot_size = msg.slot_size;
+    s->ring_size = msg.slot_size * msg.num_slots;
+    s->ring = mmap (NULL, s->ring_size, PROT_READ, MAP_SHARED, ring_fd, 0);
+    if (s->ring == MAP_FAILED)
+        goto error_ring;
+    close (ring_fd);
+
+    return s;
+
+error_ring:
+    if (ring_fd >= 0)
+        close (ring_fd);
+error_socket:
+    close (s->fd);
+error:
+    dc1394_log_error ("share: could not subscribe to %s: %s", path,
+            strerror (errno));
+    free (s);
+    return NULL;
+}
+
+void
+dc1394_subscriber_free (dc1394subscriber_t * s)
+{
+    if (!s)
+        return;
+    munmap (s->ring, s->ring_size);
+    close (s->fd);
+    free (s);
+}
+
+int
+dc1394_subscriber_get_fileno (dc1394subscriber_t * s)
+{
+    return s->fd;
+}
+
+static dc1394error_t
+subscriber_release (dc1394subscriber_t * s, uint32_t slot)
+{
+    share_msg_t msg;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.magic = SHARE_MAGIC;
+    msg.type = SHARE_RELEASE;
+    msg.slot = slot;
+    // at most num_slots releases are ever in flight, so this never blocks;
+    // once the publisher is gone there is nothing left to release
+    if (share_send (s->fd, &msg, -1) < 0 &&
+        errno != EPIPE && errno != ECONNRESET) {
+        dc1394_log_error ("share: could not release a frame: %s",
+                strerror (errno));
+        return DC1394_FAILURE;
+    }
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_subscriber_dequeue (dc1394subscriber_t * s, dc1394capture_policy_t policy,
+        dc1394video_frame_t ** frame_return)
+{
+    dc1394video_frame_t * frame;
+    share_msg_t msg;
+    ssize_t n;
+    int flags = 0;
+
+    *frame_return = NULL;
+    if ((policy < DC1394_CAPTURE_POLICY_MIN) ||
+        (policy > DC1394_CAPTURE_POLICY_MAX))
+        return DC1394_INVALID_CAPTURE_POLICY;
+    if (policy == DC1394_CAPTURE_POLICY_POLL)
+        flags = MSG_DONTWAIT;
+
+    for (;;) {
+        n = share_recv (s->fd, &msg, NULL, flags);
+        if (n < 0 && flags && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return DC1394_SUCCESS;
+        if (n == 0) {
+            dc1394_log_error ("share: the publisher has gone away");
+            return DC1394_FAILURE;
+        }
+        if (n < 0 || msg.type != SHARE_FRAME || msg.slot >= s->num_slots ||
+            msg.frame.total_bytes > s->slot_size) {
+            dc1394_log_error ("share: bad message from the publisher");
+            return DC1394_FAILURE;
+        }
+
+        if (*frame_return)
+            subscriber_release (s, (*frame_return)->id);
+        frame = s->frames + msg.slot;
+        stream_header_to_frame (frame, &msg.frame);
+        frame->image = s->ring + msg.slot * s->slot_size;
+        frame->allocated_image_bytes = s->slot_size;
+        frame->id = msg.slot;
+        *frame_return = frame;
+
+        // the latest policy only keeps the newest of the waiting frames
+        if (policy != DC1394_CAPTURE_POLICY_LATEST)
+            return DC1394_SUCCESS;
+        flags = MSG_DONTWAIT;
+        n = recv (s->fd, &msg, sizeof (msg), MSG_PEEK | MSG_DONTWAIT);
+        if (n <= 0)
+            return DC1394_SUCCESS;
+    }
+}
+
+dc1394error_t
+dc1394_subscriber_enqueue (dc1394subscriber_t * s, dc1394video_frame_t * frame)
+{
+    if (!s || !frame || frame->id >= s->num_slots ||
+        frame != s->frames + frame->id)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    return subscriber_release (s, frame->id);
+}
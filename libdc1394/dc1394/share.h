@@ -0,0 +1,122 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Distribution of captured frames to other processes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_SHARE_H__
+#define __DC1394_SHARE_H__
+
+/*! \file dc1394/share.h
+    \brief Functions to hand captured frames to other processes
+
+    The process that owns the camera publishes its frames on a local socket. Each published frame is copied
+    once into a ring of slots in shared memory; subscribers map that ring read-only when they connect and
+    receive descriptors of the frames in it, so any number of them read the same copy. A slot is reused once
+    every subscriber it was sent to has given it back, or has gone away.
+*/
+
+#include <dc1394/log.h>
+
+/**
+ * Limits of a publisher
+ */
+#define DC1394_SHARE_MAX_SLOTS          64
+#define DC1394_SHARE_MAX_SUBSCRIBERS    16
+
+/**
+ * The publishing side, in the process that captures
+ */
+typedef struct __dc1394publisher_t dc1394publisher_t;
+
+/**
+ * A connection to a publisher, in a client process
+ */
+typedef struct __dc1394subscriber_t dc1394subscriber_t;
+
+/**
+ * Publisher counters. A frame is dropped when no slot is free; a frame is skipped for a subscriber whose
+ * socket is full because it does not keep up.
+ */
+typedef struct
+{
+    uint32_t                 subscribers;
+    uint64_t                 frames_published;
+    uint64_t                 frames_dropped;
+    uint64_t                 frames_skipped;
+} dc1394publisher_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates a publisher listening on the local socket path, with num_slots slots of slot_size bytes each.
+ * The slots must be large enough for the total_bytes of the published frames.
+ */
+dc1394publisher_t * dc1394_publisher_new (const char * path, uint32_t num_slots, uint64_t slot_size);
+
+/**
+ * Disconnects the subscribers, removes the socket and frees the publisher.
+ */
+void dc1394_publisher_free (dc1394publisher_t * publisher);
+
+/**
+ * Publishes a frame to the connected subscribers. The frame is copied, so it can be enqueued right after.
+ * New connections and the frames given back by the subscribers are also handled by this call; nothing is
+ * copied while nobody is connected.
+ */
+dc1394error_t dc1394_publisher_publish (dc1394publisher_t * publisher, const dc1394video_frame_t * frame);
+
+/**
+ * Gets the counters of the publisher.
+ */
+dc1394error_t dc1394_publisher_get_stats (dc1394publisher_t * publisher, dc1394publisher_stats_t * stats);
+
+/**
+ * Connects to the publisher listening on the local socket path. The publisher accepts connections when it
+ * publishes a frame, so this waits until the next frame of the camera.
+ */
+dc1394subscriber_t * dc1394_subscriber_new (const char * path);
+
+/**
+ * Disconnects from the publisher. Frames not yet given back are released with the connection.
+ */
+void dc1394_subscriber_free (dc1394subscriber_t * subscriber);
+
+/**
+ * Gets a file descriptor that is readable when a frame is waiting, to be used for select().
+ */
+int dc1394_subscriber_get_fileno (dc1394subscriber_t * subscriber);
+
+/**
+ * Receives a frame with the same policies as dc1394_capture_dequeue(). The image is in the shared ring and
+ * is read-only; the camera field is NULL. Fails once the publisher has gone away.
+ */
+dc1394error_t dc1394_subscriber_dequeue (dc1394subscriber_t * subscriber, dc1394capture_policy_t policy,
+        dc1394video_frame_t ** frame);
+
+/**
+ * Gives a frame back to the publisher once it has been used.
+ */
+dc1394error_t dc1394_subscriber_enqueue (dc1394subscriber_t * subscriber, dc1394video_frame_t * frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Reading of recorded frame streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "control.h"
+#include "recorder.h"
+#include "stream.h"
+#include "internal.h"
+#include "log.h"
+
+#define BLOCK DC1394_RECORDER_BLOCK_SIZE
+#define BLOCK_ROUND(x) (((x) + BLOCK - 1) & ~(uint64_t)(BLOCK - 1))
+
+struct __dc1394stream_t {
+    unsigned char            * map;
+    uint64_t                   map_size;
+    const uint64_t           * index;       /* in the mapping, or allocated */
+    uint64_t                   num_frames;
+    int                        index_allocated;
+};
+
+static const stream_frame_header_t *
+frame_header_at (dc1394stream_t * s, uint64_t offset)
+{
+    const stream_frame_header_t * h;
+
+    if (offset % BLOCK || s->map_size < BLOCK ||
+        offset > s->map_size - BLOCK)
+        return NULL;
+    h = (const stream_frame_header_t *) (s->map + offset);
+    if (h->magic != STREAM_FRAME_MAGIC ||
+        h->total_bytes > s->map_size - BLOCK - offset ||
+        BLOCK_ROUND (h->total_bytes) > s->map_size - BLOCK - offset)
+        return NULL;
+    return h;
+}
+
+static int
+load_index (dc1394stream_t * s)
+{
+    const stream_index_footer_t * footer;
+
+    if (s->map_size < 2 * BLOCK)
+        return -1;
+    footer = (const stream_index_footer_t *) (s->map + s->map_size - BLOCK);
+    // neither the offset nor the count is trusted, so nothing is
+    // multiplied or added before it is known not to overflow
+    if (memcmp (footer->magic, STREAM_INDEX_MAGIC, sizeof (footer->magic)) ||
+        footer->index_offset % BLOCK ||
+        footer->index_offset > s->map_size - BLOCK ||
+        footer->num_frames > (s->map_size - BLOCK - footer->index_offset) /
+        sizeof (uint64_t))
+        return -1;
+
+    s->index = (const uint64_t *) (s->map + footer->index_offset);
+    s->num_frames = footer->num_frames;
+    return 0;
+}
+
+/* For streams without an index: walk the frame headers */
+static int
+scan_frames (dc1394stream_t * s)
+{
+    const stream_frame_header_t * h;
+    uint64_t offset = BLOCK, size = 0, * index = NULL;
+
+    s->num_frames = 0;
+    while ((h = frame_header_at (s, offset)) != NULL) {
+        if (s->num_frames == size) {
+            uint64_t * p;
+            size = size ? 2 * size : 1024;
+            p = realloc (index, size * sizeof (uint64_t));
+            if (!p) {
+                free (index);
+                return -1;
+            }
+            index = p;
+        }
+        index[s->num_frames++] = offset;
+        offset += BLOCK + BLOCK_ROUND (h->total_bytes);
+    }
+
+    s->index = index;
+    s->index_allocated = 1;
+    return 0;
+}
+
+dc1394stream_t *
+dc1394_stream_open (const char * filename)
+{
+    const stream_file_header_t * header;
+    dc1394stream_t * s;
+    struct stat st;
+    int fd;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+        dc1394_log_error ("stream: could not open %s: %m", filename);
+        return NULL;
+    }
+    if (fstat (fd, &st) < 0 || st.st_size < BLOCK) {
+        dc1394_log_error ("stream: %s is not a stream", filename);
+        close (fd);
+        return NULL;
+    }
+
+    s = calloc (1, sizeof (dc1394stream_t));
+    if (!s) {
+        close (fd);
+        return NULL;
+    }
+    s->map_size = st.st_size;
+    s->map = mmap (NULL, s->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (s->map == MAP_FAILED) {
+        dc1394_log_error ("stream: could not map %s: %m", filename);
+        free (s);
+        return NULL;
+    }
+
+    header = (const stream_file_header_t *) s->map;
+    if (memcmp (header->magic, STREAM_FILE_MAGIC, sizeof (header->magic)) ||
+        header->version != STREAM_VERSION || header->block_size != BLOCK) {
+        dc1394_log_error ("stream: %s is not a stream or has an unsupported "
+                          "version", filename);
+        dc1394_stream_close (s);
+        return NULL;
+    }
+
+    if (load_index (s) < 0) {
+        dc1394_log_warning ("stream: %s has no index, scanning it", filename);
+        if (scan_frames (s) < 0) {
+            dc1394_stream_close (s);
+            return NULL;
+        }
+    }
+
+    return s;
+}
+
+void
+dc1394_stream_close (dc1394stream_t * s)
+{
+    if (!s)
+        return;
+    if (s->index_allocated)
+        free ((void *) s->index);
+    munmap (s->map, s->map_size);
+    free (s);
+}
+
+uint64_t
+dc1394_stream_get_num_frames (dc1394stream_t * s)
+{
+    return s ? s->num_frames : 0;
+}
+
+dc1394error_t
+dc1394_stream_get_frame (dc1394stream_t * s, uint64_t index,
+                         dc1394video_frame_t * frame)
+{
+    const stream_frame_header_t * h;
+    uint64_t offset;
+
+    if (!s || !frame || index >= s->num_frames)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    offset = s->index[index];
+    h = frame_header_at (s, offset);
+    if (!h) {
+        dc1394_log_error ("stream: frame %"PRIu64" is corrupted", index);
+        return DC1394_FAILURE;
+    }
+
+    stream_header_to_frame (frame, h);
+    frame->image = s->map + offset + BLOCK;
+
+    return DC1394_SUCCESS;
+}
@@ -0,0 +1,71 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Reading of recorded frame streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_STREAM_H__
+#define __DC1394_STREAM_H__
+
+/*! \file dc1394/stream.h
+    \brief Functions to read back the streams written by the recorder
+
+    The stream file is mapped in memory and frames are returned without
+    copying their payload. Frames are located through the index of the
+    file, so that accessing any frame takes the same time. Streams whose
+    recording was interrupted have no index: their frames are then found
+    by walking the file once when it is opened.
+*/
+
+#include <dc1394/log.h>
+
+/**
+ * A recorded stream opened for reading
+ */
+typedef struct __dc1394stream_t dc1394stream_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opens and maps a stream written by dc1394_recorder_new(). Returns NULL if the file is not a valid stream.
+ */
+dc1394stream_t * dc1394_stream_open (const char * filename);
+
+/**
+ * Unmaps and closes a stream. Frames obtained from it become invalid.
+ */
+void dc1394_stream_close (dc1394stream_t * stream);
+
+/**
+ * Returns the number of frames in the stream.
+ */
+uint64_t dc1394_stream_get_num_frames (dc1394stream_t * stream);
+
+/**
+ * Fills frame with the metadata of the given frame of the stream. The image points into the mapped file and
+ * must not be modified or freed; the camera member is NULL. This function may be called from several threads
+ * at once.
+ */
+dc1394error_t dc1394_stream_get_frame (dc1394stream_t * stream, uint64_t index, dc1394video_frame_t * frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,36 +26,211 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
 
 #include "usb/usb.h"
 
-/* Callback whenever a bulk transfer finishes. */
+#ifdef HAVE_LINUX
+#include <sys/eventfd.h>
+#endif
+
+/* The notification descriptor is only signalled when frames_ready goes
+   from 0 to 1 and only cleared when it drops back to 0, so a consumer that
+   keeps up costs one write and one read per frame and a consumer that lags
+   behind costs nothing extra. The count is atomic and there is no lock:
+   a signal that crosses a clear is caught by checking the count again
+   after clearing, and a stale one by clearing when woken with no frame. */
+static int
+notify_open (platform_camera_t * craw)
+{
+#ifdef HAVE_LINUX
+    int fd = eventfd (0, EFD_NONBLOCK);
+    if (fd < 0)
+        return -1;
+    craw->notify_fd[0] = craw->notify_fd[1] = fd;
+#else
+    if (pipe (craw->notify_fd) < 0)
+        return -1;
+    fcntl (craw->notify_fd[0], F_SETFL, O_NONBLOCK);
+#endif
+    return 0;
+}
+
+static void
+notify_close (platform_camera_t * craw)
+{
+    if (craw->notify_fd[0] >= 0)
+        close (craw->notify_fd[0]);
+    if (craw->notify_fd[1] >= 0 && craw->notify_fd[1] != craw->notify_fd[0])
+        close (craw->notify_fd[1]);
+    craw->notify_fd[0] = craw->notify_fd[1] = -1;
+}
+
+static void
+notify_signal (platform_camera_t * craw)
+{
+#ifdef HAVE_LINUX
+    uint64_t one = 1;
+    write (craw->notify_fd[1], &one, sizeof one);
+#else
+    write (craw->notify_fd[1], "+", 1);
+#endif
+}
+
+static void
+notify_clear (platform_camera_t * craw)
+{
+#ifdef HAVE_LINUX
+    uint64_t val;
+    read (craw->notify_fd[0], &val, sizeof val);
+#else
+    char buf[64];
+    while (read (craw->notify_fd[0], buf, sizeof buf) > 0);
+#endif
+}
+
+/* Clears the descriptor, then signals it again if a frame completed in
+   the meantime */
+static void
+notify_rearm (platform_camera_t * craw)
+{
+    notify_clear (craw);
+    if (__sync_fetch_and_add (&craw->frames_ready, 0) > 0)
+        notify_signal (craw);
+}
+
+/* Counts a completed frame; called from the helper thread */
+static void
+notify_frame_ready (platform_camera_t * craw)
+{
+    if (__sync_fetch_and_add (&craw->frames_ready, 1) == 0)
+        notify_signal (craw);
+}
+
+/* Uncounts a frame taken by the user and returns how many are left */
+static int
+notify_frame_taken (platform_camera_t * craw)
+{
+    int remaining = __sync_sub_and_fetch (&craw->frames_ready, 1);
+
+    if (remaining == 0)
+        notify_rearm (craw);
+    return remaining;
+}
+
+/* Frames are split into bulk transfers of at most this size by default, so
+   that the next transfer is already queued when one completes. The number
+   of transfers per frame is set with dc1394_capture_set_transfers(), or
+   else with the DC1394_USB_TRANSFERS environment variable. */
+#define USB_DEFAULT_TRANSFER_SIZE  (512 * 1024)
+
+/* Transfers are split on a multiple of the largest bulk packet size so that
+   only the last transfer of a frame may end with a short packet. */
+#define USB_TRANSFER_ALIGN         1024
+
+static uint32_t
+get_transfer_size (platform_camera_t * craw, uint64_t total_bytes)
+{
+    const char * env = getenv ("DC1394_USB_TRANSFERS");
+    uint64_t n = craw->transfers_per_frame, size;
+
+    if (n == 0 && env)
+        n = strtoul (env, NULL, 10);
+    if (n == 0)
+        n = (total_bytes + USB_DEFAULT_TRANSFER_SIZE - 1) /
+            USB_DEFAULT_TRANSFER_SIZE;
+    if (n == 0)
+        n = 1;
+
+    size = (total_bytes + n - 1) / n;
+    size = (size + USB_TRANSFER_ALIGN - 1) & ~(uint64_t)(USB_TRANSFER_ALIGN - 1);
+    return size;
+}
+
+static dc1394error_t
+submit_frame (struct usb_frame * f)
+{
+    int i;
+
+    f->status = BUFFER_EMPTY;
+    f->corrupt = 0;
+    f->resync = 0;
+    f->transfers_pending = f->num_transfers;
+    __sync_fetch_and_add (&f->pcam->frames_submitted, 1);
+    for (i = 0; i < f->num_transfers; i++) {
+        if (libusb_submit_transfer (f->transfers[i]) < 0) {
+            dc1394_log_error ("usb: Failed to submit transfer %d of frame %d",
+                    i, f->frame.id);
+            __sync_fetch_and_sub (&f->pcam->frames_submitted, 1);
+            return DC1394_FAILURE;
+        }
+    }
+    return DC1394_SUCCESS;
+}
+
+/* Callback whenever a bulk transfer finishes. The frame is complete once
+   all of its transfers are. A short packet ends a frame on the wire, so
+   when a transfer other than the last one ends short the rest of the frame
+   is cancelled: its transfers would read the start of the next frame and
+   every later frame would be shifted. The cancellation is asynchronous, so
+   a transfer may still take the start of the next frame before it stops;
+   that frame then comes out short as well, is marked corrupt and has the
+   rest of it cancelled in turn, until a frame starts on the boundary. */
 static void
 callback (struct libusb_transfer * transfer)
 {
     struct usb_frame * f = transfer->user_data;
     platform_camera_t * craw = f->pcam;
+    int i;
 
-    if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+    if (transfer->status == LIBUSB_TRANSFER_CANCELLED && !f->resync) {
         dc1394_log_warning ("usb: Bulk transfer %d cancelled", f->frame.id);
         return;
     }
 
-    if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED &&
+            transfer->status != LIBUSB_TRANSFER_CANCELLED)
         dc1394_log_error ("usb: Bulk transfer %d failed with code %d",
                 f->frame.id, transfer->status);
 
     dc1394_log_debug ("usb: Bulk transfer %d complete, %d of %d bytes",
             f->frame.id, transfer->actual_length, transfer->length);
-    int status = BUFFER_FILLED;
-    if (transfer->actual_length < transfer->length)
-        status = BUFFER_CORRUPT;
-    pthread_mutex_lock (&craw->mutex);
-    f->status = status;
-    craw->frames_ready++;
-    pthread_mutex_unlock (&craw->mutex);
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED ||
+            transfer->actual_length < transfer->length)
+        f->corrupt = 1;
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+            transfer->actual_length < transfer->length &&
+            f->transfers_pending > 1 && !f->resync) {
+        dc1394_log_debug ("usb: Short transfer in frame %d, dropping the "
+                "rest of it", f->frame.id);
+        f->resync = 1;
+        /* the transfers that already completed are simply not found */
+        for (i = 0; i < f->num_transfers; i++)
+            if (f->transfers[i] != transfer)
+                libusb_cancel_transfer (f->transfers[i]);
+    }
+
+    /* all callbacks run in the helper thread */
+    if (--f->transfers_pending > 0)
+        return;
 
-    write (craw->notify_pipe[1], "+", 1);
+    int status = f->corrupt ? BUFFER_CORRUPT : BUFFER_FILLED;
+
+    struct timeval filltime;
+    gettimeofday (&filltime, NULL);
+    f->frame.timestamp = (uint64_t) filltime.tv_sec * 1000000 +
+        filltime.tv_usec;
+
+    f->status = status;
+    // no transfer is left to receive the frames that follow
+    if (__sync_sub_and_fetch (&craw->frames_submitted, 1) == 0)
+        capture_stats_ring_overrun (craw->camera);
+    /* the atomic count orders the status before it */
+    notify_frame_ready (craw);
 }
 
 static void *
@@ -65,33 +240,46 @@ capture_thread (void * arg)
 
     dc1394_log_debug ("usb: Helper thread starting");
 
-    while (1) {
+    while (!craw->kill_thread) {
         struct timeval tv = {
             .tv_sec = 0,
             .tv_usec = 100000,
         };
         libusb_handle_events_timeout(craw->thread_context, &tv);
-        pthread_mutex_lock (&craw->mutex);
-        if (craw->kill_thread)
-            break;
-        pthread_mutex_unlock (&craw->mutex);
     }
-    pthread_mutex_unlock (&craw->mutex);
     dc1394_log_debug ("usb: Helper thread ending");
     return NULL;
 }
 
 static dc1394error_t
-init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto)
+init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto,
+        uint32_t transfer_size)
 {
     struct usb_frame *f = craw->frames + index;
+    uint64_t offset;
+    int i;
 
     memcpy (&f->frame, proto, sizeof f->frame);
     f->frame.image = craw->buffer + index * proto->total_bytes;
     f->frame.id = index;
-    f->transfer = libusb_alloc_transfer (0);
     f->pcam = craw;
     f->status = BUFFER_EMPTY;
+
+    f->num_transfers = (proto->total_bytes + transfer_size - 1) / transfer_size;
+    f->transfers = calloc (f->num_transfers, sizeof *f->transfers);
+    if (f->transfers == NULL)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+
+    for (i = 0, offset = 0; i < f->num_transfers; i++, offset += transfer_size) {
+        uint32_t len = transfer_size;
+        if (offset + len > proto->total_bytes)
+            len = proto->total_bytes - offset;
+        f->transfers[i] = libusb_alloc_transfer (0);
+        if (f->transfers[i] == NULL)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        libusb_fill_bulk_transfer (f->transfers[i], craw->thread_handle,
+                0x81, f->frame.image + offset, len, callback, f, 0);
+    }
     return DC1394_SUCCESS;
 }
 
@@ -100,6 +288,7 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         uint32_t flags)
 {
     dc1394video_frame_t proto;
+    uint32_t transfer_size;
     int i;
     dc1394camera_t * camera = craw->camera;
 
@@ -121,7 +310,8 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         return DC1394_FAILURE;
     }
 
-    if (pipe (craw->notify_pipe) < 0) {
+    if (notify_open (craw) < 0) {
+        dc1394_log_error ("usb: Failed to create the notification descriptor");
         dc1394_usb_capture_stop (craw);
         return DC1394_FAILURE;
     }
@@ -131,21 +321,8 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     craw->num_frames = num_dma_buffers;
     craw->current = -1;
     craw->frames_ready = 0;
+    craw->frames_submitted = 0;
     craw->buffer_size = proto.total_bytes * num_dma_buffers;
-    craw->buffer = malloc (craw->buffer_size);
-    if (craw->buffer == NULL) {
-        dc1394_usb_capture_stop (craw);
-        return DC1394_MEMORY_ALLOCATION_FAILURE;
-    }
-
-    craw->frames = calloc (num_dma_buffers, sizeof *craw->frames);
-    if (craw->frames == NULL) {
-        dc1394_usb_capture_stop (craw);
-        return DC1394_MEMORY_ALLOCATION_FAILURE;
-    }
-
-    for (i = 0; i < num_dma_buffers; i++)
-        init_frame(craw, i, &proto);
 
     if (libusb_init(&craw->thread_context) != 0) {
         dc1394_log_error ("usb: Failed to create thread USB context");
@@ -184,25 +361,42 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         return DC1394_FAILURE;
     }
 
-    for (i = 0; i < craw->num_frames; i++) {
-        struct usb_frame *f = craw->frames + i;
-        libusb_fill_bulk_transfer (f->transfer, craw->thread_handle,
-                0x81, f->frame.image, f->frame.total_bytes,
-                callback, f, 0);
+    /* Let the kernel map the buffers to the device when it can, which
+       saves a copy of every frame. */
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    craw->buffer = libusb_dev_mem_alloc (craw->thread_handle, craw->buffer_size);
+    if (craw->buffer != NULL)
+        craw->buffer_is_dev_mem = 1;
+#endif
+    if (craw->buffer == NULL)
+        craw->buffer = malloc (craw->buffer_size);
+    if (craw->buffer == NULL) {
+        dc1394_usb_capture_stop (craw);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
     }
+
+    craw->frames = calloc (num_dma_buffers, sizeof *craw->frames);
+    if (craw->frames == NULL) {
+        dc1394_usb_capture_stop (craw);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    transfer_size = get_transfer_size (craw, proto.total_bytes);
+    dc1394_log_debug ("usb: Transfer size is %u", transfer_size);
+    for (i = 0; i < num_dma_buffers; i++) {
+        if (init_frame(craw, i, &proto, transfer_size) != DC1394_SUCCESS) {
+            dc1394_usb_capture_stop (craw);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+    }
+
     for (i = 0; i < craw->num_frames; i++) {
-        if (libusb_submit_transfer (craw->frames[i].transfer) < 0) {
-            dc1394_log_error ("usb: Failed to submit initial transfer %d", i);
+        if (submit_frame (craw->frames + i) != DC1394_SUCCESS) {
             dc1394_usb_capture_stop (craw);
             return DC1394_FAILURE;
         }
     }
 
-    if (pthread_mutex_init (&craw->mutex, NULL) < 0) {
-        dc1394_usb_capture_stop (craw);
-        return DC1394_FAILURE;
-    }
-    craw->mutex_created = 1;
     if (pthread_create (&craw->thread, NULL, capture_thread, craw) < 0) {
         dc1394_log_error ("usb: Failed to launch helper thread");
         dc1394_usb_capture_stop (craw);
@@ -237,24 +431,23 @@ dc1394_usb_capture_stop(platform_camera_t *craw)
     }
 
     if (craw->thread_created) {
-#if 0
-        for (i = 0; i < craw->num_frames; i++) {
-            libusb_cancel_transfer (craw->frames[i].transfer);
-        }
-#endif
-        pthread_mutex_lock (&craw->mutex);
         craw->kill_thread = 1;
-        pthread_mutex_unlock (&craw->mutex);
         pthread_join (craw->thread, NULL);
         dc1394_log_debug ("usb: Joined with helper thread");
         craw->kill_thread = 0;
         craw->thread_created = 0;
     }
 
-    if (craw->mutex_created) {
-        pthread_mutex_destroy (&craw->mutex);
-        craw->mutex_created = 0;
+    if (craw->buffer_is_dev_mem) {
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+        libusb_dev_mem_free (craw->thread_handle, craw->buffer,
+                craw->buffer_size);
+#endif
+        craw->buffer_is_dev_mem = 0;
     }
+    else
+        free (craw->buffer);
+    craw->buffer = NULL;
 
     if (craw->thread_handle) {
         libusb_release_interface (craw->thread_handle, 0);
@@ -269,21 +462,17 @@ dc1394_usb_capture_stop(platform_camera_t *craw)
 
     if (craw->frames) {
         for (i = 0; i < craw->num_frames; i++) {
-            libusb_free_transfer (craw->frames[i].transfer);
+            struct usb_frame * f = craw->frames + i;
+            int j;
+            for (j = 0; f->transfers && j < f->num_transfers; j++)
+                libusb_free_transfer (f->transfers[j]);
+            free (f->transfers);
         }
         free (craw->frames);
         craw->frames = NULL;
     }
 
-    free (craw->buffer);
-    craw->buffer = NULL;
-
-    if (craw->notify_pipe[0] != 0 || craw->notify_pipe[1] != 0) {
-        close (craw->notify_pipe[0]);
-        close (craw->notify_pipe[1]);
-    }
-    craw->notify_pipe[0] = 0;
-    craw->notify_pipe[1] = 0;
+    notify_close (craw);
 
     craw->capture_is_set = 0;
 
@@ -307,26 +496,50 @@ dc1394_usb_capture_dequeue (platform_camera_t * craw,
     *frame_return = NULL;
 
     if (policy == DC1394_CAPTURE_POLICY_POLL) {
-        int status;
-        pthread_mutex_lock (&craw->mutex);
-        status = f->status;
-        pthread_mutex_unlock (&craw->mutex);
-        if (status != BUFFER_FILLED && status != BUFFER_CORRUPT)
+        if (craw->frames_ready == 0) {
+            // a caller polling the descriptor must not be woken again
+            notify_rearm (craw);
             return DC1394_SUCCESS;
+        }
     }
+    else {
+        struct pollfd fds[1];
+        fds[0].fd = craw->notify_fd[0];
+        fds[0].events = POLLIN;
+        while (craw->frames_ready == 0) {
+            if (poll (fds, 1, -1) < 0 && errno != EINTR) {
+                dc1394_log_error ("usb: poll() failed: %m");
+                return DC1394_FAILURE;
+            }
+            // a signal left over from a frame already taken
+            if (craw->frames_ready == 0)
+                notify_rearm (craw);
+        }
+    }
+    __sync_synchronize ();
 
-    char ch;
-    read (craw->notify_pipe[0], &ch, 1);
-
-    pthread_mutex_lock (&craw->mutex);
     if (f->status != BUFFER_FILLED && f->status != BUFFER_CORRUPT) {
         dc1394_log_error ("usb: Expected filled buffer");
-        pthread_mutex_unlock (&craw->mutex);
         return DC1394_FAILURE;
     }
-    craw->frames_ready--;
-    f->frame.frames_behind = craw->frames_ready;
-    pthread_mutex_unlock (&craw->mutex);
+
+    /* LATEST policy: resubmit the stale buffers and move on to the newest
+     * completed one. */
+    while (policy == DC1394_CAPTURE_POLICY_LATEST && craw->frames_ready > 1) {
+        dc1394error_t err;
+
+        notify_frame_taken (craw);
+        craw->current = next;
+        err = submit_frame (f);
+        if (err != DC1394_SUCCESS)
+            return err;
+        capture_stats_frames_dropped (craw->camera, 1);
+
+        next = NEXT_BUFFER (craw, next);
+        f = craw->frames + next;
+    }
+
+    f->frame.frames_behind = notify_frame_taken (craw);
 
     craw->current = next;
 
@@ -352,19 +565,24 @@ dc1394_usb_capture_enqueue (platform_camera_t * craw,
         return DC1394_FAILURE;
     }
 
-    f->status = BUFFER_EMPTY;
-    libusb_submit_transfer (f->transfer);
+    return submit_frame (f);
+}
 
+dc1394error_t
+dc1394_usb_capture_set_transfers (platform_camera_t * craw,
+        uint32_t num_transfers)
+{
+    craw->transfers_per_frame = num_transfers;
     return DC1394_SUCCESS;
 }
 
 int
 dc1394_usb_capture_get_fileno (platform_camera_t * craw)
 {
-    if (craw->notify_pipe[0] == 0 && craw->notify_pipe[1] == 0)
+    if (!craw->capture_is_set)
         return -1;
 
-    return craw->notify_pipe[0];
+    return craw->notify_fd[0];
 }
 
 dc1394bool_t
@@ -24,6 +24,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "config.h"
 #include "platform.h"
@@ -87,6 +91,91 @@ is_device_iidc (uint16_t vendor, uint16_t product)
     return 0;
 }
 
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+static int
+hotplug_callback (libusb_context * context, libusb_device * dev,
+        libusb_hotplug_event event, void * arg)
+{
+    platform_t * p = arg;
+    struct libusb_device_descriptor desc;
+
+    if (libusb_get_device_descriptor (dev, &desc) == 0 &&
+        is_device_iidc (desc.idVendor, desc.idProduct)) {
+        dc1394_log_debug ("usb: Device %x:%x %s", desc.idVendor,
+                desc.idProduct, event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED ?
+                "arrived" : "left");
+        if (write (p->hotplug_pipe[1], "", 1) < 0)
+            dc1394_log_debug ("usb: Hotplug notification lost");
+    }
+    return 0;
+}
+
+static void *
+hotplug_thread (void * arg)
+{
+    platform_t * p = arg;
+    struct timeval tv = { 0, 100000 };
+
+    /* Control transfers made meanwhile handle events too, which libusb
+       serializes */
+    while (!p->hotplug_stop)
+        libusb_handle_events_timeout_completed (p->context, &tv, NULL);
+    return NULL;
+}
+
+static int
+dc1394_usb_monitor_start (platform_t * p)
+{
+    if (!libusb_has_capability (LIBUSB_CAP_HAS_HOTPLUG))
+        return -1;
+    if (pipe (p->hotplug_pipe) < 0)
+        return -1;
+    fcntl (p->hotplug_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl (p->hotplug_pipe[1], F_SETFL, O_NONBLOCK);
+
+    if (libusb_hotplug_register_callback (p->context,
+                LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+                LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, LIBUSB_HOTPLUG_NO_FLAGS,
+                LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback, p,
+                &p->hotplug_handle) != 0)
+        goto fail;
+    p->hotplug_stop = 0;
+    if (pthread_create (&p->hotplug_thread, NULL, hotplug_thread, p) != 0) {
+        libusb_hotplug_deregister_callback (p->context, p->hotplug_handle);
+        goto fail;
+    }
+    return p->hotplug_pipe[0];
+
+ fail:
+    dc1394_log_warning ("usb: Failed to register for hotplug events");
+    close (p->hotplug_pipe[0]);
+    close (p->hotplug_pipe[1]);
+    return -1;
+}
+
+static void
+dc1394_usb_monitor_stop (platform_t * p)
+{
+    p->hotplug_stop = 1;
+    pthread_join (p->hotplug_thread, NULL);
+    libusb_hotplug_deregister_callback (p->context, p->hotplug_handle);
+    close (p->hotplug_pipe[0]);
+    close (p->hotplug_pipe[1]);
+}
+
+static int
+dc1394_usb_monitor_changed (platform_t * p)
+{
+    char buf[16];
+    int changed = 0;
+
+    while (read (p->hotplug_pipe[0], buf, sizeof (buf)) > 0)
+        changed = 1;
+    return changed;
+}
+#endif
+
 static platform_device_list_t *
 dc1394_usb_get_device_list (platform_t * p)
 {
@@ -269,6 +358,7 @@ dc1394_usb_camera_new (platform_t * p, platform_device_t * device,
 
     camera = calloc (1, sizeof (platform_camera_t));
     camera->handle = handle;
+    camera->notify_fd[0] = camera->notify_fd[1] = -1;
     return camera;
 }
 
@@ -357,6 +447,11 @@ usb_dispatch = {
     .get_device_list = dc1394_usb_get_device_list,
     .free_device_list = dc1394_usb_free_device_list,
     .device_get_config_rom = dc1394_usb_device_get_config_rom,
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+    .monitor_start = dc1394_usb_monitor_start,
+    .monitor_stop = dc1394_usb_monitor_stop,
+    .monitor_changed = dc1394_usb_monitor_changed,
+#endif
 
     .camera_new = dc1394_usb_camera_new,
     .camera_free = dc1394_usb_camera_free,
@@ -375,6 +470,7 @@ usb_dispatch = {
     .capture_enqueue = dc1394_usb_capture_enqueue,
     .capture_get_fileno = dc1394_usb_capture_get_fileno,
     .capture_is_frame_corrupt = dc1394_usb_capture_is_frame_corrupt,
+    .capture_set_transfers = dc1394_usb_capture_set_transfers,
 };
 
 void
@@ -31,6 +31,15 @@
 
 struct _platform_t {
     libusb_context *context;
+
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+    /* hotplug: a thread handles the events of the context, and the
+       callback writes to the pipe */
+    libusb_hotplug_callback_handle hotplug_handle;
+    pthread_t hotplug_thread;
+    volatile int hotplug_stop;
+    int hotplug_pipe[2];
+#endif
 };
 
 struct _platform_camera_t {
@@ -40,21 +49,25 @@ struct _platform_camera_t {
     struct usb_frame        * frames;
     unsigned char        * buffer;
     size_t buffer_size;
+    int buffer_is_dev_mem;
     uint32_t flags;
     unsigned int num_frames;
     int current;
-    int frames_ready;
+    /* updated atomically by the helper thread and the user */
+    volatile int frames_ready;
+    volatile int frames_submitted;  /* the bulk transfers have a buffer */
+    uint32_t transfers_per_frame;   /* 0 for the default */
 
     uint8_t bus;
     uint8_t addr;
-    int notify_pipe[2];
+    /* readable while frames_ready > 0: an eventfd (both entries are the
+       same descriptor) or the two ends of a pipe */
+    int notify_fd[2];
     pthread_t thread;
     int thread_created;
-    pthread_mutex_t mutex;
-    int mutex_created;
     libusb_context *thread_context;
     libusb_device_handle *thread_handle;
-    int kill_thread;
+    volatile int kill_thread;
 
     int capture_is_set;
     int iso_auto_started;
@@ -68,9 +81,13 @@ typedef enum {
 
 struct usb_frame {
     dc1394video_frame_t frame;
-    struct libusb_transfer * transfer;
+    struct libusb_transfer ** transfers;
+    int num_transfers;
+    int transfers_pending;
+    int corrupt;
+    int resync;                 /* the rest of the frame was cancelled */
     platform_camera_t * pcam;
-    usb_frame_status status;
+    volatile usb_frame_status status;
 };
 
 
@@ -92,6 +109,10 @@ dc1394_usb_capture_enqueue (platform_camera_t * craw,
 int
 dc1394_usb_capture_get_fileno (platform_camera_t * craw);
 
+dc1394error_t
+dc1394_usb_capture_set_transfers (platform_camera_t * craw,
+        uint32_t num_transfers);
+
 dc1394bool_t
 dc1394_usb_capture_is_frame_corrupt (platform_camera_t * craw,
         dc1394video_frame_t * frame);
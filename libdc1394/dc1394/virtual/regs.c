@@ -0,0 +1,495 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Register model of virtual cameras
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "virtual.h"
+#include "utils.h"
+#include "log.h"
+
+/* Appends a textual leaf to the ROM and returns its quadlet index */
+static int
+rom_add_leaf (vcam_regs_t * r, const char * text)
+{
+    int len = strlen (text);
+    int quads = (len + 3) / 4;
+    int leaf = r->rom_quads;
+    int i;
+
+    if (leaf + 3 + quads > VCAM_ROM_QUADS)
+        return -1;
+    r->rom[leaf] = (2 + quads) << 16;
+    r->rom[leaf + 1] = 0;
+    r->rom[leaf + 2] = 0;
+    for (i = 0; i < 4 * quads; i++) {
+        uint32_t c = i < len ? (unsigned char) text[i] : 0;
+        r->rom[leaf + 3 + i / 4] |= c << (24 - 8 * (i % 4));
+    }
+    r->rom_quads += 3 + quads;
+    return leaf;
+}
+
+void
+vcam_regs_init (vcam_regs_t * r, uint64_t guid, uint32_t vendor_id,
+        const char * vendor, const char * model)
+{
+    int unit, dep, leaf;
+
+    memset (r, 0, sizeof (vcam_regs_t));
+
+    /* bus info block */
+    r->rom[0] = 0x04 << 24;
+    r->rom[1] = 0x31333934;           /* "1394" */
+    r->rom[2] = 0;
+    r->rom[3] = guid >> 32;
+    r->rom[4] = guid & 0xffffffff;
+
+    /* root directory: vendor ID and a unit directory at quadlet 9 */
+    unit = 9;
+    r->rom[5] = 2 << 16;
+    r->rom[6] = (0x03 << 24) | (vendor_id & 0xffffff);
+    r->rom[7] = (0xD1 << 24) | (unit - 7);
+
+    /* unit directory: IIDC 1.31, unit dependent directory at quadlet 14 */
+    dep = unit + 5;
+    r->rom[unit] = 4 << 16;
+    r->rom[unit + 1] = (0x12 << 24) | 0xA02D;
+    r->rom[unit + 2] = (0x13 << 24) | 0x102;
+    r->rom[unit + 3] = (0x17 << 24) | 0x1;
+    r->rom[unit + 4] = (0xD4 << 24) | (dep - (unit + 4));
+
+    /* unit dependent directory: command registers and the name leaves */
+    r->rom[dep] = 4 << 16;
+    r->rom[dep + 1] = (0x40 << 24) | (VCAM_COMMAND_BASE / 4);
+    r->rom[dep + 2] = (0x38 << 24) | 0x10;
+    r->rom_quads = dep + 5;
+    leaf = rom_add_leaf (r, vendor);
+    r->rom[dep + 3] = (0x81 << 24) | (leaf >= 0 ? leaf - (dep + 3) : 0);
+    leaf = rom_add_leaf (r, model);
+    r->rom[dep + 4] = (0x82 << 24) | (leaf >= 0 ? leaf - (dep + 4) : 0);
+
+    /* command registers that don't depend on the video mode */
+    VCAM_REG (r, REG_CAMERA_BASIC_FUNC_INQ) = 0x00008000;   /* power */
+    VCAM_REG (r, REG_CAMERA_ISO_DATA) = DC1394_ISO_SPEED_400 << 24;
+    VCAM_REG (r, REG_CAMERA_POWER) = 0x80000000;
+}
+
+static dc1394error_t
+mode_to_index (dc1394video_mode_t mode, uint32_t * format_index,
+        uint32_t * mode_index)
+{
+    uint32_t format, min;
+    dc1394error_t err;
+
+    err = get_format_from_mode (mode, &format);
+    DC1394_ERR_RTN (err, "Invalid video mode");
+
+    switch (format) {
+    case DC1394_FORMAT0:
+        min = DC1394_VIDEO_MODE_FORMAT0_MIN;
+        break;
+    case DC1394_FORMAT1:
+        min = DC1394_VIDEO_MODE_FORMAT1_MIN;
+        break;
+    case DC1394_FORMAT2:
+        min = DC1394_VIDEO_MODE_FORMAT2_MIN;
+        break;
+    case DC1394_FORMAT6:
+        min = DC1394_VIDEO_MODE_FORMAT6_MIN;
+        break;
+    default:
+        min = DC1394_VIDEO_MODE_FORMAT7_MIN;
+        break;
+    }
+    *format_index = format - DC1394_FORMAT_MIN;
+    *mode_index = mode - min;
+    return DC1394_SUCCESS;
+}
+
+/* Advertises a fixed video mode with the given set of frame rates, bit i
+   standing for DC1394_FRAMERATE_MIN + i */
+dc1394error_t
+vcam_regs_add_mode (vcam_regs_t * r, dc1394video_mode_t mode,
+        uint32_t framerates)
+{
+    uint32_t format_index, mode_index, i;
+    dc1394error_t err;
+
+    err = mode_to_index (mode, &format_index, &mode_index);
+    DC1394_ERR_RTN (err, "Invalid video mode");
+
+    VCAM_REG (r, REG_CAMERA_V_FORMAT_INQ) |= 1U << (31 - format_index);
+    VCAM_REG (r, REG_CAMERA_V_MODE_INQ_BASE + format_index * 4) |=
+        1U << (31 - mode_index);
+    for (i = 0; i < DC1394_FRAMERATE_NUM; i++)
+        if (framerates & (1 << i))
+            VCAM_REG (r, REG_CAMERA_V_RATE_INQ_BASE + format_index * 0x20 +
+                    mode_index * 4) |= 1U << (31 - i);
+    return DC1394_SUCCESS;
+}
+
+static const uint32_t format7_requests[4] = {
+    REG_CAMERA_FORMAT7_IMAGE_POSITION,
+    REG_CAMERA_FORMAT7_IMAGE_SIZE,
+    REG_CAMERA_FORMAT7_COLOR_CODING_ID,
+    REG_CAMERA_FORMAT7_BYTE_PER_PACKET,
+};
+
+/* Applies the requested image position, size, color coding and packet
+   size of a Format_7 mode and recomputes the registers that follow from
+   them. An invalid region raises error flag 1 and is rolled back to the
+   last valid one; an invalid packet size raises error flag 2 and is
+   replaced by the maximum. */
+static void
+format7_update (vcam_regs_t * r, uint32_t m)
+{
+    uint32_t max = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_MAX_IMAGE_SIZE_INQ);
+    uint32_t unit = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_UNIT_SIZE_INQ);
+    uint32_t upos = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_UNIT_POSITION_INQ);
+    uint32_t pos = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_IMAGE_POSITION);
+    uint32_t size = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_IMAGE_SIZE);
+    uint32_t coding = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_COLOR_CODING_ID) >> 24;
+    uint32_t codings = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_COLOR_CODING_INQ);
+    uint32_t packet = VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_BYTE_PER_PACKET) >> 16;
+    uint32_t * setting = &VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_VALUE_SETTING);
+    uint32_t width = size >> 16, height = size & 0xffff;
+    uint32_t left = pos >> 16, top = pos & 0xffff;
+    uint32_t unit_bytes = 4, max_bytes = 4096;
+    uint32_t bits, depth, packets, i;
+    uint64_t image_bytes;
+    float interval;
+
+    *setting &= ~(VCAM_F7_ERROR_FLAG_1 | VCAM_F7_ERROR_FLAG_2);
+
+    if (width == 0 || height == 0 ||
+        width % (unit >> 16) || height % (unit & 0xffff) ||
+        left % (upos >> 16) || top % (upos & 0xffff) ||
+        left + width > (max >> 16) || top + height > (max & 0xffff) ||
+        coding >= 32 || !(codings & (1U << (31 - coding))) ||
+        dc1394_get_color_coding_bit_size (coding + DC1394_COLOR_CODING_MIN,
+                &bits) != DC1394_SUCCESS) {
+        *setting |= VCAM_F7_ERROR_FLAG_1;
+        for (i = 0; i < 4; i++)
+            VCAM_F7_REG (r, m, format7_requests[i]) = r->format7_applied[m][i];
+        return;
+    }
+
+    if (packet == 0 || packet > max_bytes || packet % unit_bytes) {
+        *setting |= VCAM_F7_ERROR_FLAG_2;
+        packet = max_bytes;
+    }
+
+    image_bytes = (uint64_t) width * height * bits / 8;
+    packets = (image_bytes + packet - 1) / packet;
+    dc1394_get_color_coding_data_depth (coding + DC1394_COLOR_CODING_MIN,
+            &depth);
+    interval = packets / 8000.0;
+
+    VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_PIXEL_NUMBER_INQ) = width * height;
+    VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_PACKET_PARA_INQ) =
+        (unit_bytes << 16) | max_bytes;
+    VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_BYTE_PER_PACKET) =
+        (packet << 16) | max_bytes;
+    VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_PACKET_PER_FRAME_INQ) = packets;
+    VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_TOTAL_BYTES_HI_INQ) =
+        ((uint64_t) packets * packet) >> 32;
+    VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_TOTAL_BYTES_LO_INQ) =
+        ((uint64_t) packets * packet) & 0xffffffff;
+    VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_DATA_DEPTH_INQ) = depth << 24;
+    memcpy (&VCAM_F7_REG (r, m, REG_CAMERA_FORMAT7_FRAME_INTERVAL_INQ),
+            &interval, sizeof (uint32_t));
+
+    for (i = 0; i < 4; i++)
+        r->format7_applied[m][i] = VCAM_F7_REG (r, m, format7_requests[i]);
+}
+
+/* Advertises a scalable video mode. Its image covers the whole sensor and
+   uses the first of the given color codings (bit i standing for
+   DC1394_COLOR_CODING_MIN + i) until the user sets another region. */
+dc1394error_t
+vcam_regs_add_format7 (vcam_regs_t * r, dc1394video_mode_t mode,
+        uint32_t max_width, uint32_t max_height, uint32_t unit,
+        uint32_t color_codings, dc1394color_filter_t filter)
+{
+    uint32_t format_index, mode_index, i, first = 0;
+    dc1394error_t err;
+
+    err = mode_to_index (mode, &format_index, &mode_index);
+    DC1394_ERR_RTN (err, "Invalid video mode");
+    if (format_index != DC1394_FORMAT7 - DC1394_FORMAT_MIN || !color_codings)
+        return DC1394_INVALID_VIDEO_MODE;
+
+    VCAM_REG (r, REG_CAMERA_V_FORMAT_INQ) |= 1U << (31 - format_index);
+    VCAM_REG (r, REG_CAMERA_V_MODE_INQ_BASE + format_index * 4) |=
+        1U << (31 - mode_index);
+    VCAM_REG (r, REG_CAMERA_V_CSR_INQ_BASE + mode_index * 4) =
+        (VCAM_FORMAT7_BASE + mode_index * VCAM_FORMAT7_SIZE) / 4;
+
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_COLOR_CODING_INQ) = 0;
+    for (i = DC1394_COLOR_CODING_NUM; i-- > 0; )
+        if (color_codings & (1 << i)) {
+            VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_COLOR_CODING_INQ) |=
+                1U << (31 - i);
+            first = i;
+        }
+
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_MAX_IMAGE_SIZE_INQ) =
+        (max_width << 16) | max_height;
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_UNIT_SIZE_INQ) =
+        (unit << 16) | unit;
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_UNIT_POSITION_INQ) =
+        (unit << 16) | unit;
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_IMAGE_POSITION) = 0;
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_IMAGE_SIZE) =
+        (max_width << 16) | max_height;
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_COLOR_CODING_ID) =
+        first << 24;
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_BYTE_PER_PACKET) = 4096 << 16;
+    if (filter >= DC1394_COLOR_FILTER_MIN)
+        VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_COLOR_FILTER_ID) =
+            (filter - DC1394_COLOR_FILTER_MIN) << 24;
+    VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_VALUE_SETTING) =
+        VCAM_F7_PRESENCE;
+    format7_update (r, mode_index);
+
+    return DC1394_SUCCESS;
+}
+
+/* Returns the register of a feature in the block starting at base, which
+   is one of the inquiry (0x500), absolute CSR (0x700) or value (0x800)
+   blocks; the features from zoom on live 0x80 further. */
+uint32_t *
+vcam_regs_feature (vcam_regs_t * r, dc1394feature_t feature, uint32_t base)
+{
+    uint32_t slot;
+
+    if (feature < DC1394_FEATURE_MIN || feature > DC1394_FEATURE_MAX)
+        return NULL;
+    if (feature < DC1394_FEATURE_ZOOM)
+        return &VCAM_REG (r, base + (feature - DC1394_FEATURE_MIN) * 4);
+    slot = feature - DC1394_FEATURE_ZOOM;
+    if (feature >= DC1394_FEATURE_CAPTURE_SIZE)
+        slot += 12;
+    return &VCAM_REG (r, base + 0x80 + slot * 4);
+}
+
+/* Advertises a feature with the given inquiry and initial control
+   register values; the presence bits are added. */
+dc1394error_t
+vcam_regs_add_feature (vcam_regs_t * r, dc1394feature_t feature,
+        uint32_t inquiry, uint32_t value)
+{
+    uint32_t * inq = vcam_regs_feature (r, feature, REG_CAMERA_FEATURE_HI_BASE_INQ);
+    uint32_t slot;
+
+    if (!inq)
+        return DC1394_INVALID_FEATURE;
+
+    if (feature < DC1394_FEATURE_ZOOM) {
+        slot = feature - DC1394_FEATURE_MIN;
+        VCAM_REG (r, REG_CAMERA_FEATURE_HI_INQ) |= 0x80000000U >> slot;
+    }
+    else {
+        slot = feature - DC1394_FEATURE_ZOOM;
+        if (feature >= DC1394_FEATURE_CAPTURE_SIZE)
+            slot += 12;
+        VCAM_REG (r, REG_CAMERA_FEATURE_LO_INQ) |= 0x80000000U >> slot;
+    }
+    *inq = inquiry | VCAM_FEATURE_PRESENCE;
+    *vcam_regs_feature (r, feature, REG_CAMERA_FEATURE_HI_BASE) =
+        value | VCAM_FEATURE_PRESENCE;
+    return DC1394_SUCCESS;
+}
+
+/* Gives a feature that was added an absolute value CSR */
+dc1394error_t
+vcam_regs_add_absolute (vcam_regs_t * r, dc1394feature_t feature,
+        float min, float max, float value)
+{
+    uint32_t * inq = vcam_regs_feature (r, feature, REG_CAMERA_FEATURE_HI_BASE_INQ);
+    uint32_t csr = VCAM_ABSOLUTE_BASE +
+        (feature - DC1394_FEATURE_MIN) * VCAM_ABSOLUTE_SIZE;
+    uint32_t offset = csr - VCAM_COMMAND_BASE;
+
+    if (!inq || !(*inq & VCAM_FEATURE_PRESENCE))
+        return DC1394_INVALID_FEATURE;
+
+    *inq |= VCAM_FEATURE_ABSOLUTE;
+    *vcam_regs_feature (r, feature, REG_CAMERA_FEATURE_ABS_HI_BASE) = csr / 4;
+    memcpy (&VCAM_REG (r, offset + REG_CAMERA_ABS_MIN), &min, sizeof (float));
+    memcpy (&VCAM_REG (r, offset + REG_CAMERA_ABS_MAX), &max, sizeof (float));
+    memcpy (&VCAM_REG (r, offset + REG_CAMERA_ABS_VALUE), &value, sizeof (float));
+    return DC1394_SUCCESS;
+}
+
+/* Makes a video mode and frame rate the current ones */
+dc1394error_t
+vcam_regs_select_mode (vcam_regs_t * r, dc1394video_mode_t mode,
+        dc1394framerate_t framerate)
+{
+    uint32_t format_index, mode_index;
+    dc1394error_t err;
+
+    err = mode_to_index (mode, &format_index, &mode_index);
+    DC1394_ERR_RTN (err, "Invalid video mode");
+
+    VCAM_REG (r, REG_CAMERA_VIDEO_FORMAT) = format_index << 29;
+    VCAM_REG (r, REG_CAMERA_VIDEO_MODE) = mode_index << 29;
+    if (format_index != DC1394_FORMAT7 - DC1394_FORMAT_MIN)
+        VCAM_REG (r, REG_CAMERA_FRAME_RATE) =
+            (framerate - DC1394_FRAMERATE_MIN) << 29;
+    return DC1394_SUCCESS;
+}
+
+/* Makes the layout of the given frame the one and only video mode */
+dc1394error_t
+vcam_regs_set_mode (vcam_regs_t * r, const dc1394video_frame_t * proto,
+        dc1394framerate_t framerate)
+{
+    dc1394video_mode_t mode = proto->video_mode;
+    uint32_t format_index, mode_index;
+    dc1394error_t err;
+
+    err = mode_to_index (mode, &format_index, &mode_index);
+    DC1394_ERR_RTN (err, "Invalid video mode");
+
+    if (format_index != DC1394_FORMAT7 - DC1394_FORMAT_MIN) {
+        err = vcam_regs_add_mode (r, mode, 1 << (framerate - DC1394_FRAMERATE_MIN));
+        DC1394_ERR_RTN (err, "Could not add the video mode");
+    }
+    else {
+        // a single region covering the recorded image
+        err = vcam_regs_add_format7 (r, mode,
+                proto->size[0] + proto->position[0],
+                proto->size[1] + proto->position[1], 1,
+                1 << (proto->color_coding - DC1394_COLOR_CODING_MIN),
+                proto->color_filter);
+        DC1394_ERR_RTN (err, "Could not add the video mode");
+        VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_IMAGE_POSITION) =
+            (proto->position[0] << 16) | proto->position[1];
+        VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_IMAGE_SIZE) =
+            (proto->size[0] << 16) | proto->size[1];
+        VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_BYTE_PER_PACKET) =
+            proto->packet_size << 16;
+        format7_update (r, mode_index);
+        VCAM_F7_REG (r, mode_index, REG_CAMERA_FORMAT7_DATA_DEPTH_INQ) =
+            proto->data_depth << 24;
+    }
+    VCAM_REG (r, REG_CAMERA_DATA_DEPTH) = proto->data_depth << 24;
+
+    return vcam_regs_select_mode (r, mode, framerate);
+}
+
+static uint32_t *
+vcam_reg_at (vcam_regs_t * r, uint64_t offset, int * writable)
+{
+    *writable = 0;
+    if (offset % 4)
+        return NULL;
+    if (offset >= VCAM_ROM_OFFSET &&
+        offset < VCAM_ROM_OFFSET + 4 * VCAM_ROM_QUADS)
+        return r->rom + (offset - VCAM_ROM_OFFSET) / 4;
+    if (offset >= VCAM_COMMAND_BASE &&
+        offset < VCAM_COMMAND_BASE + VCAM_REGS_SIZE) {
+        *writable = 1;
+        return r->regs + (offset - VCAM_COMMAND_BASE) / 4;
+    }
+    return NULL;
+}
+
+dc1394error_t
+vcam_regs_read (vcam_regs_t * r, uint64_t offset, uint32_t * quads,
+        int num_quads)
+{
+    int i, writable;
+
+    for (i = 0; i < num_quads; i++) {
+        uint32_t * reg = vcam_reg_at (r, offset + 4 * i, &writable);
+        if (!reg)
+            return DC1394_FAILURE;
+        quads[i] = *reg;
+    }
+    return DC1394_SUCCESS;
+}
+
+/* Applies the side effects a write has on a real camera */
+static void
+vcam_regs_written (vcam_regs_t * r, uint32_t offset, uint32_t old)
+{
+    uint32_t * reg = &VCAM_REG (r, offset);
+
+    if (offset >= VCAM_COMMAND_SIZE &&
+        offset < VCAM_COMMAND_SIZE + 8 * VCAM_FORMAT7_SIZE) {
+        uint32_t m = (offset - VCAM_COMMAND_SIZE) / VCAM_FORMAT7_SIZE;
+        switch ((offset - VCAM_COMMAND_SIZE) % VCAM_FORMAT7_SIZE) {
+        case REG_CAMERA_FORMAT7_VALUE_SETTING:
+            // the request is applied at once: setting_1 reads back as 0
+            if ((*reg & VCAM_F7_SETTING_1) && (old & VCAM_F7_PRESENCE)) {
+                *reg = old;
+                format7_update (r, m);
+            }
+            else
+                *reg = old;
+            break;
+        case REG_CAMERA_FORMAT7_IMAGE_POSITION:
+        case REG_CAMERA_FORMAT7_IMAGE_SIZE:
+        case REG_CAMERA_FORMAT7_COLOR_CODING_ID:
+        case REG_CAMERA_FORMAT7_BYTE_PER_PACKET:
+            // requests wait for the value setting handshake
+            break;
+        default:
+            // inquiry registers are read only
+            *reg = old;
+            break;
+        }
+    }
+    else if (offset >= VCAM_ABSOLUTE_BASE - VCAM_COMMAND_BASE) {
+        // only the value of an absolute CSR can be written
+        if ((offset - (VCAM_ABSOLUTE_BASE - VCAM_COMMAND_BASE)) %
+                VCAM_ABSOLUTE_SIZE != REG_CAMERA_ABS_VALUE)
+            *reg = old;
+    }
+    else if ((offset >= REG_CAMERA_FEATURE_HI_BASE &&
+              offset < REG_CAMERA_FEATURE_LO_BASE + 0x80)) {
+        // one-push operations complete immediately
+        *reg = (*reg & ~0x04000000) | (old & VCAM_FEATURE_PRESENCE);
+    }
+    else if (offset < REG_CAMERA_FRAME_RATE) {
+        *reg = old;
+    }
+}
+
+dc1394error_t
+vcam_regs_write (vcam_regs_t * r, uint64_t offset, const uint32_t * quads,
+        int num_quads)
+{
+    int i, writable;
+
+    for (i = 0; i < num_quads; i++) {
+        uint32_t * reg = vcam_reg_at (r, offset + 4 * i, &writable);
+        uint32_t old;
+        if (!reg || !writable)
+            return DC1394_FAILURE;
+        old = *reg;
+        *reg = quads[i];
+        vcam_regs_written (r, (reg - r->regs) * 4, old);
+    }
+    return DC1394_SUCCESS;
+}
@@ -0,0 +1,518 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Replay platform: recorded streams presented as cameras
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+  The streams to replay are given as a colon separated list of files in the
+  DC1394_REPLAY environment variable; each of them becomes one camera. Frames
+  are served at the pace they were recorded at, relative to the moment the
+  transmission is switched on, unless DC1394_REPLAY_TIMING is set to "fast"
+  in which case they are available as soon as a buffer is free. Streams are
+  looped when their end is reached.
+*/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "virtual.h"
+#include "platform.h"
+#include "control.h"
+#include "video.h"
+#include "log.h"
+
+#define REPLAY_VENDOR_ID   0x00d139
+
+struct _platform_t {
+    char                     * files;
+    char                    ** names;
+    int                        num_names;
+    int                        fast;
+};
+
+struct _platform_device_t {
+    char                     * filename;
+    vcam_regs_t                regs;
+};
+
+struct _platform_camera_t {
+    dc1394camera_t           * camera;
+    char                     * filename;
+    dc1394stream_t           * stream;
+    vcam_regs_t                regs;
+    int                        fast;
+    dc1394video_mode_t         video_mode;
+
+    uint64_t                   num_frames;
+    uint64_t                   first_timestamp;
+    uint64_t                   period;          /* duration of one loop */
+
+    int                        iso_on;
+    uint64_t                   start_time;
+    uint64_t                   position;        /* next frame to serve, counted across loops */
+
+    int                        capture_is_set;
+    int                        iso_auto_started;
+    vcam_ring_t                ring;
+};
+
+static platform_t *
+replay_new (void)
+{
+    const char * env = getenv ("DC1394_REPLAY");
+    const char * timing = getenv ("DC1394_REPLAY_TIMING");
+    platform_t * p;
+    char * s;
+
+    if (!env || !*env)
+        return NULL;
+
+    p = calloc (1, sizeof (platform_t));
+    if (!p)
+        return NULL;
+    p->files = strdup (env);
+    p->names = calloc (strlen (env) / 2 + 1, sizeof (char *));
+    if (!p->files || !p->names) {
+        free (p->files);
+        free (p->names);
+        free (p);
+        return NULL;
+    }
+    for (s = strtok (p->files, ":"); s; s = strtok (NULL, ":"))
+        p->names[p->num_names++] = s;
+    p->fast = timing && !strcmp (timing, "fast");
+
+    dc1394_log_debug ("Replay: %d stream(s), %s timing", p->num_names,
+            p->fast ? "fast" : "recorded");
+    return p;
+}
+
+static void
+replay_free (platform_t * p)
+{
+    free (p->names);
+    free (p->files);
+    free (p);
+}
+
+/* Picks the IIDC frame rate closest to the mean interval of the stream */
+static dc1394framerate_t
+replay_guess_framerate (dc1394stream_t * stream, uint64_t num_frames)
+{
+    dc1394video_frame_t first, last;
+    double fps, rate = 1.875 * 1.41421356;
+    int index = 0;
+
+    if (num_frames < 2 ||
+        dc1394_stream_get_frame (stream, 0, &first) != DC1394_SUCCESS ||
+        dc1394_stream_get_frame (stream, num_frames - 1, &last) != DC1394_SUCCESS ||
+        last.timestamp <= first.timestamp)
+        return DC1394_FRAMERATE_30;
+
+    fps = 1e6 * (num_frames - 1) / (last.timestamp - first.timestamp);
+    // the IIDC rates double from 1.875 fps on: round on a log scale
+    while (fps > rate && index < DC1394_FRAMERATE_MAX - DC1394_FRAMERATE_MIN) {
+        rate *= 2;
+        index++;
+    }
+    return DC1394_FRAMERATE_MIN + index;
+}
+
+/* Builds the registers of the camera that replays a stream */
+static dc1394error_t
+replay_build_regs (vcam_regs_t * regs, const char * filename, int index)
+{
+    dc1394stream_t * stream;
+    dc1394video_frame_t proto;
+    dc1394framerate_t framerate;
+    const char * base = strrchr (filename, '/');
+    dc1394error_t err;
+
+    stream = dc1394_stream_open (filename);
+    if (!stream)
+        return DC1394_FAILURE;
+    if (dc1394_stream_get_num_frames (stream) == 0 ||
+        dc1394_stream_get_frame (stream, 0, &proto) != DC1394_SUCCESS) {
+        dc1394_log_warning ("Replay: %s has no frames", filename);
+        dc1394_stream_close (stream);
+        return DC1394_FAILURE;
+    }
+    framerate = replay_guess_framerate (stream,
+            dc1394_stream_get_num_frames (stream));
+
+    vcam_regs_init (regs, ((uint64_t) REPLAY_VENDOR_ID << 40) | index,
+            REPLAY_VENDOR_ID, "libdc1394 replay", base ? base + 1 : filename);
+    err = vcam_regs_set_mode (regs, &proto, framerate);
+    dc1394_stream_close (stream);
+    return err;
+}
+
+static platform_device_list_t *
+replay_get_device_list (platform_t * p)
+{
+    platform_device_list_t * list;
+    int i;
+
+    list = calloc (1, sizeof (platform_device_list_t));
+    if (!list)
+        return NULL;
+    list->devices = calloc (p->num_names, sizeof (platform_device_t *));
+    if (!list->devices) {
+        free (list);
+        return NULL;
+    }
+
+    for (i = 0; i < p->num_names; i++) {
+        platform_device_t * device = malloc (sizeof (platform_device_t));
+        if (!device)
+            continue;
+        if (replay_build_regs (&device->regs, p->names[i], i) != DC1394_SUCCESS) {
+            dc1394_log_warning ("Replay: could not use stream %s", p->names[i]);
+            free (device);
+            continue;
+        }
+        device->filename = p->names[i];
+        list->devices[list->num_devices++] = device;
+    }
+
+    return list;
+}
+
+static void
+replay_free_device_list (platform_device_list_t * d)
+{
+    int i;
+    for (i = 0; i < d->num_devices; i++)
+        free (d->devices[i]);
+    free (d->devices);
+    free (d);
+}
+
+static int
+replay_device_get_config_rom (platform_device_t * device,
+        uint32_t * quads, int * num_quads)
+{
+    if (*num_quads > device->regs.rom_quads)
+        *num_quads = device->regs.rom_quads;
+
+    memcpy (quads, device->regs.rom, *num_quads * sizeof (uint32_t));
+    return 0;
+}
+
+static platform_camera_t *
+replay_camera_new (platform_t * p, platform_device_t * device,
+        uint32_t unit_directory_offset)
+{
+    platform_camera_t * cam;
+    dc1394video_frame_t first, last;
+
+    cam = calloc (1, sizeof (platform_camera_t));
+    if (!cam)
+        return NULL;
+
+    cam->stream = dc1394_stream_open (device->filename);
+    if (!cam->stream) {
+        free (cam);
+        return NULL;
+    }
+    cam->filename = device->filename;
+    cam->regs = device->regs;
+    cam->fast = p->fast;
+    cam->ring.timer_fd = -1;
+
+    cam->num_frames = dc1394_stream_get_num_frames (cam->stream);
+    dc1394_stream_get_frame (cam->stream, 0, &first);
+    dc1394_stream_get_frame (cam->stream, cam->num_frames - 1, &last);
+    cam->video_mode = first.video_mode;
+    cam->first_timestamp = first.timestamp;
+    // the loop restarts one mean interval after the last frame
+    cam->period = last.timestamp - first.timestamp;
+    if (cam->num_frames > 1)
+        cam->period += cam->period / (cam->num_frames - 1);
+
+    return cam;
+}
+
+static void
+replay_camera_free (platform_camera_t * cam)
+{
+    dc1394_stream_close (cam->stream);
+    free (cam);
+}
+
+static void
+replay_camera_set_parent (platform_camera_t * cam, dc1394camera_t * parent)
+{
+    cam->camera = parent;
+}
+
+static dc1394error_t
+replay_camera_print_info (platform_camera_t * cam, FILE *fd)
+{
+    fprintf(fd,"------ Camera platform-specific information ------\n");
+    fprintf(fd,"Replayed stream                   :     %s\n", cam->filename);
+    fprintf(fd,"Number of frames                  :     %"PRIu64"\n", cam->num_frames);
+    fprintf(fd,"Timing                            :     %s\n",
+            cam->fast ? "fast" : "recorded");
+    return DC1394_SUCCESS;
+}
+
+/* Time at which the frame at the given position becomes available */
+static uint64_t
+replay_due_time (platform_camera_t * cam, uint64_t position)
+{
+    dc1394video_frame_t frame;
+
+    if (cam->fast)
+        return 0;
+    if (dc1394_stream_get_frame (cam->stream, position % cam->num_frames,
+                &frame) != DC1394_SUCCESS)
+        return 0;
+    return cam->start_time + (position / cam->num_frames) * cam->period +
+        (frame.timestamp - cam->first_timestamp);
+}
+
+/* Makes the timer fd readable when the next frame can be dequeued */
+static void
+replay_arm_timer (platform_camera_t * cam)
+{
+    if (cam->capture_is_set)
+        vcam_ring_arm (&cam->ring, cam->iso_on ?
+                replay_due_time (cam, cam->position) : VCAM_NEVER);
+}
+
+static dc1394error_t
+replay_camera_read (platform_camera_t * cam, uint64_t offset,
+        uint32_t * quads, int num_quads)
+{
+    return vcam_regs_read (&cam->regs, offset, quads, num_quads);
+}
+
+static dc1394error_t
+replay_camera_write (platform_camera_t * cam, uint64_t offset,
+        const uint32_t * quads, int num_quads)
+{
+    dc1394error_t err;
+    int iso_on;
+
+    err = vcam_regs_write (&cam->regs, offset, quads, num_quads);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    // the replay clock starts when the transmission is switched on
+    iso_on = (VCAM_REG (&cam->regs, REG_CAMERA_ISO_EN) & 0x80000000) != 0;
+    if (iso_on && !cam->iso_on) {
+        cam->start_time = vcam_get_time ();
+        cam->position = 0;
+    }
+    cam->iso_on = iso_on;
+    replay_arm_timer (cam);
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+replay_camera_get_node (platform_camera_t * cam, uint32_t * node,
+        uint32_t * generation)
+{
+    if (node)
+        *node = 0;
+    if (generation)
+        *generation = 0;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+replay_capture_setup (platform_camera_t * cam, uint32_t num_dma_buffers,
+        uint32_t flags)
+{
+    dc1394video_mode_t mode;
+    dc1394error_t err;
+
+    if (cam->capture_is_set)
+        return DC1394_CAPTURE_IS_RUNNING;
+
+    // frames can only be served in the layout they were recorded with
+    err = dc1394_video_get_mode (cam->camera, &mode);
+    DC1394_ERR_RTN (err, "Could not get the video mode");
+    if (mode != cam->video_mode) {
+        dc1394_log_error ("Replay: the stream was recorded in another mode");
+        return DC1394_INVALID_VIDEO_MODE;
+    }
+
+    // if auto iso is requested, stop ISO (if necessary)
+    if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
+        err = dc1394_video_set_transmission (cam->camera, DC1394_OFF);
+        DC1394_ERR_RTN (err, "Could not stop ISO!");
+    }
+
+    err = vcam_ring_init (&cam->ring, num_dma_buffers);
+    DC1394_ERR_RTN (err, "Could not allocate the frame ring");
+    cam->capture_is_set = 1;
+
+    // if auto iso is requested, start ISO
+    if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
+        err = dc1394_video_set_transmission (cam->camera, DC1394_ON);
+        DC1394_ERR_RTN (err, "Could not start ISO!");
+        cam->iso_auto_started = 1;
+    }
+    replay_arm_timer (cam);
+
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+replay_capture_stop (platform_camera_t * cam)
+{
+    if (!cam->capture_is_set)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    vcam_ring_free (&cam->ring);
+    cam->capture_is_set = 0;
+
+    // stop ISO if it was started automatically
+    if (cam->iso_auto_started) {
+        dc1394error_t err = dc1394_video_set_transmission (cam->camera,
+                DC1394_OFF);
+        DC1394_ERR_RTN (err, "Could not stop ISO!");
+        cam->iso_auto_started = 0;
+    }
+
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+replay_capture_dequeue (platform_camera_t * cam,
+        dc1394capture_policy_t policy, dc1394video_frame_t ** frame_return)
+{
+    dc1394video_frame_t * frame;
+    uint64_t now, due, next_due;
+    uint32_t behind;
+
+    *frame_return = NULL;
+
+    if ((policy < DC1394_CAPTURE_POLICY_MIN) ||
+        (policy > DC1394_CAPTURE_POLICY_MAX))
+        return DC1394_INVALID_CAPTURE_POLICY;
+    if (!cam->capture_is_set)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    if (!cam->iso_on || cam->ring.num_held == cam->ring.num_buffers) {
+        if (policy != DC1394_CAPTURE_POLICY_WAIT)
+            return DC1394_SUCCESS;
+        dc1394_log_error ("Replay: %s, no frame will ever come",
+                cam->iso_on ? "all buffers are held" : "transmission is off");
+        return DC1394_FAILURE;
+    }
+
+    due = replay_due_time (cam, cam->position);
+    now = vcam_get_time ();
+    if (due > now) {
+        if (policy != DC1394_CAPTURE_POLICY_WAIT)
+            return DC1394_SUCCESS;
+        vcam_sleep_until (due);
+        now = vcam_get_time ();
+    }
+
+    // with the latest policy, skip the frames that already have a successor
+    if (policy == DC1394_CAPTURE_POLICY_LATEST && !cam->fast) {
+        while (replay_due_time (cam, cam->position + 1) <= now) {
+            cam->position++;
+            capture_stats_frames_dropped (cam->camera, 1);
+        }
+        due = replay_due_time (cam, cam->position);
+    }
+
+    frame = vcam_ring_take (&cam->ring);
+    if (dc1394_stream_get_frame (cam->stream, cam->position % cam->num_frames,
+                frame) != DC1394_SUCCESS) {
+        vcam_ring_release (&cam->ring, frame);
+        return DC1394_FAILURE;
+    }
+    frame->camera = cam->camera;
+    frame->id = frame - cam->ring.frames;
+    frame->timestamp = due ? due : now;
+
+    // frames that would already be waiting in a real ring buffer
+    behind = 0;
+    if (!cam->fast) {
+        while (behind < cam->ring.num_buffers - cam->ring.num_held) {
+            next_due = replay_due_time (cam, cam->position + 1 + behind);
+            if (next_due > now)
+                break;
+            behind++;
+        }
+    }
+    frame->frames_behind = behind;
+
+    cam->position++;
+    replay_arm_timer (cam);
+
+    *frame_return = frame;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+replay_capture_enqueue (platform_camera_t * cam, dc1394video_frame_t * frame)
+{
+    dc1394error_t err = vcam_ring_release (&cam->ring, frame);
+    DC1394_ERR_RTN (err, "Could not enqueue the frame");
+    replay_arm_timer (cam);
+    return DC1394_SUCCESS;
+}
+
+static int
+replay_capture_get_fileno (platform_camera_t * cam)
+{
+    return cam->ring.timer_fd;
+}
+
+static platform_dispatch_t
+replay_dispatch = {
+    .platform_new = replay_new,
+    .platform_free = replay_free,
+
+    .get_device_list = replay_get_device_list,
+    .free_device_list = replay_free_device_list,
+    .device_get_config_rom = replay_device_get_config_rom,
+
+    .camera_new = replay_camera_new,
+    .camera_free = replay_camera_free,
+    .camera_set_parent = replay_camera_set_parent,
+
+    .camera_read = replay_camera_read,
+    .camera_write = replay_camera_write,
+
+    .camera_print_info = replay_camera_print_info,
+    .camera_get_node = replay_camera_get_node,
+    .read_cycle_timer = vcam_read_cycle_timer,
+
+    .capture_setup = replay_capture_setup,
+    .capture_stop = replay_capture_stop,
+    .capture_dequeue = replay_capture_dequeue,
+    .capture_enqueue = replay_capture_enqueue,
+    .capture_get_fileno = replay_capture_get_fileno,
+};
+
+void
+replay_init (dc1394_t * d)
+{
+    register_platform (d, &replay_dispatch, "replay");
+}
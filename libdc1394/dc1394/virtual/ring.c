@@ -0,0 +1,168 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Frame rings and timing of virtual cameras
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef HAVE_LINUX
+#include <sys/timerfd.h>
+#endif
+
+#include "virtual.h"
+#include "log.h"
+
+uint64_t
+vcam_get_time (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void
+vcam_sleep_until (uint64_t time)
+{
+    uint64_t now = vcam_get_time ();
+    struct timespec ts;
+
+    if (time <= now)
+        return;
+    ts.tv_sec = (time - now) / 1000000;
+    ts.tv_nsec = ((time - now) % 1000000) * 1000;
+    while (nanosleep (&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+/* The emulated bus has its own clock, a little fast compared to the host,
+   like the crystal of a real cycle master. */
+dc1394error_t
+vcam_read_cycle_timer (platform_camera_t * cam, uint32_t * cycle_timer,
+        uint64_t * local_time)
+{
+    struct timespec ts;
+    uint64_t ticks, rem;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    ticks = ((double) ts.tv_sec * 1e9 + ts.tv_nsec) * 0.024576 *
+        (1.0 + VCAM_CYCLE_TIMER_DRIFT);
+    rem = ticks % 24576000;
+    *cycle_timer = ((ticks / 24576000) & 0x7f) << 25 |
+        (rem / 3072) << 12 | rem % 3072;
+    *local_time = vcam_get_time ();
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+vcam_ring_init (vcam_ring_t * ring, uint32_t num_buffers)
+{
+    uint32_t i;
+
+    if (num_buffers == 0)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    ring->frames = calloc (num_buffers, sizeof (dc1394video_frame_t));
+    ring->held = calloc (num_buffers, 1);
+    if (!ring->frames || !ring->held) {
+        free (ring->frames);
+        free (ring->held);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    for (i = 0; i < num_buffers; i++)
+        ring->frames[i].id = i;
+    ring->num_buffers = num_buffers;
+    ring->num_held = 0;
+    ring->timer_fd = -1;
+
+#ifdef HAVE_LINUX
+    ring->timer_fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK);
+    if (ring->timer_fd < 0)
+        dc1394_log_warning ("Could not create the capture timer: %m");
+#endif
+    return DC1394_SUCCESS;
+}
+
+void
+vcam_ring_free (vcam_ring_t * ring)
+{
+    if (ring->timer_fd >= 0)
+        close (ring->timer_fd);
+    free (ring->frames);
+    free (ring->held);
+    memset (ring, 0, sizeof (vcam_ring_t));
+    ring->timer_fd = -1;
+}
+
+/* Returns a slot that is not held by the user and marks it held */
+dc1394video_frame_t *
+vcam_ring_take (vcam_ring_t * ring)
+{
+    uint32_t i;
+
+    for (i = 0; i < ring->num_buffers; i++) {
+        if (!ring->held[i]) {
+            ring->held[i] = 1;
+            ring->num_held++;
+            return ring->frames + i;
+        }
+    }
+    return NULL;
+}
+
+dc1394error_t
+vcam_ring_release (vcam_ring_t * ring, dc1394video_frame_t * frame)
+{
+    if (frame < ring->frames || frame >= ring->frames + ring->num_buffers ||
+        !ring->held[frame->id]) {
+        dc1394_log_error ("(%s) dc1394_capture_enqueue: frame is not held "
+                "by this camera", __FILE__);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+    ring->held[frame->id] = 0;
+    ring->num_held--;
+    return DC1394_SUCCESS;
+}
+
+/* Makes the timer readable at the given time (at once if it is 0). The
+   timer is disarmed for VCAM_NEVER and while all the slots are held. */
+void
+vcam_ring_arm (vcam_ring_t * ring, uint64_t due)
+{
+#ifdef HAVE_LINUX
+    struct itimerspec its;
+
+    if (ring->timer_fd < 0)
+        return;
+    memset (&its, 0, sizeof (its));
+    if (due != VCAM_NEVER && ring->num_held < ring->num_buffers) {
+        if (due == 0)
+            its.it_value.tv_nsec = 1;
+        else {
+            its.it_value.tv_sec = due / 1000000;
+            its.it_value.tv_nsec = (due % 1000000) * 1000 + 1;
+        }
+    }
+    timerfd_settime (ring->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+#endif
+}
@@ -0,0 +1,811 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Simulated platform: IIDC cameras emulated in software
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+  DC1394_SIM gives the number of simulated cameras to create. Every
+  register access costs DC1394_SIM_LATENCY microseconds (0 by default), as
+  does every quadlet of the config ROM read during enumeration, and
+  DC1394_SIM_FPS overrides the frame rate that follows from the video mode.
+  While the cameras are monitored for hotplug, DC1394_SIM_HOTPLUG makes the
+  last one go and come back every given number of milliseconds (on Linux). A reset of
+  the bus makes the cameras stop transmitting, as real ones may when they
+  lose their isochronous resources.
+
+  The cameras implement the IIDC 1.31 register map: fixed and Format_7
+  modes with the value setting handshake, a set of features with absolute
+  value registers, one-shot, multi-shot and the external trigger with a
+  software source. Frames are generated when they are dequeued: row y of
+  frame n is filled with the byte (y + n) & 0xff.
+*/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX
+#include <sys/timerfd.h>
+#endif
+
+#include "virtual.h"
+#include "platform.h"
+#include "control.h"
+#include "video.h"
+#include "log.h"
+
+#define SIM_VENDOR_ID      0x00d139
+#define SIM_MODEL_ID       0x000100
+
+struct _platform_t {
+    int                        num_cameras;
+    uint64_t                   latency;
+    double                     fps;
+
+    uint32_t                   hotplug_period;     /* ms */
+    int                        hotplug_fd;
+    volatile uint32_t          hotplug_toggles;    /* the last camera is away if odd */
+};
+
+struct _platform_device_t {
+    vcam_regs_t                regs;
+    uint64_t                   latency;
+};
+
+/* Transactions a camera keeps in flight before it answers busy */
+#define SIM_TRANSACTION_DEPTH   4
+#define SIM_MAX_TRANSACTIONS    64
+
+struct _platform_camera_t {
+    dc1394camera_t           * camera;
+    vcam_regs_t                regs;
+    uint64_t                   latency;
+    double                     fps;
+    uint32_t                   generation;     /* bumped by each bus reset */
+
+    int                        iso_on;
+    uint64_t                   start_time;
+    uint64_t                   interval;
+    uint64_t                   position;       /* frames generated so far */
+    uint32_t                   pending_shots;  /* one-shot, multi-shot and trigger requests */
+
+    int                        capture_is_set;
+    int                        iso_auto_started;
+    int                        keep_buffer;
+    vcam_ring_t                ring;
+    unsigned char            * buffer;
+    size_t                     buffer_size;
+    dc1394video_frame_t        proto;
+
+    /* asynchronous transactions, completed in order after the latency */
+    int                        transaction_pipe[2];
+    struct {
+        platform_transaction_t * t;
+        uint64_t                 due;
+        int                      busy;
+    }                          transactions[SIM_MAX_TRANSACTIONS];
+    int                        first_transaction;
+    int                        num_transactions;
+    int                        num_accepted;   /* not answered busy */
+};
+
+static platform_t *
+sim_new (void)
+{
+    const char * env = getenv ("DC1394_SIM");
+    const char * latency = getenv ("DC1394_SIM_LATENCY");
+    const char * fps = getenv ("DC1394_SIM_FPS");
+    const char * hotplug = getenv ("DC1394_SIM_HOTPLUG");
+    platform_t * p;
+
+    if (!env || atoi (env) <= 0)
+        return NULL;
+
+    p = calloc (1, sizeof (platform_t));
+    if (!p)
+        return NULL;
+    p->num_cameras = atoi (env);
+    if (latency)
+        p->latency = strtoull (latency, NULL, 10);
+    if (fps)
+        p->fps = strtod (fps, NULL);
+    if (hotplug)
+        p->hotplug_period = strtoul (hotplug, NULL, 10);
+    p->hotplug_fd = -1;
+
+    dc1394_log_debug ("Sim: %d camera(s), %"PRIu64" us per transaction",
+            p->num_cameras, p->latency);
+    return p;
+}
+
+static void
+sim_free (platform_t * p)
+{
+    free (p);
+}
+
+#define RATES(min, max) \
+    (((1 << ((max) - DC1394_FRAMERATE_MIN + 1)) - 1) & \
+     ~((1 << ((min) - DC1394_FRAMERATE_MIN)) - 1))
+#define CODING(c)          (1 << ((c) - DC1394_COLOR_CODING_MIN))
+
+static void
+sim_build_regs (vcam_regs_t * r, int index)
+{
+    vcam_regs_init (r, ((uint64_t) SIM_VENDOR_ID << 40) | SIM_MODEL_ID | index,
+            SIM_VENDOR_ID, "libdc1394", "Simulated camera");
+    VCAM_REG (r, REG_CAMERA_BASIC_FUNC_INQ) |= 0x00001800;   /* one/multi shot */
+
+    vcam_regs_add_mode (r, DC1394_VIDEO_MODE_320x240_YUV422,
+            RATES (DC1394_FRAMERATE_3_75, DC1394_FRAMERATE_60));
+    vcam_regs_add_mode (r, DC1394_VIDEO_MODE_640x480_YUV422,
+            RATES (DC1394_FRAMERATE_1_875, DC1394_FRAMERATE_30));
+    vcam_regs_add_mode (r, DC1394_VIDEO_MODE_640x480_RGB8,
+            RATES (DC1394_FRAMERATE_1_875, DC1394_FRAMERATE_15));
+    vcam_regs_add_mode (r, DC1394_VIDEO_MODE_640x480_MONO8,
+            RATES (DC1394_FRAMERATE_1_875, DC1394_FRAMERATE_60));
+    vcam_regs_add_mode (r, DC1394_VIDEO_MODE_640x480_MONO16,
+            RATES (DC1394_FRAMERATE_1_875, DC1394_FRAMERATE_30));
+    vcam_regs_add_mode (r, DC1394_VIDEO_MODE_1024x768_MONO8,
+            RATES (DC1394_FRAMERATE_1_875, DC1394_FRAMERATE_30));
+    vcam_regs_add_format7 (r, DC1394_VIDEO_MODE_FORMAT7_0, 1280, 1024, 8,
+            CODING (DC1394_COLOR_CODING_MONO8) |
+            CODING (DC1394_COLOR_CODING_MONO16) |
+            CODING (DC1394_COLOR_CODING_RAW8), DC1394_COLOR_FILTER_RGGB);
+    vcam_regs_add_format7 (r, DC1394_VIDEO_MODE_FORMAT7_1, 640, 512, 4,
+            CODING (DC1394_COLOR_CODING_MONO8), 0);
+    vcam_regs_select_mode (r, DC1394_VIDEO_MODE_640x480_MONO8,
+            DC1394_FRAMERATE_30);
+
+    vcam_regs_add_feature (r, DC1394_FEATURE_BRIGHTNESS,
+            VCAM_FEATURE_MANUAL | 255, 128);
+    vcam_regs_add_feature (r, DC1394_FEATURE_EXPOSURE,
+            VCAM_FEATURE_ONE_PUSH | VCAM_FEATURE_READOUT | VCAM_FEATURE_ON_OFF |
+            VCAM_FEATURE_AUTO | VCAM_FEATURE_MANUAL | (1 << 12) | 1023,
+            0x03000000 | 512);
+    vcam_regs_add_feature (r, DC1394_FEATURE_SHARPNESS,
+            VCAM_FEATURE_MANUAL | 255, 80);
+    vcam_regs_add_feature (r, DC1394_FEATURE_WHITE_BALANCE,
+            VCAM_FEATURE_ONE_PUSH | VCAM_FEATURE_READOUT | VCAM_FEATURE_AUTO |
+            VCAM_FEATURE_MANUAL | 1023, 0x02000000 | (512 << 12) | 512);
+    vcam_regs_add_feature (r, DC1394_FEATURE_SATURATION,
+            VCAM_FEATURE_MANUAL | 255, 128);
+    vcam_regs_add_feature (r, DC1394_FEATURE_SHUTTER,
+            VCAM_FEATURE_READOUT | VCAM_FEATURE_AUTO | VCAM_FEATURE_MANUAL |
+            (1 << 12) | 4095, 1000);
+    vcam_regs_add_absolute (r, DC1394_FEATURE_SHUTTER, 1e-5, 0.5, 0.01);
+    vcam_regs_add_feature (r, DC1394_FEATURE_GAIN,
+            VCAM_FEATURE_READOUT | VCAM_FEATURE_AUTO | VCAM_FEATURE_MANUAL |
+            680, 0);
+    vcam_regs_add_absolute (r, DC1394_FEATURE_GAIN, 0, 24, 0);
+    vcam_regs_add_feature (r, DC1394_FEATURE_TEMPERATURE,
+            VCAM_FEATURE_READOUT | 4095, 3030);
+    vcam_regs_add_feature (r, DC1394_FEATURE_TRIGGER,
+            VCAM_FEATURE_READOUT | VCAM_FEATURE_ON_OFF |
+            0x02000000 |                     /* polarity */
+            0x00800000 | 0x00010000 |        /* source 0 and software */
+            0x0000c003,                      /* modes 0, 1, 14 and 15 */
+            7 << 21);
+    vcam_regs_add_feature (r, DC1394_FEATURE_TRIGGER_DELAY,
+            VCAM_FEATURE_ON_OFF | VCAM_FEATURE_MANUAL | 4095, 0);
+    vcam_regs_add_absolute (r, DC1394_FEATURE_TRIGGER_DELAY, 0, 0.1, 0);
+    vcam_regs_add_feature (r, DC1394_FEATURE_FRAME_RATE,
+            VCAM_FEATURE_ON_OFF | VCAM_FEATURE_AUTO | VCAM_FEATURE_MANUAL |
+            4095, 0x02000000 | 0x01000000);
+    vcam_regs_add_absolute (r, DC1394_FEATURE_FRAME_RATE, 1, 240, 30);
+}
+
+/* Busy-waits for short latencies, which sleeping could not honour */
+static void
+sim_wait_until (uint64_t end)
+{
+    uint64_t now = vcam_get_time ();
+
+    if (now >= end)
+        return;
+    if (end - now >= 1000)
+        vcam_sleep_until (end);
+    else
+        while (vcam_get_time () < end)
+            ;
+}
+
+static platform_device_list_t *
+sim_get_device_list (platform_t * p)
+{
+    platform_device_list_t * list;
+    int i;
+
+    list = calloc (1, sizeof (platform_device_list_t));
+    if (!list)
+        return NULL;
+    list->devices = calloc (p->num_cameras, sizeof (platform_device_t *));
+    if (!list->devices) {
+        free (list);
+        return NULL;
+    }
+
+    for (i = 0; i < p->num_cameras; i++) {
+        if (i == p->num_cameras - 1 && (p->hotplug_toggles & 1))
+            break;
+        platform_device_t * device = malloc (sizeof (platform_device_t));
+        if (!device)
+            continue;
+        sim_build_regs (&device->regs, i);
+        device->latency = p->latency;
+        list->devices[list->num_devices++] = device;
+    }
+
+    return list;
+}
+
+static void
+sim_free_device_list (platform_device_list_t * d)
+{
+    int i;
+    for (i = 0; i < d->num_devices; i++)
+        free (d->devices[i]);
+    free (d->devices);
+    free (d);
+}
+
+/* Hotplug is driven by a timerfd, so it is only simulated on Linux */
+static int
+sim_monitor_start (platform_t * p)
+{
+#ifdef HAVE_LINUX
+    struct itimerspec its;
+
+    if (!p->hotplug_period)
+        return -1;
+    p->hotplug_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (p->hotplug_fd < 0)
+        return -1;
+    its.it_value.tv_sec = p->hotplug_period / 1000;
+    its.it_value.tv_nsec = (p->hotplug_period % 1000) * 1000000;
+    its.it_interval = its.it_value;
+    timerfd_settime (p->hotplug_fd, 0, &its, NULL);
+    return p->hotplug_fd;
+#else
+    return -1;
+#endif
+}
+
+static void
+sim_monitor_stop (platform_t * p)
+{
+    if (p->hotplug_fd >= 0)
+        close (p->hotplug_fd);
+    p->hotplug_fd = -1;
+}
+
+static int
+sim_monitor_changed (platform_t * p)
+{
+    uint64_t expirations;
+
+    if (read (p->hotplug_fd, &expirations, sizeof (expirations)) !=
+            sizeof (expirations))
+        return 0;
+    __sync_fetch_and_add (&p->hotplug_toggles, (uint32_t) expirations);
+    return 1;
+}
+
+static int
+sim_device_get_config_rom (platform_device_t * device,
+        uint32_t * quads, int * num_quads)
+{
+    if (*num_quads > device->regs.rom_quads)
+        *num_quads = device->regs.rom_quads;
+
+    /* The config ROM is read one quadlet at a time */
+    if (device->latency)
+        sim_wait_until (vcam_get_time () + device->latency * *num_quads);
+    memcpy (quads, device->regs.rom, *num_quads * sizeof (uint32_t));
+    return 0;
+}
+
+static platform_camera_t *
+sim_camera_new (platform_t * p, platform_device_t * device,
+        uint32_t unit_directory_offset)
+{
+    platform_camera_t * cam;
+
+    cam = calloc (1, sizeof (platform_camera_t));
+    if (!cam)
+        return NULL;
+    cam->regs = device->regs;
+    cam->latency = p->latency;
+    cam->fps = p->fps;
+    cam->ring.timer_fd = -1;
+    cam->transaction_pipe[0] = cam->transaction_pipe[1] = -1;
+    return cam;
+}
+
+static void
+sim_camera_free (platform_camera_t * cam)
+{
+    if (cam->transaction_pipe[0] >= 0) {
+        close (cam->transaction_pipe[0]);
+        close (cam->transaction_pipe[1]);
+    }
+    free (cam->buffer);
+    free (cam);
+}
+
+static void
+sim_camera_set_parent (platform_camera_t * cam, dc1394camera_t * parent)
+{
+    cam->camera = parent;
+}
+
+static dc1394error_t
+sim_camera_print_info (platform_camera_t * cam, FILE *fd)
+{
+    fprintf(fd,"------ Camera platform-specific information ------\n");
+    fprintf(fd,"Transaction latency               :     %"PRIu64" us\n", cam->latency);
+    return DC1394_SUCCESS;
+}
+
+static void
+sim_transaction_delay (platform_camera_t * cam)
+{
+    if (cam->latency == 0)
+        return;
+    sim_wait_until (vcam_get_time () + cam->latency);
+}
+
+static int
+sim_is_triggered (platform_camera_t * cam)
+{
+    return (VCAM_REG (&cam->regs, REG_CAMERA_TRIGGER_MODE) & 0x02000000) != 0;
+}
+
+/* Time at which the next frame can be dequeued, 0 if it is ready now */
+static uint64_t
+sim_next_due (platform_camera_t * cam)
+{
+    if (cam->pending_shots > 0)
+        return 0;
+    if (!cam->iso_on || sim_is_triggered (cam))
+        return VCAM_NEVER;
+    return cam->start_time + cam->position * cam->interval;
+}
+
+static void
+sim_arm_timer (platform_camera_t * cam)
+{
+    if (cam->capture_is_set)
+        vcam_ring_arm (&cam->ring, sim_next_due (cam));
+}
+
+static dc1394error_t
+sim_camera_read (platform_camera_t * cam, uint64_t offset,
+        uint32_t * quads, int num_quads)
+{
+    sim_transaction_delay (cam);
+    return vcam_regs_read (&cam->regs, offset, quads, num_quads);
+}
+
+static dc1394error_t
+sim_regs_write (platform_camera_t * cam, uint64_t offset,
+        const uint32_t * quads, int num_quads)
+{
+    uint32_t * shot = &VCAM_REG (&cam->regs, REG_CAMERA_ONE_SHOT);
+    uint32_t * soft = &VCAM_REG (&cam->regs, REG_CAMERA_SOFT_TRIGGER);
+    dc1394error_t err;
+    int iso_on;
+
+    err = vcam_regs_write (&cam->regs, offset, quads, num_quads);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    // shots and software triggers are taken at once and read back as 0
+    if (*shot & 0x80000000)
+        cam->pending_shots++;
+    else if (*shot & 0x40000000)
+        cam->pending_shots += *shot & 0xffff;
+    *shot = 0;
+    if ((*soft & 0x80000000) && sim_is_triggered (cam) &&
+        ((VCAM_REG (&cam->regs, REG_CAMERA_TRIGGER_MODE) >> 21) & 0x7) == 7)
+        cam->pending_shots++;
+    *soft = 0;
+
+    // the frame clock starts when the transmission is switched on
+    iso_on = (VCAM_REG (&cam->regs, REG_CAMERA_ISO_EN) & 0x80000000) != 0;
+    if (iso_on && !cam->iso_on) {
+        cam->start_time = vcam_get_time ();
+        cam->position = 0;
+    }
+    cam->iso_on = iso_on;
+    sim_arm_timer (cam);
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+sim_camera_write (platform_camera_t * cam, uint64_t offset,
+        const uint32_t * quads, int num_quads)
+{
+    sim_transaction_delay (cam);
+    return sim_regs_write (cam, offset, quads, num_quads);
+}
+
+/*
+  The asynchronous path overlaps the latencies of the transactions in
+  flight. The pipe holds one byte per transaction so that it can be polled;
+  like a real node, the camera answers busy past a few of them.
+*/
+static int
+sim_transaction_get_fileno (platform_camera_t * cam)
+{
+    if (cam->transaction_pipe[0] < 0 && pipe (cam->transaction_pipe) < 0)
+        return -1;
+    return cam->transaction_pipe[0];
+}
+
+static dc1394error_t
+sim_transaction_submit (platform_camera_t * cam, platform_transaction_t * t)
+{
+    int i;
+    char c = 0;
+
+    if (sim_transaction_get_fileno (cam) < 0 ||
+        cam->num_transactions == SIM_MAX_TRANSACTIONS)
+        return DC1394_FAILURE;
+
+    i = (cam->first_transaction + cam->num_transactions) % SIM_MAX_TRANSACTIONS;
+    cam->transactions[i].t = t;
+    cam->transactions[i].busy = cam->num_accepted >= SIM_TRANSACTION_DEPTH;
+    cam->transactions[i].due = vcam_get_time () + cam->latency;
+    if (!cam->transactions[i].busy)
+        cam->num_accepted++;
+    cam->num_transactions++;
+    if (write (cam->transaction_pipe[1], &c, 1) != 1)
+        return DC1394_FAILURE;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+sim_transaction_complete (platform_camera_t * cam, platform_transaction_t ** done)
+{
+    platform_transaction_t * t;
+    int i = cam->first_transaction;
+    char c;
+
+    *done = NULL;
+    if (cam->num_transactions == 0 ||
+        read (cam->transaction_pipe[0], &c, 1) != 1)
+        return DC1394_FAILURE;
+
+    sim_wait_until (cam->transactions[i].due);
+    t = cam->transactions[i].t;
+    t->retry = cam->transactions[i].busy;
+    t->rcode = t->retry ? 0x12 : 0;     // RCODE_BUSY or RCODE_COMPLETE
+    if (!t->retry) {
+        if (t->write)
+            t->result = sim_regs_write (cam, t->offset, t->quads, t->num_quads);
+        else
+            t->result = vcam_regs_read (&cam->regs, t->offset, t->quads,
+                    t->num_quads);
+        cam->num_accepted--;
+    }
+    cam->first_transaction = (i + 1) % SIM_MAX_TRANSACTIONS;
+    cam->num_transactions--;
+    *done = t;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+sim_camera_get_node (platform_camera_t * cam, uint32_t * node,
+        uint32_t * generation)
+{
+    if (node)
+        *node = 0;
+    if (generation)
+        *generation = cam->generation;
+    return DC1394_SUCCESS;
+}
+
+/* The frame clock is woken so that a receive thread sees the reset */
+static dc1394error_t
+sim_reset_bus (platform_camera_t * cam)
+{
+    cam->generation++;
+    VCAM_REG (&cam->regs, REG_CAMERA_ISO_EN) &= ~0x80000000;
+    cam->iso_on = 0;
+    if (cam->capture_is_set)
+        vcam_ring_arm (&cam->ring, 0);
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+sim_capture_check_reset (platform_camera_t * cam, uint32_t * generation)
+{
+    *generation = cam->generation;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+sim_capture_setup (platform_camera_t * cam, uint32_t num_dma_buffers,
+        uint32_t flags)
+{
+    dc1394camera_t * camera = cam->camera;
+    dc1394framerate_t framerate;
+    float fps;
+    uint32_t i;
+    dc1394error_t err;
+
+    if (cam->capture_is_set)
+        return DC1394_CAPTURE_IS_RUNNING;
+
+    // if auto iso is requested, stop ISO (if necessary)
+    if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
+        err = dc1394_video_set_transmission (camera, DC1394_OFF);
+        DC1394_ERR_RTN (err, "Could not stop ISO!");
+    }
+
+    if (capture_basic_setup (camera, &cam->proto) != DC1394_SUCCESS) {
+        dc1394_log_error ("basic setup failed");
+        return DC1394_FAILURE;
+    }
+
+    // one packet per isochronous cycle of 125 us, unless told otherwise
+    if (cam->fps > 0)
+        cam->interval = 1e6 / cam->fps;
+    else if (dc1394_is_video_mode_scalable (cam->proto.video_mode))
+        cam->interval = cam->proto.packets_per_frame * 125;
+    else {
+        err = dc1394_video_get_framerate (camera, &framerate);
+        DC1394_ERR_RTN (err, "Could not get the frame rate");
+        err = dc1394_framerate_as_float (framerate, &fps);
+        DC1394_ERR_RTN (err, "Invalid frame rate");
+        cam->interval = 1e6 / fps;
+    }
+    if (cam->interval == 0)
+        cam->interval = 1;
+
+    // a buffer kept by the last capture_stop is reused if large enough
+    if ((size_t) num_dma_buffers * cam->proto.total_bytes > cam->buffer_size) {
+        free (cam->buffer);
+        cam->buffer_size = (size_t) num_dma_buffers * cam->proto.total_bytes;
+        cam->buffer = malloc (cam->buffer_size);
+        if (!cam->buffer) {
+            cam->buffer_size = 0;
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+    }
+    cam->keep_buffer = (flags & DC1394_CAPTURE_FLAGS_KEEP_BUFFERS) != 0;
+    err = vcam_ring_init (&cam->ring, num_dma_buffers);
+    DC1394_ERR_RTN (err, "Could not allocate the frame ring");
+    for (i = 0; i < num_dma_buffers; i++) {
+        memcpy (cam->ring.frames + i, &cam->proto, sizeof (dc1394video_frame_t));
+        cam->ring.frames[i].image = cam->buffer + i * cam->proto.total_bytes;
+        cam->ring.frames[i].id = i;
+        cam->ring.frames[i].allocated_image_bytes = cam->proto.total_bytes;
+    }
+    cam->capture_is_set = 1;
+
+    // if auto iso is requested, start ISO
+    if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
+        err = dc1394_video_set_transmission (camera, DC1394_ON);
+        DC1394_ERR_RTN (err, "Could not start ISO!");
+        cam->iso_auto_started = 1;
+    }
+    sim_arm_timer (cam);
+
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+sim_capture_stop (platform_camera_t * cam)
+{
+    if (!cam->capture_is_set)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    vcam_ring_free (&cam->ring);
+    if (!cam->keep_buffer) {
+        free (cam->buffer);
+        cam->buffer = NULL;
+        cam->buffer_size = 0;
+    }
+    cam->capture_is_set = 0;
+
+    // stop ISO if it was started automatically
+    if (cam->iso_auto_started) {
+        dc1394error_t err = dc1394_video_set_transmission (cam->camera,
+                DC1394_OFF);
+        DC1394_ERR_RTN (err, "Could not stop ISO!");
+        cam->iso_auto_started = 0;
+    }
+
+    return DC1394_SUCCESS;
+}
+
+static void
+sim_fill_frame (dc1394video_frame_t * frame, uint64_t n)
+{
+    uint32_t y;
+
+    for (y = 0; y < frame->size[1]; y++)
+        memset (frame->image + y * frame->stride, (y + n) & 0xff,
+                frame->stride);
+}
+
+static dc1394error_t
+sim_capture_dequeue (platform_camera_t * cam,
+        dc1394capture_policy_t policy, dc1394video_frame_t ** frame_return)
+{
+    dc1394video_frame_t * frame;
+    uint64_t now, due, last, skipped;
+    uint32_t behind = 0, room;
+
+    *frame_return = NULL;
+
+    if ((policy < DC1394_CAPTURE_POLICY_MIN) ||
+        (policy > DC1394_CAPTURE_POLICY_MAX))
+        return DC1394_INVALID_CAPTURE_POLICY;
+    if (!cam->capture_is_set)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    due = sim_next_due (cam);
+    if (due == VCAM_NEVER || cam->ring.num_held == cam->ring.num_buffers) {
+        if (policy != DC1394_CAPTURE_POLICY_WAIT)
+            return DC1394_SUCCESS;
+        dc1394_log_error ("Sim: %s, no frame will ever come",
+                due == VCAM_NEVER ? "no trigger and no transmission" :
+                "all buffers are held");
+        return DC1394_FAILURE;
+    }
+
+    now = vcam_get_time ();
+    if (due > now) {
+        if (policy != DC1394_CAPTURE_POLICY_WAIT)
+            return DC1394_SUCCESS;
+        vcam_sleep_until (due);
+        now = vcam_get_time ();
+    }
+
+    if (cam->pending_shots > 0) {
+        cam->pending_shots--;
+        due = now;
+    }
+    else {
+        // frames that did not fit in the free buffers were lost
+        last = (now - cam->start_time) / cam->interval;
+        room = cam->ring.num_buffers - cam->ring.num_held;
+        if (last - cam->position >= room) {
+            cam->position = last - room + 1;
+            capture_stats_ring_overrun (cam->camera);
+        }
+        skipped = cam->position;
+        if (policy == DC1394_CAPTURE_POLICY_LATEST)
+            cam->position = last;
+        if (cam->position > skipped)
+            capture_stats_frames_dropped (cam->camera,
+                    cam->position - skipped);
+        behind = last - cam->position;
+        due = cam->start_time + cam->position * cam->interval;
+        cam->position++;
+    }
+
+    frame = vcam_ring_take (&cam->ring);
+    sim_fill_frame (frame, cam->position - 1);
+    frame->timestamp = due;
+    frame->frames_behind = behind;
+
+    sim_arm_timer (cam);
+    *frame_return = frame;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+sim_capture_enqueue (platform_camera_t * cam, dc1394video_frame_t * frame)
+{
+    dc1394error_t err = vcam_ring_release (&cam->ring, frame);
+    DC1394_ERR_RTN (err, "Could not enqueue the frame");
+    sim_arm_timer (cam);
+    return DC1394_SUCCESS;
+}
+
+static int
+sim_capture_get_fileno (platform_camera_t * cam)
+{
+    return cam->ring.timer_fd;
+}
+
+static dc1394error_t
+sim_capture_set_layout (platform_camera_t * cam,
+        const dc1394video_frame_t * proto)
+{
+    dc1394video_frame_t * frame;
+    uint64_t slot;
+    uint32_t i;
+
+    if (!cam->capture_is_set)
+        return DC1394_CAPTURE_IS_NOT_SET;
+    slot = cam->ring.frames[0].allocated_image_bytes;
+    if (proto->total_bytes > slot) {
+        dc1394_log_error ("Sim: frames of %"PRIu64" bytes do not fit in the "
+                "capture buffers", proto->total_bytes);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    memcpy (&cam->proto, proto, sizeof (dc1394video_frame_t));
+    for (i = 0; i < cam->ring.num_buffers; i++) {
+        frame = cam->ring.frames + i;
+        memcpy (frame, proto, sizeof (dc1394video_frame_t));
+        frame->image = cam->buffer + i * slot;
+        frame->id = i;
+        frame->allocated_image_bytes = slot;
+    }
+
+    // a smaller region is sent in fewer packets, hence faster
+    if (cam->fps <= 0 && dc1394_is_video_mode_scalable (proto->video_mode)) {
+        cam->interval = proto->packets_per_frame * 125;
+        if (cam->interval == 0)
+            cam->interval = 1;
+        cam->start_time = vcam_get_time () - cam->position * cam->interval;
+        sim_arm_timer (cam);
+    }
+
+    return DC1394_SUCCESS;
+}
+
+static platform_dispatch_t
+sim_dispatch = {
+    .platform_new = sim_new,
+    .platform_free = sim_free,
+
+    .get_device_list = sim_get_device_list,
+    .free_device_list = sim_free_device_list,
+    .device_get_config_rom = sim_device_get_config_rom,
+    .monitor_start = sim_monitor_start,
+    .monitor_stop = sim_monitor_stop,
+    .monitor_changed = sim_monitor_changed,
+
+    .camera_new = sim_camera_new,
+    .camera_free = sim_camera_free,
+    .camera_set_parent = sim_camera_set_parent,
+
+    .camera_read = sim_camera_read,
+    .camera_write = sim_camera_write,
+    .transaction_submit = sim_transaction_submit,
+    .transaction_get_fileno = sim_transaction_get_fileno,
+    .transaction_complete = sim_transaction_complete,
+
+    .camera_print_info = sim_camera_print_info,
+    .camera_get_node = sim_camera_get_node,
+    .reset_bus = sim_reset_bus,
+    .read_cycle_timer = vcam_read_cycle_timer,
+
+    .capture_setup = sim_capture_setup,
+    .capture_stop = sim_capture_stop,
+    .capture_dequeue = sim_capture_dequeue,
+    .capture_enqueue = sim_capture_enqueue,
+    .capture_get_fileno = sim_capture_get_fileno,
+    .capture_set_layout = sim_capture_set_layout,
+    .capture_check_reset = sim_capture_check_reset,
+};
+
+void
+sim_init (dc1394_t * d)
+{
+    register_platform (d, &sim_dispatch, "sim");
+}
@@ -0,0 +1,121 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Virtual cameras: cameras that are not backed by hardware
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_VIRTUAL_H__
+#define __DC1394_VIRTUAL_H__
+
+#include <stdio.h>
+#include "config.h"
+#include "internal.h"
+#include "register.h"
+#include "offsets.h"
+#include "stream.h"
+
+/* Address map of a virtual camera, as offsets from CONFIG_ROM_BASE */
+#define VCAM_ROM_OFFSET          0x400
+#define VCAM_ROM_QUADS           64
+#define VCAM_COMMAND_BASE        0xF00000
+#define VCAM_COMMAND_SIZE        0x1000
+#define VCAM_FORMAT7_BASE        (VCAM_COMMAND_BASE + VCAM_COMMAND_SIZE)
+#define VCAM_FORMAT7_SIZE        0x100
+#define VCAM_ABSOLUTE_BASE       (VCAM_FORMAT7_BASE + 8 * VCAM_FORMAT7_SIZE)
+#define VCAM_ABSOLUTE_SIZE       0x10
+#define VCAM_REGS_SIZE           (VCAM_COMMAND_SIZE + 8 * VCAM_FORMAT7_SIZE + \
+                                  32 * VCAM_ABSOLUTE_SIZE)
+
+/* Format_7 value setting bits */
+#define VCAM_F7_PRESENCE         0x80000000
+#define VCAM_F7_SETTING_1        0x40000000
+#define VCAM_F7_ERROR_FLAG_1     0x00800000
+#define VCAM_F7_ERROR_FLAG_2     0x00400000
+
+/* Feature inquiry and control bits */
+#define VCAM_FEATURE_PRESENCE    0x80000000
+#define VCAM_FEATURE_ABSOLUTE    0x40000000
+#define VCAM_FEATURE_ONE_PUSH    0x10000000
+#define VCAM_FEATURE_READOUT     0x08000000
+#define VCAM_FEATURE_ON_OFF      0x04000000
+#define VCAM_FEATURE_AUTO        0x02000000
+#define VCAM_FEATURE_MANUAL      0x01000000
+
+/* The registers of a virtual IIDC camera: its configuration ROM and its
+   command, Format_7 and absolute value registers, all kept in memory.
+   The last valid region of each Format_7 mode is kept so that a rejected
+   request can be rolled back. */
+typedef struct {
+    uint32_t rom[VCAM_ROM_QUADS];
+    int      rom_quads;
+    uint32_t regs[VCAM_REGS_SIZE / 4];
+    uint32_t format7_applied[8][4];
+} vcam_regs_t;
+
+void vcam_regs_init (vcam_regs_t * r, uint64_t guid, uint32_t vendor_id,
+        const char * vendor, const char * model);
+dc1394error_t vcam_regs_add_mode (vcam_regs_t * r, dc1394video_mode_t mode,
+        uint32_t framerates);
+dc1394error_t vcam_regs_add_format7 (vcam_regs_t * r, dc1394video_mode_t mode,
+        uint32_t max_width, uint32_t max_height, uint32_t unit,
+        uint32_t color_codings, dc1394color_filter_t filter);
+dc1394error_t vcam_regs_add_feature (vcam_regs_t * r, dc1394feature_t feature,
+        uint32_t inquiry, uint32_t value);
+dc1394error_t vcam_regs_add_absolute (vcam_regs_t * r, dc1394feature_t feature,
+        float min, float max, float value);
+dc1394error_t vcam_regs_select_mode (vcam_regs_t * r, dc1394video_mode_t mode,
+        dc1394framerate_t framerate);
+dc1394error_t vcam_regs_set_mode (vcam_regs_t * r,
+        const dc1394video_frame_t * proto, dc1394framerate_t framerate);
+dc1394error_t vcam_regs_read (vcam_regs_t * r, uint64_t offset,
+        uint32_t * quads, int num_quads);
+dc1394error_t vcam_regs_write (vcam_regs_t * r, uint64_t offset,
+        const uint32_t * quads, int num_quads);
+uint32_t * vcam_regs_feature (vcam_regs_t * r, dc1394feature_t feature,
+        uint32_t base);
+
+/* Accessors for the command registers (offset relative to the command
+   register base) */
+#define VCAM_REG(r, offset)      ((r)->regs[(offset) / 4])
+#define VCAM_F7_REG(r, mode, offset) \
+    ((r)->regs[(VCAM_COMMAND_SIZE + (mode) * VCAM_FORMAT7_SIZE + (offset)) / 4])
+
+/* A ring of frame slots handed out to the user, with a timer file
+   descriptor that becomes readable when the next frame is due. */
+typedef struct {
+    dc1394video_frame_t    * frames;
+    unsigned char          * held;
+    uint32_t                 num_buffers;
+    uint32_t                 num_held;
+    int                      timer_fd;
+} vcam_ring_t;
+
+#define VCAM_NEVER               UINT64_MAX
+#define VCAM_CYCLE_TIMER_DRIFT   25e-6
+
+uint64_t vcam_get_time (void);
+void vcam_sleep_until (uint64_t time);
+dc1394error_t vcam_read_cycle_timer (platform_camera_t * cam,
+        uint32_t * cycle_timer, uint64_t * local_time);
+dc1394error_t vcam_ring_init (vcam_ring_t * ring, uint32_t num_buffers);
+void vcam_ring_free (vcam_ring_t * ring);
+dc1394video_frame_t * vcam_ring_take (vcam_ring_t * ring);
+dc1394error_t vcam_ring_release (vcam_ring_t * ring,
+        dc1394video_frame_t * frame);
+void vcam_ring_arm (vcam_ring_t * ring, uint64_t due);
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Measure the cost of the capture API: latency of the dequeue and enqueue
+ *    calls, frame rate ceiling and CPU time per frame, for each capture
+ *    policy and ring depth. Results are written as JSON.
+ *
+ * Meant to be run against the simulated or replay platforms, e.g.
+ *    DC1394_SIM=1 DC1394_SIM_FPS=100000 ./capture_benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <dc1394/dc1394.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define MAX_DEPTHS 16
+
+static const struct {
+    const char * name;
+    dc1394capture_policy_t policy;
+} policies[] = {
+    { "wait",   DC1394_CAPTURE_POLICY_WAIT },
+    { "poll",   DC1394_CAPTURE_POLICY_POLL },
+    { "latest", DC1394_CAPTURE_POLICY_LATEST },
+};
+#define NUM_POLICIES (sizeof (policies) / sizeof (policies[0]))
+
+typedef struct {
+    uint64_t * dequeue_ns;
+    uint64_t * enqueue_ns;
+    uint32_t   frames;
+    uint64_t   empty_polls;
+    uint64_t   elapsed_ns;
+    uint64_t   cpu_ns;
+    uint64_t   cycles;
+} run_t;
+
+static uint64_t
+get_ns (clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime (clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+get_cycles (void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc ();
+#else
+    return 0;
+#endif
+}
+
+static int
+compare_u64 (const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+print_percentiles (FILE * out, const char * name, uint64_t * v, uint32_t n)
+{
+    static const double p[] = { 50, 90, 99, 99.9 };
+    unsigned int i;
+
+    qsort (v, n, sizeof (uint64_t), compare_u64);
+    fprintf (out, "\"%s\": {", name);
+    for (i = 0; i < sizeof (p) / sizeof (p[0]); i++)
+        fprintf (out, "\"p%g\": %"PRIu64", ", p[i],
+                 n ? v[(uint32_t) (p[i] / 100 * (n - 1))] : 0);
+    fprintf (out, "\"max\": %"PRIu64"}", n ? v[n - 1] : 0);
+}
+
+static dc1394error_t
+run_benchmark (dc1394camera_t * camera, dc1394capture_policy_t policy,
+               uint32_t depth, uint32_t num_frames, run_t * run)
+{
+    dc1394video_frame_t * frame;
+    dc1394error_t err;
+    uint64_t t0, t1, start, cpu_start, cycles_start;
+
+    memset (run, 0, sizeof (run_t));
+    run->dequeue_ns = malloc (num_frames * sizeof (uint64_t));
+    run->enqueue_ns = malloc (num_frames * sizeof (uint64_t));
+    if (!run->dequeue_ns || !run->enqueue_ns)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+
+    err = dc1394_capture_setup (camera, depth, DC1394_CAPTURE_FLAGS_DEFAULT);
+    DC1394_ERR_RTN (err, "Could not setup camera");
+    err = dc1394_video_set_transmission (camera, DC1394_ON);
+    DC1394_ERR_CLN_RTN (err, dc1394_capture_stop (camera),
+                        "Could not start camera iso transmission");
+
+    start = get_ns (CLOCK_MONOTONIC);
+    cpu_start = get_ns (CLOCK_PROCESS_CPUTIME_ID);
+    cycles_start = get_cycles ();
+
+    while (run->frames < num_frames) {
+        t0 = get_ns (CLOCK_MONOTONIC);
+        err = dc1394_capture_dequeue (camera, policy, &frame);
+        t1 = get_ns (CLOCK_MONOTONIC);
+        if (err != DC1394_SUCCESS)
+            break;
+        if (frame == NULL) {
+            run->empty_polls++;
+            continue;
+        }
+        run->dequeue_ns[run->frames] = t1 - t0;
+
+        t0 = get_ns (CLOCK_MONOTONIC);
+        err = dc1394_capture_enqueue (camera, frame);
+        t1 = get_ns (CLOCK_MONOTONIC);
+        if (err != DC1394_SUCCESS)
+            break;
+        run->enqueue_ns[run->frames] = t1 - t0;
+        run->frames++;
+    }
+
+    run->cycles = get_cycles () - cycles_start;
+    run->cpu_ns = get_ns (CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    run->elapsed_ns = get_ns (CLOCK_MONOTONIC) - start;
+
+    dc1394_video_set_transmission (camera, DC1394_OFF);
+    dc1394_capture_stop (camera);
+    return err;
+}
+
+static void
+print_run (FILE * out, const char * policy, uint32_t depth, run_t * run,
+           int first)
+{
+    double seconds = run->elapsed_ns / 1e9;
+    uint32_t n = run->frames ? run->frames : 1;
+
+    fprintf (out, "%s\n    {\"policy\": \"%s\", \"ring_depth\": %u, "
+             "\"frames\": %u, \"empty_polls\": %"PRIu64", ",
+             first ? "" : ",", policy, depth, run->frames, run->empty_polls);
+    fprintf (out, "\"elapsed_s\": %.6f, \"frames_per_s\": %.1f, "
+             "\"cpu_ns_per_frame\": %"PRIu64", ",
+             seconds, seconds > 0 ? run->frames / seconds : 0,
+             run->cpu_ns / n);
+#ifdef HAVE_TSC
+    fprintf (out, "\"cycles_per_frame\": %"PRIu64", ", run->cycles / n);
+#else
+    fprintf (out, "\"cycles_per_frame\": null, ");
+#endif
+    fprintf (out, "\n     ");
+    print_percentiles (out, "dequeue_ns", run->dequeue_ns, run->frames);
+    fprintf (out, ",\n     ");
+    print_percentiles (out, "enqueue_ns", run->enqueue_ns, run->frames);
+    fprintf (out, "}");
+}
+
+static void
+usage (const char * name)
+{
+    fprintf (stderr, "Usage: %s [-n frames] [-d depth,depth,...] "
+             "[-p wait|poll|latest,...] [-o file.json]\n", name);
+    exit (1);
+}
+
+int main (int argc, char *argv[])
+{
+    dc1394_t * d;
+    dc1394camera_list_t * list;
+    dc1394camera_t * camera;
+    dc1394error_t err;
+    uint32_t depths[MAX_DEPTHS] = { 2, 4, 8, 16, 32 };
+    int num_depths = 5;
+    int use_policy[NUM_POLICIES] = { 1, 1, 1 };
+    uint32_t num_frames = 10000;
+    FILE * out = stdout;
+    int opt, first = 1;
+    unsigned int i, j;
+    char * s;
+    run_t run;
+
+    while ((opt = getopt (argc, argv, "n:d:p:o:")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_frames = strtoul (optarg, NULL, 0);
+            break;
+        case 'd':
+            num_depths = 0;
+            for (s = strtok (optarg, ","); s && num_depths < MAX_DEPTHS;
+                 s = strtok (NULL, ","))
+                depths[num_depths++] = strtoul (s, NULL, 0);
+            break;
+        case 'p':
+            memset (use_policy, 0, sizeof (use_policy));
+            for (s = strtok (optarg, ","); s; s = strtok (NULL, ","))
+                for (i = 0; i < NUM_POLICIES; i++)
+                    if (!strcmp (s, policies[i].name))
+                        use_policy[i] = 1;
+            break;
+        case 'o':
+            out = fopen (optarg, "w");
+            if (!out) {
+                perror (optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage (argv[0]);
+        }
+    }
+    if (num_frames == 0)
+        usage (argv[0]);
+
+    d = dc1394_new ();
+    if (!d)
+        return 1;
+    err = dc1394_camera_enumerate (d, &list);
+    DC1394_ERR_RTN (err, "Failed to enumerate cameras");
+
+    if (list->num == 0) {
+        dc1394_log_error ("No cameras found");
+        return 1;
+    }
+
+    camera = dc1394_camera_new (d, list->ids[0].guid);
+    if (!camera) {
+        dc1394_log_error ("Failed to initialize camera with guid %"PRIx64,
+                          list->ids[0].guid);
+        return 1;
+    }
+    dc1394_camera_free_list (list);
+
+    fprintf (out, "{\n  \"camera\": {\"guid\": \"%016"PRIx64"\", "
+             "\"vendor\": \"%s\", \"model\": \"%s\"},\n",
+             camera->guid, camera->vendor, camera->model);
+    fprintf (out, "  \"frames_per_run\": %u,\n  \"results\": [", num_frames);
+
+    for (i = 0; i < NUM_POLICIES; i++) {
+        if (!use_policy[i])
+            continue;
+        for (j = 0; j < num_depths; j++) {
+            err = run_benchmark (camera, policies[i].policy, depths[j],
+                                 num_frames, &run);
+            if (err != DC1394_SUCCESS)
+                dc1394_log_warning ("%s policy with %u buffers stopped "
+                                    "after %u frames", policies[i].name,
+                                    depths[j], run.frames);
+            print_run (out, policies[i].name, depths[j], &run, first);
+            first = 0;
+            free (run.dequeue_ns);
+            free (run.enqueue_ns);
+        }
+    }
+
+    fprintf (out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose (out);
+
+    dc1394_camera_free (camera);
+    dc1394_free (d);
+    return 0;
+}